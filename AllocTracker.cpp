@@ -0,0 +1,129 @@
+#include "AllocTracker.hpp"
+
+// in front of every tracked block, the user's memory starts ALLOC_HEADER_SIZE after it
+struct AllocHeader {
+    size_t size;
+    uint32 offset; // from what malloc returned to the user's memory
+    uint8 tag;
+};
+static_assert(sizeof(AllocHeader) <= ALLOC_HEADER_SIZE, "AllocHeader has to fit in front of the user's memory");
+// at the default alignment the user's memory is malloc's plus the header, with nothing to spare
+static_assert(alignof(std::max_align_t) >= ALLOC_HEADER_SIZE, "malloc has to align to ALLOC_HEADER_SIZE");
+
+struct AllocCounters {
+    std::atomic<uint64_t> allocations {0}, bytes {0};
+    std::atomic<int64_t> liveBytes {0}, peakBytes {0};
+    std::atomic<uint32> frameAllocations {0};
+    std::atomic<size_t> frameBytes {0};
+    // endAllocFrame's
+    uint32 lastFrameAllocations = 0, peakFrameAllocations = 0;
+    size_t lastFrameBytes = 0;
+};
+
+const char * allocTagNames[NUM_ALLOC_TAGS] = {"other", "room", "bullets", "sim", "render", "ui"};
+
+AllocCounters allocCounters[NUM_ALLOC_TAGS];
+thread_local uint8 allocTag = ALLOC_OTHER;
+thread_local uint64_t allocationsOnThread = 0;
+thread_local uint8 lastTagOnThread = ALLOC_OTHER;
+thread_local size_t lastSizeOnThread = 0;
+
+void * trackedAlloc(size_t size, size_t align)
+{
+    if (align < ALLOC_HEADER_SIZE) align = ALLOC_HEADER_SIZE;
+    if (size > SIZE_MAX - align - ALLOC_HEADER_SIZE) return nullptr;
+    // malloc aligns to ALLOC_HEADER_SIZE (see above), more has to be made room for
+    size_t extra = align > ALLOC_HEADER_SIZE ? align : 0;
+    uint8 * base = (uint8*)malloc(size + ALLOC_HEADER_SIZE + extra);
+    if (!base) return nullptr;
+    uintptr_t user = (uintptr_t(base) + ALLOC_HEADER_SIZE + align-1) & ~uintptr_t(align-1);
+
+    AllocHeader * header = (AllocHeader*)(user - ALLOC_HEADER_SIZE);
+    header->size = size;
+    header->offset = uint32(user - uintptr_t(base));
+    header->tag = allocTag;
+
+    AllocCounters& counters = allocCounters[allocTag];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    counters.frameAllocations.fetch_add(1, std::memory_order_relaxed);
+    counters.frameBytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = counters.liveBytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    int64_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !counters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+
+    allocationsOnThread++;
+    lastTagOnThread = allocTag;
+    lastSizeOnThread = size;
+    return (void*)user;
+}
+
+void trackedFree(void * memory)
+{
+    if (!memory) return;
+    AllocHeader * header = (AllocHeader*)((uint8*)memory - ALLOC_HEADER_SIZE);
+    allocCounters[header->tag].liveBytes.fetch_sub((int64_t)header->size, std::memory_order_relaxed);
+    free((uint8*)memory - header->offset);
+}
+
+void endAllocFrame()
+{
+    for (AllocCounters& counters : allocCounters) {
+        counters.lastFrameAllocations = counters.frameAllocations.exchange(0, std::memory_order_relaxed);
+        counters.lastFrameBytes = counters.frameBytes.exchange(0, std::memory_order_relaxed);
+        counters.peakFrameAllocations = MAX(counters.peakFrameAllocations, counters.lastFrameAllocations);
+    }
+}
+
+AllocTagStats allocTagStats(int tag)
+{
+    const AllocCounters& counters = allocCounters[tag];
+    return AllocTagStats {allocTagNames[tag], counters.allocations.load(), counters.bytes.load(),
+        counters.liveBytes.load(), counters.peakBytes.load(),
+        counters.lastFrameAllocations, counters.lastFrameBytes, counters.peakFrameAllocations};
+}
+
+uint64_t threadAllocations() { return allocationsOnThread; }
+int lastAllocTag() { return lastTagOnThread; }
+size_t lastAllocSize() { return lastSizeOnThread; }
+
+AllocScope::AllocScope(AllocTag tag)
+{
+    saved = allocTag;
+    allocTag = tag;
+}
+
+AllocScope::~AllocScope()
+{
+    allocTag = saved;
+}
+
+// every new and delete in the program
+void * trackedNew(size_t size, size_t align)
+{
+    void * memory = trackedAlloc(size ? size : 1, align);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+void * operator new(size_t size) { return trackedNew(size, 0); }
+void * operator new[](size_t size) { return trackedNew(size, 0); }
+void * operator new(size_t size, std::align_val_t align) { return trackedNew(size, (size_t)align); }
+void * operator new[](size_t size, std::align_val_t align) { return trackedNew(size, (size_t)align); }
+void * operator new(size_t size, const std::nothrow_t&) noexcept { return trackedAlloc(size ? size : 1, 0); }
+void * operator new[](size_t size, const std::nothrow_t&) noexcept { return trackedAlloc(size ? size : 1, 0); }
+void * operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return trackedAlloc(size ? size : 1, (size_t)align); }
+void * operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return trackedAlloc(size ? size : 1, (size_t)align); }
+
+void operator delete(void * memory) noexcept { trackedFree(memory); }
+void operator delete[](void * memory) noexcept { trackedFree(memory); }
+void operator delete(void * memory, size_t) noexcept { trackedFree(memory); }
+void operator delete[](void * memory, size_t) noexcept { trackedFree(memory); }
+void operator delete(void * memory, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete[](void * memory, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete(void * memory, size_t, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete[](void * memory, size_t, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete(void * memory, const std::nothrow_t&) noexcept { trackedFree(memory); }
+void operator delete[](void * memory, const std::nothrow_t&) noexcept { trackedFree(memory); }
+void operator delete(void * memory, std::align_val_t, const std::nothrow_t&) noexcept { trackedFree(memory); }
+void operator delete[](void * memory, std::align_val_t, const std::nothrow_t&) noexcept { trackedFree(memory); }
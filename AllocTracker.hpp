@@ -0,0 +1,73 @@
+#ifndef ALLOC_TRACKER_HPP
+#define ALLOC_TRACKER_HPP
+
+/*
+    heap allocation tracking by subsystem
+
+    the global operator new and delete are replaced, every allocation gets a
+    16 byte header with its size and the tag of the thread's innermost
+    ALLOC_SCOPE when it was made, and is counted against that tag: how many
+    and how many bytes in total, bytes live and their high-water mark, and
+    how many this frame. endAllocFrame closes a frame (the game calls it after
+    painting), keeping the last frame's counts and the most one frame has
+    ever made. the counters are relaxed atomics, any thread can allocate.
+
+    threadAllocations counts the calling thread's allocations on its own, so
+    the balance runner can tell whether a tick allocated (-allocassert).
+
+    only what goes through operator new is seen: GDI+ objects use their own
+    allocator, EntityPool records and behaviour frames come out of pools (the
+    pools' blocks are seen), malloc and the OS aren't.
+
+    the runtime's own code has to free through the same delete, so the game
+    links libstdc++ statically (CMakeLists.txt): a shared one would hand
+    blocks it allocated itself to this delete, or ours to its own.
+*/
+
+#include <atomic>
+#include <new>
+
+#define ALLOC_HEADER_SIZE 16
+
+enum AllocTag : uint8 {
+    ALLOC_OTHER,   // no scope, threads that aren't the game's
+    ALLOC_ROOM,    // generating, storing and restoring rooms and chunks
+    ALLOC_BULLETS,
+    ALLOC_SIM,     // the rest of a tick
+    ALLOC_RENDER,  // composing the frame
+    ALLOC_UI,      // HUD, menus and overlay
+    NUM_ALLOC_TAGS
+};
+
+struct AllocTagStats {
+    const char * name;
+    uint64_t allocations, bytes;  // ever
+    int64_t liveBytes, peakBytes;
+    uint32 frameAllocations;      // last frame
+    size_t frameBytes;
+    uint32 peakFrameAllocations;  // the most in one frame
+};
+
+extern const char * allocTagNames[NUM_ALLOC_TAGS];
+
+void * trackedAlloc(size_t size, size_t align); // null when out of memory
+void trackedFree(void * memory);
+
+void endAllocFrame();
+AllocTagStats allocTagStats(int tag);
+
+// by the calling thread
+uint64_t threadAllocations();
+int lastAllocTag();
+size_t lastAllocSize();
+
+// tags allocations on this thread until the end of the block, scopes nest
+struct AllocScope {
+    uint8 saved;
+    AllocScope(AllocTag tag);
+    ~AllocScope();
+};
+
+#define ALLOC_SCOPE(tag) AllocScope PROFILE_CONCAT(allocScope, __LINE__)(tag)
+
+#endif
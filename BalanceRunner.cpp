@@ -0,0 +1,1027 @@
+/*
+    headless balance runner
+
+    plays thousands of complete runs with autoplayPolicy and writes one row
+    per run to balance.csv and the totals to balance.json. upgrades come from
+    the save file and gameplay numbers from the tuning file, like in the game.
+
+    the game state is plain globals, so the runs are spread over worker
+    processes (this program again with -worker), one per core by default.
+    each takes every workers'th run and prints a result line per run on its
+    stdout, which the runner reads back through a pipe. a run only depends
+    on its seed, not on which worker played it or what it played before.
+
+    usage: BalanceRunner [runs] [workers] [depth] [seed]
+        depth is how many rooms deep the bot goes before heading back
+    or:    BalanceRunner -soak [hours] [seed]
+        plays runs back to back on one thread, writing throughput and memory
+        to soak.csv every SOAK_REPORT_SECONDS so slowdowns and leaks show up
+    or:    BalanceRunner -cavebench [caves] [size] [seed]
+        times cave generation on size x size cells (1024 by default), per phase
+    or:    BalanceRunner -entitybench [entities] [passes]
+        memory per entity and the time of a position update pass over them,
+        the pooled GameObject against the struct it replaced
+    or:    BalanceRunner -behaviourbench [enemies] [ticks]
+        enemy behaviours scattered through a big cave, mostly out of earshot,
+        against checking every enemy every tick like checkidle did
+    or:    BalanceRunner -timerbench [timers] [ticks]
+        the timer wheel with that many timers waiting up to 10 minutes, some
+        scheduled and cancelled every tick, against counting every one down
+    or:    BalanceRunner -swarmbench [enemies] [ticks]
+        enemies all chasing the player from a ring round it, steered with
+        separation (plain and SSE2) against running straight at the player
+    or:    BalanceRunner -allocassert [runs] [workers] [depth] [seed]
+        the balance runs, failing if any tick after the first
+        ALLOC_WARMUP_TICKS of a room heap allocates on the simulation thread
+    or:    BalanceRunner -check [name]
+        the fast paths against plain reference code, all of them or the one
+        named, failing if any differs. the telemetry check leaves a stream in
+        telemetry.bin for TelemetryDecoder to check. ctest runs both
+*/
+
+#define HEADLESS
+#include "Runner.cpp"
+#include <psapi.h>
+#include <algorithm>
+#include <random>
+
+#define BALANCE_CSV "balance.csv"
+#define BALANCE_JSON "balance.json"
+#define SOAK_CSV "soak.csv"
+#define SOAK_REPORT_SECONDS 60
+#define SIM_DELTA_TIME (1.0f/60.0f)
+#define SIM_MAX_TICKS (60*60*10) // 10 minutes of game time, runs past that time out
+#define ALLOC_WARMUP_TICKS 60 // after entering a room, before -allocassert counts a tick
+#define WORKER_RESULT "result" // starts a worker's line for a run, anything else it prints is passed on
+
+enum RunOutcome { RUN_VICTORY, RUN_LOSS, RUN_TIMEOUT };
+const char * outcomeNames[] = {"victory", "loss", "timeout"};
+
+struct RunResult {
+    uint32 seed;
+    int outcome;
+    uint32 ticks;
+    uint32 rooms;     // load zones walked through
+    uint32 maxDepth;  // deepest room reached
+    uint32 gems;      // picked up, banked or not
+    uint32 banked;    // brought out of the cave
+    float charge;     // flashlight charge left
+    uint32 allocatingTicks; // steady ticks that heap allocated, with -allocassert
+};
+
+// the loaded game's settings, applied at the start of each run
+SaveFields balanceFields;
+bool allocAssert = false;
+
+RunResult simulateRun(uint32 seed)
+{
+    RunResult result = {seed, RUN_TIMEOUT, 0, 0, 0, 0, 0, 0.0f, 0};
+    seedRandom(seed);
+    applySaveFields(balanceFields);
+    applyTuning();
+    uint32 gemsBefore = gemsSaved;
+    timer = 0.0f;
+    newRun();
+
+    setController(autoplayPolicy, seed);
+    size_t depth = roomQueue.size();
+    uint32 roomTicks = 0; // since entering the room
+    for (; result.ticks < SIM_MAX_TICKS; result.ticks++, roomTicks++) {
+        uint64_t allocations = threadAllocations();
+        runController();
+        tickGame(SIM_DELTA_TIME);
+        if (roomQueue.size() != depth) { // walked through a load zone
+            depth = roomQueue.size();
+            result.rooms++;
+            if (depth > 0) result.maxDepth = MAX(result.maxDepth, (uint32)depth-1);
+            roomTicks = 0;
+        } else if (allocAssert && roomTicks >= ALLOC_WARMUP_TICKS && threadAllocations() != allocations) {
+            if (result.allocatingTicks++ == 0) {
+                LOG_ERROR("steady tick allocated", "seed", seed, "tick", result.ticks,
+                    "tag", allocTagNames[lastAllocTag()], "bytes", lastAllocSize());
+            }
+        }
+        if (gameIsPaused) {
+            result.outcome = pauseState == VICTORY ? RUN_VICTORY : RUN_LOSS;
+            result.ticks++;
+            break;
+        }
+    }
+
+    result.banked = gemsSaved-gemsBefore;
+    result.gems = result.banked+numGems;
+    result.charge = flashLightCharge;
+    return result;
+}
+
+int writeBalanceCsv(const std::vector<RunResult>& results)
+{
+    FILE * file = fopen(BALANCE_CSV, "w");
+    if (!file) return -1;
+    fprintf(file, "run,seed,outcome,ticks,rooms,max_depth,gems,banked,charge\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const RunResult& r = results[i];
+        fprintf(file, "%zu,%u,%s,%u,%u,%u,%u,%u,%.2f\n", i, r.seed, outcomeNames[r.outcome],
+            r.ticks, r.rooms, r.maxDepth, r.gems, r.banked, r.charge);
+    }
+    fclose(file);
+    return 0;
+}
+
+int writeBalanceJson(const std::vector<RunResult>& results, int threads, double seconds)
+{
+    double outcomes[3] = {0, 0, 0}, gems = 0, banked = 0, rooms = 0, depth = 0, ticks = 0;
+    for (const RunResult& r : results) {
+        outcomes[r.outcome]++;
+        gems += r.gems; banked += r.banked; rooms += r.rooms; depth += r.maxDepth; ticks += r.ticks;
+    }
+    double n = MAX((double)results.size(), 1.0);
+
+    FILE * file = fopen(BALANCE_JSON, "w");
+    if (!file) return -1;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"runs\": %zu,\n  \"threads\": %d,\n  \"target_depth\": %d,\n", results.size(), threads, autoplayDepth);
+    fprintf(file, "  \"survival_rate\": %.4f,\n  \"loss_rate\": %.4f,\n  \"timeout_rate\": %.4f,\n",
+        outcomes[RUN_VICTORY]/n, outcomes[RUN_LOSS]/n, outcomes[RUN_TIMEOUT]/n);
+    fprintf(file, "  \"mean_gems\": %.3f,\n  \"mean_banked\": %.3f,\n  \"mean_rooms\": %.3f,\n  \"mean_max_depth\": %.3f,\n",
+        gems/n, banked/n, rooms/n, depth/n);
+    fprintf(file, "  \"total_ticks\": %.0f,\n  \"seconds\": %.3f,\n", ticks, seconds);
+    fprintf(file, "  \"ticks_per_second\": %.0f,\n  \"ticks_per_second_per_thread\": %.0f\n}\n",
+        ticks/seconds, ticks/seconds/threads);
+    fclose(file);
+    return 0;
+}
+
+size_t workingSetBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+}
+
+int soakTest(double hours, uint32 seed)
+{
+    FILE * file = fopen(SOAK_CSV, "w");
+    if (!file) return -1;
+    fprintf(file, "minutes,runs,ticks_per_second,objects,room_cache_kb,working_set_kb\n");
+
+    auto start = std::chrono::steady_clock::now(), lastReport = start;
+    uint64_t runs = 0, ticks = 0;
+    size_t firstWorkingSet = 0, workingSet = 0;
+    double minutes = 0.0;
+    while (minutes < hours*60.0) {
+        ticks += simulateRun(seed + (uint32)runs).ticks;
+        runs++;
+
+        auto now = std::chrono::steady_clock::now();
+        double sinceReport = std::chrono::duration<double>(now - lastReport).count();
+        if (sinceReport < SOAK_REPORT_SECONDS) continue;
+
+        // objects and cached rooms are what's left of the last run, the working set should stay flat
+        minutes = std::chrono::duration<double>(now - start).count() / 60.0;
+        RoomCacheStats cache = roomCacheStats();
+        workingSet = workingSetBytes();
+        if (!firstWorkingSet) firstWorkingSet = workingSet;
+        fprintf(file, "%.1f,%llu,%.0f,%zu,%zu,%zu\n", minutes, (unsigned long long)runs, ticks/sinceReport,
+            gameObjects.size(), (cache.hotBytes+cache.coldBytes)/1024, workingSet/1024);
+        fflush(file);
+        printf("soak %.1f min: %llu runs, %.0f ticks/s, working set %zu KB\n",
+            minutes, (unsigned long long)runs, ticks/sinceReport, workingSet/1024);
+        ticks = 0;
+        lastReport = now;
+    }
+    fclose(file);
+
+    printf("soak done, working set %zu KB -> %zu KB, per report results in " SOAK_CSV "\n",
+        firstWorkingSet/1024, workingSet/1024);
+    return 0;
+}
+
+int caveBenchmark(int caves, int size, uint32 seed)
+{
+    CaveGrid grid;
+    std::vector<CaveRect> rects;
+    CaveSpan exits = {size/2-2, size/2+2};
+    CaveTimings total = {0.0, 0.0, 0.0, 0.0};
+    double best = 1e30;
+    uint64_t rectCount = 0, wallCells = 0;
+    for (int i = 0; i < caves; i++) {
+        generateCave(grid, size, size, seed + (uint64_t)i, exits, exits);
+        mergeCaveWalls(grid, rects);
+
+        CaveTimings t = caveTimings();
+        total.fill += t.fill; total.smooth += t.smooth; total.connect += t.connect; total.merge += t.merge;
+        double ms = t.fill + t.smooth + t.connect + t.merge;
+        if (ms < best) best = ms;
+        rectCount += rects.size();
+        wallCells += caveWallCount(grid);
+    }
+
+    double n = (double)caves;
+    printf("%d caves of %dx%d cells: %.3f ms per cave, best %.3f ms\n", caves, size, size,
+        (total.fill+total.smooth+total.connect+total.merge)/n, best);
+    printf("  fill %.3f ms, smooth %.3f ms (%d steps), connect %.3f ms, merge %.3f ms\n",
+        total.fill/n, total.smooth/n, CAVE_SMOOTH_STEPS, total.connect/n, total.merge/n);
+    printf("  %.0f wall rectangles per cave, %.1f%% wall\n", rectCount/n, 100.0*wallCells/(n*size*size));
+    return 0;
+}
+
+// the GameObject from before it was packed into EntityPool records
+struct LegacyGameObject {
+    int health;
+    Vector2 pos;
+    Vector2 velocity;
+    float moveSpeed;
+    int entityType;
+    bool idle;
+    uint8 lodTier;
+    bool lodAwake;
+    float lodTime;
+    Gdiplus::Image * img;
+    int size[2];
+};
+
+// median distance between neighbouring objects, what one really takes up with the allocator's header and padding
+template <typename T>
+size_t allocatedBytes(const std::vector<T*>& objects)
+{
+    std::vector<uintptr_t> addresses(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) addresses[i] = (uintptr_t)objects[i];
+    std::sort(addresses.begin(), addresses.end());
+    std::vector<uintptr_t> gaps(addresses.size()-1);
+    for (size_t i = 1; i < addresses.size(); i++) gaps[i-1] = addresses[i]-addresses[i-1];
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size()/2, gaps.end());
+    return gaps[gaps.size()/2];
+}
+
+// updatePositions' loop through the gameObjects pointers, nanoseconds per object
+template <typename T>
+double positionPass(const std::vector<T*>& objects, int passes)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        for (T * obj : objects) {
+            obj->pos.x += obj->velocity.x * SIM_DELTA_TIME;
+            obj->pos.y += obj->velocity.y * SIM_DELTA_TIME;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds*1e9 / ((double)objects.size()*passes);
+}
+
+int entityBenchmark(int count, int passes)
+{
+    std::vector<LegacyGameObject*> legacy(count);
+    std::vector<GameObject*> compact(count);
+    for (int i = 0; i < count; i++) {
+        legacy[i] = new LegacyGameObject {5, {(float)i, 0.0f}, {1.0f, 1.0f}, 5.0f, ENEMY, true, LOD_NEAR, true, 0.0f, enemyImg, {30, 30}};
+        compact[i] = new GameObject(enemyImg, 5, (float)i, 0.0f, 5.0f, ENEMY, 1.0f, 1.0f);
+    }
+
+    size_t legacyBytes = allocatedBytes(legacy), compactBytes = allocatedBytes(compact);
+    printf("%d entities, plus %zu bytes each for the pointer in gameObjects\n", count, sizeof(GameObject*));
+    printf("  legacy:  %zu byte struct, %zu bytes allocated, %.2f per cache line\n",
+        sizeof(LegacyGameObject), legacyBytes, (double)ENTITY_LINE_SIZE/legacyBytes);
+    printf("  compact: %zu byte struct, %zu bytes allocated, %.2f per cache line\n",
+        sizeof(GameObject), compactBytes, (double)ENTITY_LINE_SIZE/compactBytes);
+
+    // in the order they were made, then shuffled like a cave that's had objects come and go
+    std::mt19937 shuffler(12345);
+    for (int order = 0; order < 2; order++) {
+        if (order == 1) {
+            std::shuffle(legacy.begin(), legacy.end(), shuffler);
+            std::shuffle(compact.begin(), compact.end(), shuffler);
+        }
+        positionPass(legacy, 1); positionPass(compact, 1); // warm up
+        double legacyNs = positionPass(legacy, passes), compactNs = positionPass(compact, passes);
+        printf("position pass, %s: legacy %.2f ns per entity (%.2f GB/s), compact %.2f ns (%.2f GB/s), %.2fx\n",
+            order ? "shuffled" : "in order", legacyNs, legacyBytes/legacyNs, compactNs, compactBytes/compactNs,
+            legacyNs/compactNs);
+    }
+
+    for (int i = 0; i < count; i++) {
+        delete legacy[i];
+        delete compact[i];
+    }
+    EntityPoolStats pool = entityPoolStats();
+    printf("entity pool: %zu blocks, %zu KB reserved, %zu live\n", pool.blocks, pool.reservedBytes/1024, pool.live);
+    return 0;
+}
+
+int behaviourBenchmark(int enemies, int ticks)
+{
+    seedRandom(1);
+    applySaveFields(balanceFields);
+    newRun();
+    deltaTime = SIM_DELTA_TIME;
+
+    // a 20000 pixel square around the player
+    uint32 state = 12345;
+    for (int i = 0; i < enemies; i++) {
+        state = state*1664525u + 1013904223u;
+        float x = player->pos.x + float(state >> 8) / 16777216.0f * 20000.0f - 10000.0f;
+        state = state*1664525u + 1013904223u;
+        float y = player->pos.y + float(state >> 8) / 16777216.0f * 20000.0f - 10000.0f;
+        gameObjects.push_back(new GameObject(enemyImg, 5, x, y, 5.0f, ENEMY));
+    }
+    auto start = std::chrono::steady_clock::now();
+    resetBehaviours();
+    double startMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    buildSpatialGrid();
+
+    uint64_t resumes = behaviourStats().totalResumes;
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) updateBehaviours();
+    double scheduledUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+    // what checkidle did, a distance to the player from every enemy every tick
+    uint32 heard = 0;
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) {
+        forEachEntity<ENEMY>([&heard](GameObject * enemy) {
+            const GameObject * target = nearestPlayer(enemy->pos.x, enemy->pos.y);
+            float dx = target->pos.x - enemy->pos.x, dy = target->pos.y - enemy->pos.y;
+            heard += dx*dx + dy*dy <= BEHAVIOUR_LISTEN_RADIUS*BEHAVIOUR_LISTEN_RADIUS;
+        });
+    }
+    double pollingUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+    BehaviourStats stats = behaviourStats();
+    resumes = stats.totalResumes - resumes;
+    printf("%d behaviours started in %.2f ms, %zu byte frames, %zu KB of frame pool\n",
+        stats.live, startMs, stats.frameBytes, stats.reservedBytes/1024);
+    printf("  scheduled: %.2f us per tick, %.1f resumed per tick\n", scheduledUs, (double)resumes/ticks);
+    printf("  polling every enemy: %.2f us per tick (%u heard)\n", pollingUs, heard);
+
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    clearRoomCache();
+    return 0;
+}
+
+int timerBenchmark(int count, int ticks)
+{
+    resetTimers();
+    int churn = MAX(count/1000, 1); // scheduled and cancelled per tick
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> delay(SIM_DELTA_TIME, 600.0f);
+
+    std::vector<TimerHandle> handles(count);
+    for (int i = 0; i < count; i++) handles[i] = scheduleTimer(TIMER_INVULNERABLE, delay(random));
+    uint64_t fired = timerStats().totalFired, cascaded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) {
+        for (int k = 0; k < churn; k++) {
+            TimerHandle& handle = handles[random() % count];
+            cancelTimer(handle);
+            handle = scheduleTimer(TIMER_INVULNERABLE, delay(random));
+        }
+        advanceTimers(SIM_DELTA_TIME);
+        cascaded += timerStats().cascaded;
+    }
+    double wheelUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+    TimerStats stats = timerStats();
+    fired = stats.totalFired - fired;
+
+    // seconds left on each, all counted down every tick like drainLight did
+    random.seed(1);
+    std::vector<float> left(count);
+    for (int i = 0; i < count; i++) left[i] = delay(random);
+    uint64_t expired = 0;
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) {
+        for (int k = 0; k < churn; k++) left[random() % count] = delay(random);
+        for (int i = 0; i < count; i++) {
+            if (left[i] <= 0.0f) continue;
+            left[i] -= SIM_DELTA_TIME;
+            expired += left[i] <= 0.0f;
+        }
+    }
+    double countdownUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ticks;
+
+    printf("%d timers, %d scheduled and cancelled per tick\n", count, churn);
+    printf("  wheel: %.2f us per tick, %.1f fired and %.1f cascaded per tick, %d live at the end\n",
+        wheelUs, (double)fired/ticks, (double)cascaded/ticks, stats.live);
+    printf("  counting every one down: %.2f us per tick (%llu expired)\n", countdownUs, (unsigned long long)expired);
+    resetTimers();
+    return 0;
+}
+
+// pairs of enemies overlapping each other
+int countEnemyOverlaps()
+{
+    buildSpatialGrid();
+    int overlaps = 0;
+    forEachEntity<ENEMY>([&overlaps](GameObject * enemy) {
+        queryRadius(enemy->pos.x + enemy->size[0]/2, enemy->pos.y + enemy->size[1]/2, enemy->size[0], [&](GameObject * other) {
+            if (other->entityType != ENEMY || other <= enemy) return; // each pair once
+            overlaps += fabsf(other->pos.x - enemy->pos.x) < enemy->size[0] && fabsf(other->pos.y - enemy->pos.y) < enemy->size[1];
+        });
+    });
+    return overlaps;
+}
+
+int swarmBenchmark(int enemies, int ticks)
+{
+    seedRandom(1);
+    applySaveFields(balanceFields);
+    newRun();
+    deltaTime = SIM_DELTA_TIME;
+
+    // a ring 100 - 700 pixels round the player
+    uint32 state = 12345;
+    for (int i = 0; i < enemies; i++) {
+        state = state*1664525u + 1013904223u;
+        float angle = float(state >> 8) / 16777216.0f * 6.2831853f;
+        state = state*1664525u + 1013904223u;
+        float distance = 100.0f + float(state >> 8) / 16777216.0f * 600.0f;
+        gameObjects.push_back(new GameObject(enemyImg, 5, player->pos.x + cosf(angle)*distance, player->pos.y + sinf(angle)*distance, 5.0f, ENEMY));
+    }
+    std::vector<GameObject*> swarm;
+    std::vector<Vector2> startPos;
+    forEachEntity<ENEMY>([&](GameObject * enemy) {
+        enemy->behaviour = BEHAVIOUR_CHASE;
+        enemy->lodAwake = true;
+        swarm.push_back(enemy);
+        startPos.push_back(enemy->pos);
+    });
+
+    // straight at the player like updateVelocities did, then steered by the plain loop and by SSE2
+    const char * names[3] = {"straight at the player", "steering, plain", "steering, SSE2"};
+    std::vector<Vector2> plainPos;
+    for (int mode = 0; mode < 3; mode++) {
+        for (size_t i = 0; i < swarm.size(); i++) swarm[i]->pos = startPos[i];
+        steeringSse2 = mode == 2;
+        double us = 0.0, neighbours = 0.0;
+        for (int t = 0; t < ticks; t++) {
+            buildSpatialGrid();
+            auto start = std::chrono::steady_clock::now();
+            if (mode == 0) {
+                for (GameObject * enemy : swarm) {
+                    int delta_x = player->pos.x - enemy->pos.x, delta_y = player->pos.y - enemy->pos.y;
+                    enemy->velocity.x = (delta_x/10) * enemy->moveSpeed;
+                    enemy->velocity.y = (delta_y/10) * enemy->moveSpeed;
+                }
+            } else steerEnemies();
+            us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            neighbours += steeringStats().neighbours;
+            for (GameObject * enemy : swarm) {
+                enemy->pos.x += enemy->velocity.x * SIM_DELTA_TIME;
+                enemy->pos.y += enemy->velocity.y * SIM_DELTA_TIME;
+            }
+        }
+        int overlaps = countEnemyOverlaps();
+        printf("%s: %.2f us per tick, %.1f ns per enemy, %d overlapping pairs at the end", names[mode],
+            us/ticks, us*1000.0/ticks/swarm.size(), overlaps);
+        if (mode > 0) printf(", %.2f neighbours each", neighbours/ticks/swarm.size());
+        if (mode == 2) {
+            bool same = true;
+            for (size_t i = 0; i < swarm.size(); i++) same = same && swarm[i]->pos.x == plainPos[i].x && swarm[i]->pos.y == plainPos[i].y;
+            printf(", %s the plain loop", same ? "the same as" : "DIFFERENT from");
+        }
+        printf("\n");
+        if (mode == 1) for (GameObject * enemy : swarm) plainPos.push_back(enemy->pos);
+    }
+    steeringSse2 = true;
+
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    clearRoomCache();
+    return 0;
+}
+
+// argument i as a number, fallback when it isn't there, never less than least
+int intArg(int argc, char ** argv, int i, int fallback, int least)
+{
+    int value = argc > i ? atoi(argv[i]) : fallback;
+    return MAX(value, least);
+}
+
+uint32 seedArg(int argc, char ** argv, int i) // the time when it isn't there
+{
+    return argc > i ? (uint32)strtoul(argv[i], NULL, 10) : (uint32)std::time(nullptr);
+}
+
+// cellular automaton steps against counting each cell's neighbours one by one
+bool checkCaveSmoothing()
+{
+    const int sizes[][2] = {{64, 64}, {130, 70}, {200, 33}, {1, 5}, {65, 1}};
+    uint64_t rng = 42;
+    for (const auto& size : sizes) {
+        CaveGrid grid, next;
+        grid.width = size[0]; grid.height = size[1];
+        grid.words = (grid.width+63) / 64;
+        grid.cells.resize(grid.words*grid.height);
+        next = grid;
+        fillCave(grid, &rng);
+        for (int step = 0; step < CAVE_SMOOTH_STEPS; step++) {
+            smoothCave(grid, next);
+            for (int y = 0; y < grid.height; y++) {
+                for (int x = 0; x < grid.width; x++) {
+                    int walls = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = x+dx, ny = y+dy;
+                            if (dx == 0 && dy == 0) continue;
+                            walls += nx < 0 || ny < 0 || nx >= grid.width || ny >= grid.height || grid.wall(nx, ny);
+                        }
+                    }
+                    bool wall = walls >= 5 || (walls == 4 && grid.wall(x, y));
+                    if (next.wall(x, y) != wall) {
+                        printf("cave smoothing: %dx%d step %d, cell %d,%d is %d, should be %d\n",
+                            grid.width, grid.height, step, x, y, (int)next.wall(x, y), (int)wall);
+                        return false;
+                    }
+                }
+            }
+            if ((next.cells[grid.words-1] & cavePadding(grid)) != cavePadding(grid)) {
+                printf("cave smoothing: %dx%d step %d, the padding bits aren't set\n", grid.width, grid.height, step);
+                return false;
+            }
+            grid.cells.swap(next.cells);
+        }
+    }
+    return true;
+}
+
+// every timer fires on exactly the slot it was due, through every level of the wheel, and cancelled ones never do
+bool checkTimerOrder()
+{
+    struct Expected {
+        TimerHandle handle;
+        uint32 due; // slot
+        bool cancelled;
+    };
+    resetTimers();
+    std::mt19937 random(7);
+    std::vector<Expected> timers;
+    uint32 slot = 0, last = 0;
+    auto schedule = [&](int count) {
+        for (int i = 0; i < count; i++) {
+            // mostly the first level, some long enough to come down from each level above
+            uint32 slots = 1 + random() % (i % 4 == 0 ? 1u << (TIMER_LEVEL0_BITS + 2*TIMER_LEVEL_BITS) : 600u);
+            timers.push_back(Expected {scheduleTimerSlots(TIMER_INVULNERABLE, slots, 0), slot + slots, false});
+            last = MAX(last, slot + slots);
+        }
+    };
+    schedule(2000);
+    for (size_t i = 0; i < timers.size(); i += 7) {
+        cancelTimer(timers[i].handle);
+        timers[i].cancelled = true;
+    }
+
+    bool passed = true;
+    for (; slot < last && passed; ) {
+        advanceTimerSlot();
+        slot++;
+        if (slot == 1000) schedule(500); // from somewhere other than the start of the wheel
+        int waiting = 0;
+        for (const Expected& timer : timers) {
+            bool due = timer.cancelled || timer.due <= slot;
+            if (timerScheduled(timer.handle) == due) {
+                printf("timer wheel: timer due on slot %u is %s on slot %u\n", timer.due, due ? "still waiting" : "gone", slot);
+                passed = false;
+                break;
+            }
+            waiting += !due;
+        }
+        if (passed && timerStats().live != waiting) {
+            printf("timer wheel: %d timers live on slot %u, should be %d\n", timerStats().live, slot, waiting);
+            passed = false;
+        }
+        // after the first few thousand slots, straight on to the one before the next timer due
+        if (slot > 2000) {
+            uint32 next = last;
+            for (const Expected& timer : timers) if (!timer.cancelled && timer.due > slot) next = MIN(next, timer.due);
+            while (slot+1 < next) {
+                advanceTimerSlot();
+                slot++;
+            }
+        }
+    }
+    resetTimers();
+    return passed;
+}
+
+// the wall index has to give every wall under a box once, the same ones as going through every wall
+bool checkWallIndex()
+{
+    seedRandom(5);
+    applySaveFields(balanceFields);
+    newRun();
+    std::mt19937 random(13);
+    bool passed = true;
+    for (int room = 0; room < 2 && passed; room++) {
+        if (room == 1) { // a wall moved, the index has to notice
+            for (GameObject * obj : gameObjects) if (obj->entityType == WALL) { obj->pos.x += 50.0f; break; }
+        }
+        buildSpatialGrid();
+        for (int q = 0; q < 20000 && passed; q++) {
+            int l = int(random() % (bkgWidth+200)) - 100, t = int(random() % (bkgHeight+200)) - 100;
+            int r = l + 1 + int(random() % 60), b = t + 1 + int(random() % 60);
+            std::vector<GameObject*> found, expected;
+            queryWalls(l, t, r, b, [&found](const WallShape& wall) {
+                found.push_back(wall.obj);
+                return false;
+            });
+            for (GameObject * obj : gameObjects) {
+                int l1 = obj->pos.x, t1 = obj->pos.y, r1 = l1+obj->size[0], b1 = t1+obj->size[1];
+                if (obj->entityType == WALL && !(r <= l1 || l >= r1 || b <= t1 || t >= b1)) expected.push_back(obj);
+            }
+            std::sort(found.begin(), found.end());
+            std::sort(expected.begin(), expected.end());
+            if (found != expected) {
+                printf("wall index: box %d,%d - %d,%d finds %zu walls, %zu overlap it\n", l, t, r, b, found.size(), expected.size());
+                passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+// a crowd steered by SSE2 and by the plain loop has to move the same to the bit, co-op peers may run either
+bool checkSteering()
+{
+    seedRandom(3);
+    applySaveFields(balanceFields);
+    newRun();
+    deltaTime = SIM_DELTA_TIME;
+    std::mt19937 random(11);
+    for (int i = 0; i < 400; i++) { // a tight ring, so most have neighbours and some more than STEER_MAX_NEIGHBOURS
+        float angle = float(random() % 6283) / 1000.0f, distance = 30.0f + float(random() % 300);
+        gameObjects.push_back(new GameObject(enemyImg, 5, player->pos.x + cosf(angle)*distance, player->pos.y + sinf(angle)*distance, 5.0f, ENEMY));
+    }
+    std::vector<GameObject*> swarm;
+    std::vector<Vector2> startPos, plainVelocity;
+    forEachEntity<ENEMY>([&](GameObject * enemy) {
+        enemy->behaviour = BEHAVIOUR_CHASE;
+        enemy->lodAwake = true;
+        swarm.push_back(enemy);
+        startPos.push_back(enemy->pos);
+    });
+
+    bool passed = true;
+    for (int mode = 0; mode < 2; mode++) {
+        for (size_t i = 0; i < swarm.size(); i++) swarm[i]->pos = startPos[i];
+        steeringSse2 = mode == 1;
+        for (int t = 0; t < 120 && passed; t++) {
+            buildSpatialGrid();
+            steerEnemies();
+            for (size_t i = 0; i < swarm.size(); i++) {
+                GameObject * enemy = swarm[i];
+                if (mode == 0) plainVelocity.push_back(enemy->velocity);
+                else if (memcmp(&enemy->velocity, &plainVelocity[t*swarm.size() + i], sizeof(Vector2)) != 0) {
+                    printf("steering: enemy %zu on tick %d goes %g,%g with SSE2, %g,%g plain\n", i, t, enemy->velocity.x, enemy->velocity.y,
+                        plainVelocity[t*swarm.size() + i].x, plainVelocity[t*swarm.size() + i].y);
+                    passed = false;
+                    break;
+                }
+                enemy->pos.x += enemy->velocity.x * SIM_DELTA_TIME;
+                enemy->pos.y += enemy->velocity.y * SIM_DELTA_TIME;
+            }
+        }
+    }
+    steeringSse2 = true;
+
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    clearRoomCache();
+    return passed;
+}
+
+// sprite blends of every length and alignment against blendPixel one pixel at a time
+bool checkSpriteBlend()
+{
+    std::mt19937 random(5);
+    std::vector<uint32> src(64), dst(64), expected(64);
+    for (int round = 0; round < 2000; round++) {
+        int count = 1 + round % 40, offset = round % 7;
+        for (int i = 0; i < count+offset; i++) {
+            // premultiplied, with runs of clear and opaque like a real sprite
+            uint32 kind = random() % 4, alpha = kind == 0 ? 0 : kind == 1 ? 255 : random() % 256;
+            uint32 pixel = alpha << 24;
+            for (int shift = 0; shift < 24; shift += 8) pixel |= (random() % (alpha+1)) << shift;
+            src[i] = pixel;
+            dst[i] = expected[i] = random();
+        }
+        for (int i = offset; i < count+offset; i++) {
+            uint32 alpha = src[i] >> 24;
+            if (alpha) expected[i] = alpha == 255 ? src[i] : blendPixel(src[i], expected[i]);
+        }
+        blendRow(&src[offset], &dst[offset], count);
+        for (int i = 0; i < count+offset; i++) {
+            if (dst[i] != expected[i]) {
+                printf("sprite blend: %d pixels from %d, pixel %d is %08x, should be %08x\n", count, offset, i, dst[i], expected[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// the capture's SSE2 YUV conversion against the scalar one, 2 pixels at a time, including the saturated colours
+bool checkCaptureYuv()
+{
+    std::mt19937 random(9);
+    const uint32 corners[] = {0xff0000ff, 0xffff0000, 0xff00ff00, 0xffffffff, 0xff000000, 0xffff00ff, 0xff00ffff, 0xffffff00};
+    uint32 rows[2][16];
+    uint8 y[2][2][16], u[2][8], v[2][8];
+    for (int round = 0; round < 20000; round++) {
+        for (int i = 0; i < 32; i++) {
+            uint32 pixel = random();
+            rows[i/16][i%16] = round % 4 == 0 ? corners[pixel % 8] : pixel | 0xff000000; // flat blocks of the extremes too
+        }
+        convertRowPair(rows[0], rows[1], 16, y[0][0], y[0][1], u[0], v[0]);
+        for (int x = 0; x < 16; x += 2) convertRowPair(rows[0]+x, rows[1]+x, 2, y[1][0]+x, y[1][1]+x, u[1]+x/2, v[1]+x/2);
+        if (memcmp(y[0], y[1], sizeof(y[0])) != 0 || memcmp(u[0], u[1], sizeof(u[0])) != 0 || memcmp(v[0], v[1], sizeof(v[0])) != 0) {
+            printf("capture yuv: the SSE2 and scalar conversions differ, first pixel %08x\n", rows[0][0]);
+            return false;
+        }
+    }
+    // pure blue and red have the most chroma there is
+    for (int i = 0; i < 16; i++) rows[0][i] = rows[1][i] = i < 8 ? 0xff0000ff : 0xffff0000;
+    convertRowPair(rows[0], rows[1], 16, y[0][0], y[0][1], u[0], v[0]);
+    if (u[0][0] != 255 || v[0][4] != 255) {
+        printf("capture yuv: blue has Cb %d and red has Cr %d, both should be 255\n", u[0][0], v[0][4]);
+        return false;
+    }
+    return true;
+}
+
+// one autoplay run encoded to TELEMETRY_FILE with every tick in it, ctest then has TelemetryDecoder
+// rebuild it and compare with the keyframes
+bool checkTelemetry()
+{
+    if (startTelemetry(60) != 0) {
+        printf("telemetry: can't write " TELEMETRY_FILE "\n");
+        return false;
+    }
+    seedRandom(1);
+    applySaveFields(balanceFields);
+    timer = 0.0f;
+    newRun();
+    setController(autoplayPolicy, 1);
+    for (int t = 0; t < SIM_MAX_TICKS && !gameIsPaused; t++) {
+        runController();
+        tickGame(SIM_DELTA_TIME);
+        publishTelemetry(SIM_DELTA_TIME);
+        while (telemetryBusy.load()) std::this_thread::yield(); // no dropped ticks, each gets its own delta
+    }
+    stopTelemetry();
+    setController(nullptr, 0);
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    clearRoomCache();
+
+    TelemetryStats stats = telemetryStats();
+    if (stats.keyframes < 2 || stats.deltas == 0 || stats.dropped != 0) {
+        printf("telemetry: %u keyframes, %u deltas and %u dropped ticks\n", stats.keyframes, stats.deltas, stats.dropped);
+        return false;
+    }
+    return true;
+}
+
+struct RunnerCheck {
+    const char * name;
+    bool (*run)();
+};
+
+const RunnerCheck runnerChecks[] = {
+    {"cave", checkCaveSmoothing},
+    {"timers", checkTimerOrder},
+    {"walls", checkWallIndex},
+    {"steering", checkSteering},
+    {"blend", checkSpriteBlend},
+    {"yuv", checkCaptureYuv},
+    {"telemetry", checkTelemetry},
+};
+
+// every check, or only the one named, 1 if any fails
+int runChecks(const char * only)
+{
+    int failed = 0, ran = 0;
+    for (const RunnerCheck& check : runnerChecks) {
+        if (only && strcmp(only, check.name) != 0) continue;
+        bool passed = check.run();
+        printf("%s: %s\n", check.name, passed ? "ok" : "FAILED");
+        failed += !passed;
+        ran++;
+    }
+    if (!ran) {
+        fprintf(stderr, "no check called %s\n", only);
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
+
+// plays runs index, index+workers, ... and prints a result line for each
+int runWorker(int index, int workers, int runs, uint32 seed)
+{
+    for (int run = index; run < runs; run += workers) {
+        RunResult r = simulateRun(seed + (uint32)run);
+        printf(WORKER_RESULT " %d %u %d %u %u %u %u %u %a %u\n", run, r.seed, r.outcome, r.ticks, r.rooms,
+            r.maxDepth, r.gems, r.banked, r.charge, r.allocatingTicks);
+        fflush(stdout);
+    }
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    clearRoomCache();
+    return 0;
+}
+
+struct Worker {
+    HANDLE process;
+    HANDLE output; // read end of its stdout
+};
+
+// starts this program again with args, false if it couldn't
+bool startWorker(const std::string& args, Worker * worker)
+{
+    char path[MAX_PATH];
+    if (!GetModuleFileNameA(NULL, path, MAX_PATH)) return false;
+    std::string command = std::string("\"") + path + "\" " + args;
+
+    SECURITY_ATTRIBUTES inherit = {sizeof(inherit), NULL, TRUE};
+    HANDLE readEnd, writeEnd;
+    if (!CreatePipe(&readEnd, &writeEnd, &inherit, 0)) return false;
+    SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0); // only the write end goes to the worker
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = writeEnd;
+    startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    PROCESS_INFORMATION info;
+    BOOL started = CreateProcessA(NULL, &command[0], NULL, NULL, TRUE, 0, NULL, NULL, &startup, &info);
+    CloseHandle(writeEnd); // the pipe ends when the worker's copy closes
+    if (!started) {
+        CloseHandle(readEnd);
+        return false;
+    }
+    CloseHandle(info.hThread);
+    worker->process = info.hProcess;
+    worker->output = readEnd;
+    return true;
+}
+
+// reads a worker's stdout until it exits, filling in the results it prints
+void readWorker(const Worker& worker, std::vector<RunResult>& results, std::vector<bool>& done, std::mutex& printMutex)
+{
+    std::string pending;
+    char buffer[4096];
+    DWORD bytes;
+    while (ReadFile(worker.output, buffer, sizeof(buffer), &bytes, NULL) && bytes > 0) {
+        pending.append(buffer, bytes);
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, end);
+            pending.erase(0, end+1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+
+            RunResult r;
+            int run;
+            if (sscanf(line.c_str(), WORKER_RESULT " %d %u %d %u %u %u %u %u %a %u", &run, &r.seed, &r.outcome, &r.ticks,
+                    &r.rooms, &r.maxDepth, &r.gems, &r.banked, &r.charge, &r.allocatingTicks) == 10 &&
+                    run >= 0 && run < (int)results.size()) {
+                results[run] = r;
+                done[run] = true;
+            } else { // its log
+                std::lock_guard<std::mutex> lock(printMutex);
+                printf("%s\n", line.c_str());
+            }
+        }
+    }
+    CloseHandle(worker.output);
+}
+
+// the balance runs, or the -allocassert ones
+int balanceRuns(int argc, char ** argv)
+{
+    int runs = intArg(argc, argv, 1, 1000, 0);
+    int threads = intArg(argc, argv, 2, (int)std::thread::hardware_concurrency(), 1);
+    autoplayDepth = intArg(argc, argv, 3, autoplayDepth, 0);
+    uint32 seed = seedArg(argc, argv, 4);
+
+    // a worker process per core, each plays every threads'th run
+    std::vector<RunResult> results(runs);
+    std::vector<bool> done(runs, false);
+    std::mutex printMutex;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Worker> workers;
+    std::vector<std::thread> readers;
+    int workerCount = std::min(threads, std::max(runs, 1));
+    for (int w = 0; w < workerCount; w++) {
+        char args[128];
+        snprintf(args, sizeof(args), "-worker %d %d %d %d %u %d", w, workerCount, runs, autoplayDepth, seed, allocAssert ? 1 : 0);
+        Worker started;
+        if (!startWorker(args, &started)) {
+            LOG_ERROR("couldn't start a worker", "index", w);
+            break;
+        }
+        workers.push_back(started);
+    }
+    for (const Worker& w : workers) readers.emplace_back(readWorker, std::cref(w), std::ref(results), std::ref(done), std::ref(printMutex));
+    for (std::thread& reader : readers) reader.join();
+    bool workersFailed = workers.empty();
+    for (const Worker& w : workers) {
+        DWORD code = 1;
+        WaitForSingleObject(w.process, INFINITE);
+        GetExitCodeProcess(w.process, &code);
+        CloseHandle(w.process);
+        workersFailed = workersFailed || code != 0;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int missing = (int)std::count(done.begin(), done.end(), false);
+    if (workersFailed || missing) {
+        fprintf(stderr, "workers failed, %d of %d runs have no result\n", missing, runs);
+        return 1;
+    }
+    if (writeBalanceCsv(results) != 0 || writeBalanceJson(results, workerCount, seconds) != 0) {
+        fprintf(stderr, "failed to write results\n");
+        return 1;
+    }
+    uint64_t ticks = 0;
+    for (const RunResult& r : results) ticks += r.ticks;
+    printf("%d runs on %d workers in %.2fs, %.0f ticks/s (%.0f per worker), results in " BALANCE_CSV " and " BALANCE_JSON "\n",
+        runs, workerCount, seconds, ticks/seconds, ticks/seconds/workerCount);
+    if (allocAssert) {
+        uint64_t allocating = 0;
+        int failed = 0;
+        for (const RunResult& r : results) {
+            allocating += r.allocatingTicks;
+            failed += r.allocatingTicks > 0;
+        }
+        if (failed) {
+            fprintf(stderr, "%d runs had %llu steady ticks that allocated, see the log\n", failed, (unsigned long long)allocating);
+            return 1;
+        }
+        printf("no steady tick allocated\n");
+    }
+    return 0;
+}
+
+// the first argument picks one of these, without one it's the balance runs
+struct RunnerMode {
+    const char * flag;
+    int (*run)(int argc, char ** argv); // argv[1] is the first argument after the flag
+};
+
+const RunnerMode runnerModes[] = {
+    {"-soak", [](int argc, char ** argv) {
+        return soakTest(argc > 1 ? atof(argv[1]) : 24.0, seedArg(argc, argv, 2));
+    }},
+    {"-cavebench", [](int argc, char ** argv) {
+        return caveBenchmark(intArg(argc, argv, 1, 100, 1), intArg(argc, argv, 2, 1024, 32), seedArg(argc, argv, 3));
+    }},
+    {"-entitybench", [](int argc, char ** argv) {
+        return entityBenchmark(intArg(argc, argv, 1, 1000000, 2), intArg(argc, argv, 2, 20, 1));
+    }},
+    {"-behaviourbench", [](int argc, char ** argv) {
+        return behaviourBenchmark(intArg(argc, argv, 1, 10000, 1), intArg(argc, argv, 2, 600, 1));
+    }},
+    {"-timerbench", [](int argc, char ** argv) {
+        return timerBenchmark(intArg(argc, argv, 1, 100000, 1), intArg(argc, argv, 2, 3600, 1));
+    }},
+    {"-swarmbench", [](int argc, char ** argv) {
+        return swarmBenchmark(intArg(argc, argv, 1, 500, 1), intArg(argc, argv, 2, 600, 1));
+    }},
+    {"-allocassert", [](int argc, char ** argv) {
+        allocAssert = true;
+        return balanceRuns(argc, argv);
+    }},
+    {"-check", [](int argc, char ** argv) {
+        return runChecks(argc > 1 ? argv[1] : nullptr);
+    }},
+    {"-worker", [](int argc, char ** argv) { // index workers runs depth seed allocassert, started by balanceRuns
+        autoplayDepth = intArg(argc, argv, 4, autoplayDepth, 0);
+        allocAssert = intArg(argc, argv, 6, 0, 0) != 0;
+        return runWorker(intArg(argc, argv, 1, 0, 0), intArg(argc, argv, 2, 1, 1), intArg(argc, argv, 3, 0, 0), seedArg(argc, argv, 5));
+    }},
+};
+
+int main(int argc, char ** argv)
+{
+    const RunnerMode * mode = nullptr;
+    for (const RunnerMode& m : runnerModes) if (argc > 1 && strcmp(argv[1], m.flag) == 0) mode = &m;
+    if (mode) { argv++; argc--; }
+
+    // room size comes from the background image
+    Gdiplus::GdiplusStartupInput gdiplusStartupInput;
+    ULONG_PTR gdiplusToken;
+    Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+    loadImages();
+    loadGlobals();
+    balanceFields = collectSaveFields();
+    profilerEnabled = false;
+    startLogger();
+    loadTuning(); // the runs play with the tuning file as it is now
+    applyTuning();
+
+    int res = mode ? mode->run(argc, argv) : balanceRuns(argc, argv);
+
+    stopLogger();
+    Gdiplus::GdiplusShutdown(gdiplusToken);
+    return res;
+}
@@ -0,0 +1,385 @@
+#include "Behaviour.hpp"
+
+#include <algorithm>
+
+// one per enemy with a behaviour
+struct BehaviourSlot {
+    GameObject * enemy;             // null when the slot is free
+    std::coroutine_handle<> handle;
+    uint32 waitId;                  // counts waits, so timers left from an earlier one are ignored
+    uint8 conditions;               // what it's waiting for, 0 while it runs
+    uint8 woke;                     // what woke it
+    float radius;                   // WAKE_NEAR
+    uint32 deadline;                // WAKE_TIMER, in behaviourTick
+};
+
+struct BehaviourTimer {
+    uint32 deadline;
+    uint32 waitId;
+    int slot;
+};
+
+// frames, a free list per size
+struct BehaviourFramePool {
+    void * free[BEHAVIOUR_FRAME_MAX/BEHAVIOUR_FRAME_ALIGN] = {};
+    std::vector<void*> blocks;
+    size_t reservedBytes = 0, frameBytes = 0;
+
+    ~BehaviourFramePool() {
+        for (void * block : blocks) ::operator delete(block, std::align_val_t(BEHAVIOUR_FRAME_ALIGN));
+    }
+};
+
+BehaviourFramePool behaviourFrames;
+std::vector<BehaviourSlot> behaviourSlots;
+std::vector<int> freeBehaviourSlots;
+std::unordered_map<GameObject*, int> behaviourIndex;
+std::vector<BehaviourTimer> behaviourTimers; // heap, soonest first
+std::vector<int> wokenBehaviours;            // this tick's, resumed together
+uint32 behaviourTick = 0;
+int runningBehaviour = -1; // the slot being resumed, for BehaviourWait
+int nearWaiting = 0, litWaiting = 0;
+uint32 behaviourResumes = 0;
+uint64_t totalBehaviourResumes = 0;
+
+size_t behaviourFrameSize(size_t bytes)
+{
+    return (bytes + BEHAVIOUR_FRAME_ALIGN-1) / BEHAVIOUR_FRAME_ALIGN * BEHAVIOUR_FRAME_ALIGN;
+}
+
+void * BehaviourTask::promise_type::operator new(size_t bytes)
+{
+    if (bytes > BEHAVIOUR_FRAME_MAX) return ::operator new(bytes);
+    BehaviourFramePool& pool = behaviourFrames;
+    size_t size = behaviourFrameSize(bytes);
+    pool.frameBytes = size;
+    void *& list = pool.free[size/BEHAVIOUR_FRAME_ALIGN - 1];
+    if (!list) {
+        char * block = static_cast<char*>(::operator new(size*BEHAVIOUR_FRAME_BLOCK, std::align_val_t(BEHAVIOUR_FRAME_ALIGN)));
+        pool.blocks.push_back(block);
+        pool.reservedBytes += size*BEHAVIOUR_FRAME_BLOCK;
+        for (int i = BEHAVIOUR_FRAME_BLOCK-1; i >= 0; i--) {
+            void * frame = block + (size_t)i*size;
+            *static_cast<void**>(frame) = list;
+            list = frame;
+        }
+    }
+    void * frame = list;
+    list = *static_cast<void**>(frame);
+    return frame;
+}
+
+void BehaviourTask::promise_type::operator delete(void * frame, size_t bytes)
+{
+    if (bytes > BEHAVIOUR_FRAME_MAX) {
+        ::operator delete(frame);
+        return;
+    }
+    void *& list = behaviourFrames.free[behaviourFrameSize(bytes)/BEHAVIOUR_FRAME_ALIGN - 1];
+    *static_cast<void**>(frame) = list;
+    list = frame;
+}
+
+bool laterTimer(const BehaviourTimer& a, const BehaviourTimer& b)
+{
+    return a.deadline > b.deadline;
+}
+
+void BehaviourWait::await_suspend(std::coroutine_handle<> handle)
+{
+    slot = runningBehaviour;
+    BehaviourSlot& s = behaviourSlots[slot];
+    s.conditions = conditions;
+    s.radius = radius;
+    s.waitId++;
+    if (conditions & WAKE_NEAR) nearWaiting++;
+    if (conditions & WAKE_LIT) litWaiting++;
+    if (conditions & WAKE_TIMER) {
+        s.deadline = behaviourTick + (ticks ? ticks : 1);
+        behaviourTimers.push_back(BehaviourTimer {s.deadline, s.waitId, slot});
+        std::push_heap(behaviourTimers.begin(), behaviourTimers.end(), laterTimer);
+    }
+}
+
+uint8 BehaviourWait::await_resume() const
+{
+    return behaviourSlots[slot].woke;
+}
+
+void clearBehaviourWait(BehaviourSlot& s)
+{
+    if (s.conditions & WAKE_NEAR) nearWaiting--;
+    if (s.conditions & WAKE_LIT) litWaiting--;
+    s.conditions = 0;
+}
+
+// queued for the end of updateBehaviours, once however many conditions hold
+void wakeBehaviour(int slot, uint8 reason)
+{
+    BehaviourSlot& s = behaviourSlots[slot];
+    if (!(s.conditions & reason)) return;
+    clearBehaviourWait(s);
+    s.woke = reason;
+    wokenBehaviours.push_back(slot);
+}
+
+void resumeBehaviour(int slot)
+{
+    int outer = runningBehaviour;
+    runningBehaviour = slot;
+    behaviourSlots[slot].handle.resume();
+    runningBehaviour = outer;
+    behaviourResumes++;
+    totalBehaviourResumes++;
+}
+
+// a wait in ticks of the current length, or what was left of one
+uint32 behaviourTicks(float seconds, uint32 resumeTicks)
+{
+    if (resumeTicks) return resumeTicks;
+    float dt = deltaTime > 0.0f ? deltaTime : 1.0f/60.0f;
+    uint32 ticks = (uint32)(seconds/dt + 0.5f);
+    return ticks ? ticks : 1;
+}
+
+// 0 - 1 from where the enemy is and the tick, the same whatever order behaviours run in
+float behaviourRandom(const GameObject * enemy)
+{
+    uint32 x, y;
+    memcpy(&x, &enemy->pos.x, sizeof(x));
+    memcpy(&y, &enemy->pos.y, sizeof(y));
+    uint32 h = x*0x9e3779b1u ^ y*0x85ebca77u ^ behaviourTick*0xc2b2ae3du;
+    h ^= h >> 15; h *= 0x2c1b3c6du;
+    h ^= h >> 12; h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return float(h >> 8) / 16777216.0f;
+}
+
+bool playerWithin(const GameObject * enemy, float radius)
+{
+    float x = enemy->pos.x + enemy->size[0]/2, y = enemy->pos.y + enemy->size[1]/2;
+    for (int p = 0; p < avatarCount(); p++) {
+        const GameObject * avatar = playerAvatar(p);
+        float dx = avatar->pos.x + avatar->size[0]/2 - x, dy = avatar->pos.y + avatar->size[1]/2 - y;
+        if (dx*dx + dy*dy <= radius*radius) return true;
+    }
+    return false;
+}
+
+BehaviourTask enemyBehaviour(GameObject * enemy, uint32 resumeTicks)
+{
+    // each step is one wait, so a behaviour can be started again at any of them
+    for (;;) {
+        switch (enemy->behaviour) {
+        case BEHAVIOUR_PATROL: {
+            // wander a leg at a time until a player is heard, or sleep if there's nobody about
+            if (!resumeTicks && !playerWithin(enemy, BEHAVIOUR_WAKE_RADIUS)) {
+                enemy->behaviour = BEHAVIOUR_SLEEP;
+                break;
+            }
+            if (!resumeTicks) {
+                float angle = behaviourRandom(enemy) * 6.2831853f, speed = enemy->moveSpeed * BEHAVIOUR_PATROL_SPEED;
+                enemy->velocity = Vector2 {cosf(angle)*speed, sinf(angle)*speed};
+            }
+            uint8 woke = co_await BehaviourWait {WAKE_NEAR | WAKE_TIMER, BEHAVIOUR_LISTEN_RADIUS,
+                behaviourTicks(BEHAVIOUR_PATROL_SECONDS, resumeTicks)};
+            if (woke == WAKE_NEAR) enemy->behaviour = BEHAVIOUR_LISTEN;
+            break;
+        }
+        case BEHAVIOUR_LISTEN: {
+            // stand still, the flashlight or coming close gives the player away
+            if (!resumeTicks) enemy->velocity = Vector2 {0.0f, 0.0f};
+            uint8 woke = co_await BehaviourWait {WAKE_NEAR | WAKE_LIT | WAKE_TIMER, BEHAVIOUR_CHASE_RADIUS,
+                behaviourTicks(BEHAVIOUR_LISTEN_SECONDS, resumeTicks)};
+            enemy->behaviour = woke == WAKE_TIMER ? BEHAVIOUR_PATROL : BEHAVIOUR_CHASE;
+            break;
+        }
+        case BEHAVIOUR_SLEEP:
+            enemy->velocity = Vector2 {0.0f, 0.0f};
+            co_await BehaviourWait {WAKE_NEAR, BEHAVIOUR_WAKE_RADIUS, 0};
+            enemy->behaviour = BEHAVIOUR_PATROL;
+            break;
+        case BEHAVIOUR_CHASE:
+            // updateVelocities steers it until it gets shot
+            co_await BehaviourWait {WAKE_HIT, 0.0f, 0};
+            enemy->behaviour = BEHAVIOUR_FLEE;
+            break;
+        default: {
+            // straight away from the nearest player for a moment
+            if (!resumeTicks) {
+                const GameObject * target = nearestPlayer(enemy->pos.x, enemy->pos.y);
+                Vector2 away = {enemy->pos.x-target->pos.x, enemy->pos.y-target->pos.y};
+                float len = away.length(), speed = enemy->moveSpeed * BEHAVIOUR_FLEE_SPEED;
+                if (len > 0.0f) enemy->velocity = Vector2 {away.x/len*speed, away.y/len*speed};
+            }
+            co_await BehaviourWait {WAKE_TIMER, 0.0f, behaviourTicks(BEHAVIOUR_FLEE_SECONDS, resumeTicks)};
+            enemy->behaviour = BEHAVIOUR_CHASE;
+            break;
+        }
+        }
+        resumeTicks = 0;
+    }
+}
+
+void startBehaviour(GameObject * enemy, uint32 resumeTicks)
+{
+    stopBehaviour(enemy);
+    int slot;
+    if (!freeBehaviourSlots.empty()) {
+        slot = freeBehaviourSlots.back();
+        freeBehaviourSlots.pop_back();
+    } else {
+        slot = (int)behaviourSlots.size();
+        behaviourSlots.push_back(BehaviourSlot {});
+        // room for every slot to wake and wait, so ticks don't grow them (timers can be stale for a while)
+        wokenBehaviours.reserve(behaviourSlots.capacity());
+        behaviourTimers.reserve(2*behaviourSlots.capacity());
+    }
+    BehaviourSlot& s = behaviourSlots[slot];
+    s.enemy = enemy;
+    s.conditions = 0;
+    s.handle = enemyBehaviour(enemy, resumeTicks).handle;
+    behaviourIndex[enemy] = slot;
+    resumeBehaviour(slot); // up to its first wait
+}
+
+void stopBehaviour(GameObject * enemy)
+{
+    auto found = behaviourIndex.find(enemy);
+    if (found == behaviourIndex.end()) return;
+    int slot = found->second;
+    BehaviourSlot& s = behaviourSlots[slot];
+    clearBehaviourWait(s);
+    s.waitId++;
+    s.handle.destroy();
+    s.handle = nullptr;
+    s.enemy = nullptr;
+    freeBehaviourSlots.push_back(slot);
+    behaviourIndex.erase(found);
+}
+
+void stopAllBehaviours()
+{
+    for (size_t i = 0; i < behaviourSlots.size(); i++) {
+        if (behaviourSlots[i].enemy) stopBehaviour(behaviourSlots[i].enemy);
+    }
+    behaviourTimers.clear();
+}
+
+void restartBehaviourClock()
+{
+    stopAllBehaviours();
+    behaviourTick = 0;
+}
+
+void resetBehaviours()
+{
+    stopAllBehaviours();
+    forEachEntity<ENEMY>([](GameObject * enemy) { startBehaviour(enemy); });
+}
+
+// slot of an enemy waiting for condition, -1 otherwise
+int behaviourWaitingFor(GameObject * obj, uint8 condition)
+{
+    if (obj->entityType != ENEMY) return -1;
+    auto found = behaviourIndex.find(obj);
+    if (found == behaviourIndex.end() || !(behaviourSlots[found->second].conditions & condition)) return -1;
+    return found->second;
+}
+
+// which side of the line a - b point p is on
+float edgeSide(Vector2 a, Vector2 b, float px, float py)
+{
+    return (b.x-a.x)*(py-a.y) - (b.y-a.y)*(px-a.x);
+}
+
+void updateBehaviours()
+{
+    PROFILE_SCOPE("updateBehaviours");
+    behaviourTick++;
+    behaviourResumes = 0;
+    wokenBehaviours.clear();
+
+    // timers that have run out
+    while (!behaviourTimers.empty() && behaviourTimers.front().deadline <= behaviourTick) {
+        BehaviourTimer timer = behaviourTimers.front();
+        std::pop_heap(behaviourTimers.begin(), behaviourTimers.end(), laterTimer);
+        behaviourTimers.pop_back();
+        if (behaviourSlots[timer.slot].waitId == timer.waitId) wakeBehaviour(timer.slot, WAKE_TIMER);
+    }
+
+    // enemies close enough to a player
+    if (nearWaiting > 0) {
+        for (int p = 0; p < avatarCount(); p++) {
+            const GameObject * avatar = playerAvatar(p);
+            float px = avatar->pos.x + avatar->size[0]/2, py = avatar->pos.y + avatar->size[1]/2;
+            queryRadius(px, py, BEHAVIOUR_WAKE_RADIUS, [px, py](GameObject * obj) {
+                int slot = behaviourWaitingFor(obj, WAKE_NEAR);
+                if (slot < 0) return;
+                float dx = obj->pos.x + obj->size[0]/2 - px, dy = obj->pos.y + obj->size[1]/2 - py;
+                float radius = behaviourSlots[slot].radius;
+                if (dx*dx + dy*dy <= radius*radius) wakeBehaviour(slot, WAKE_NEAR);
+            });
+        }
+    }
+
+    // enemies in the flashlight beam, the same triangle as flashlightTriangle in world space
+    if (litWaiting > 0 && flashlightOn && flashLightCharge > 0.0f) {
+        Vector2 a = {player->pos.x + player->size[0]/2, player->pos.y + player->size[1]/2};
+        Vector2 mid = {a.x + flashRange*playerToMouse.x, a.y + flashRange*playerToMouse.y};
+        Vector2 side = {-playerToMouse.y*flashRange*flashWidth, playerToMouse.x*flashRange*flashWidth};
+        Vector2 b = {mid.x+side.x, mid.y+side.y}, c = {mid.x-side.x, mid.y-side.y};
+        float x0 = fminf(a.x, fminf(b.x, c.x)), x1 = fmaxf(a.x, fmaxf(b.x, c.x));
+        float y0 = fminf(a.y, fminf(b.y, c.y)), y1 = fmaxf(a.y, fmaxf(b.y, c.y));
+        float half = fmaxf(x1-x0, y1-y0) / 2;
+        queryRadius((x0+x1)/2, (y0+y1)/2, half, [a, b, c](GameObject * obj) {
+            int slot = behaviourWaitingFor(obj, WAKE_LIT);
+            if (slot < 0) return;
+            float px = obj->pos.x + obj->size[0]/2, py = obj->pos.y + obj->size[1]/2;
+            float s0 = edgeSide(a, b, px, py), s1 = edgeSide(b, c, px, py), s2 = edgeSide(c, a, px, py);
+            if ((s0 >= 0 && s1 >= 0 && s2 >= 0) || (s0 <= 0 && s1 <= 0 && s2 <= 0)) wakeBehaviour(slot, WAKE_LIT);
+        });
+    }
+
+    for (size_t i = 0; i < wokenBehaviours.size(); i++) resumeBehaviour(wokenBehaviours[i]);
+}
+
+void behaviourHit(GameObject * enemy)
+{
+    int slot = behaviourWaitingFor(enemy, WAKE_HIT);
+    if (slot < 0) return;
+    BehaviourSlot& s = behaviourSlots[slot];
+    clearBehaviourWait(s);
+    s.woke = WAKE_HIT;
+    resumeBehaviour(slot);
+}
+
+void captureBehaviours(BehaviourState& state)
+{
+    state.tick = behaviourTick;
+    state.waits.clear();
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        auto found = behaviourIndex.find(gameObjects[i]);
+        if (found == behaviourIndex.end()) continue;
+        const BehaviourSlot& s = behaviourSlots[found->second];
+        state.waits.push_back(BehaviourSave {(int)i, (s.conditions & WAKE_TIMER) ? s.deadline-behaviourTick : 0});
+    }
+}
+
+void restoreBehaviours(const BehaviourState& state)
+{
+    stopAllBehaviours();
+    behaviourTick = state.tick;
+    for (const BehaviourSave& save : state.waits) startBehaviour(gameObjects[save.index], save.ticksLeft);
+}
+
+BehaviourStats behaviourStats()
+{
+    BehaviourStats stats = {0, 0, behaviourResumes, totalBehaviourResumes, behaviourFrames.frameBytes, behaviourFrames.reservedBytes};
+    for (size_t i = 0; i < behaviourSlots.size(); i++) {
+        if (!behaviourSlots[i].enemy) continue;
+        stats.live++;
+        stats.chasing += behaviourSlots[i].enemy->behaviour == BEHAVIOUR_CHASE;
+    }
+    return stats;
+}
@@ -0,0 +1,114 @@
+#ifndef BEHAVIOUR_HPP
+#define BEHAVIOUR_HPP
+
+/*
+    enemy behaviour, one coroutine per enemy
+
+    enemyBehaviour is written as the steps an enemy goes through: patrol
+    until a player is heard, listen for the flashlight, chase, flee when
+    shot, chase again. a patrol with no player anywhere near goes to sleep
+    until one comes. every step ends in a co_await on what ends it, any of:
+        WAKE_TIMER  some seconds have passed
+        WAKE_NEAR   a player is within a radius
+        WAKE_LIT    the flashlight beam is on it
+        WAKE_HIT    it was shot
+    and the coroutine isn't touched again until one of them happens. timers
+    sit in a heap, proximity and light are found through the spatial grid
+    around the players and inside the beam, and hits come from bulletHit, so
+    a tick costs nothing for enemies that are waiting out of reach however
+    many there are. chasing is still steered every tick by updateVelocities.
+
+    frames come from a pool of fixed size blocks, so starting
+    and dropping behaviours doesn't touch the heap once it has grown.
+
+    the step an enemy is in is kept in its record (GameObject::behaviour),
+    that's all that survives packEntity. when gameObjects is swapped for
+    another room, resetBehaviours starts every enemy again at the beginning
+    of its step. lockstep captures the wait timers as well so a rollback
+    carries on exactly where it left off. a behaviour only changes its own
+    enemy and picks its random numbers from its position and the tick, so
+    the order behaviours wake up in never matters.
+*/
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include <unordered_map>
+
+#define WAKE_TIMER 1
+#define WAKE_NEAR 2
+#define WAKE_LIT 4
+#define WAKE_HIT 8
+
+#define BEHAVIOUR_WAKE_RADIUS 1200.0f   // pixels, further than this from every player a patrol sleeps
+#define BEHAVIOUR_LISTEN_RADIUS 500.0f  // pixels, a patrolling enemy hears a player this close
+#define BEHAVIOUR_CHASE_RADIUS 250.0f   // pixels, a listening enemy goes for a player this close
+#define BEHAVIOUR_PATROL_SECONDS 2.0f   // per leg of a patrol
+#define BEHAVIOUR_LISTEN_SECONDS 3.0f   // before going back to patrolling
+#define BEHAVIOUR_FLEE_SECONDS 0.75f
+#define BEHAVIOUR_PATROL_SPEED 8.0f     // times moveSpeed, pixels per second
+#define BEHAVIOUR_FLEE_SPEED 30.0f      // times moveSpeed, pixels per second
+#define BEHAVIOUR_FRAME_ALIGN 64        // frame sizes are rounded up to this
+#define BEHAVIOUR_FRAME_MAX 1024        // bigger frames go on the heap
+#define BEHAVIOUR_FRAME_BLOCK 256       // frames per pool block
+
+// co_await one of these, it gives back the condition that woke it
+struct BehaviourWait {
+    uint8 conditions;
+    float radius;  // WAKE_NEAR, pixels, up to BEHAVIOUR_WAKE_RADIUS
+    uint32 ticks;  // WAKE_TIMER
+    int slot;      // set while it's waiting
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    uint8 await_resume() const;
+};
+
+struct BehaviourTask {
+    struct promise_type {
+        BehaviourTask get_return_object() { return BehaviourTask {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; } // the scheduler starts it
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void * operator new(size_t bytes);
+        static void operator delete(void * frame, size_t bytes);
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+// lockstep's copy of the waits, by index in gameObjects
+struct BehaviourSave {
+    int index;
+    uint32 ticksLeft; // 0 when it isn't waiting on a timer
+};
+
+struct BehaviourState {
+    uint32 tick;
+    std::vector<BehaviourSave> waits;
+};
+
+struct BehaviourStats {
+    int live, chasing;
+    uint32 resumes;        // last tick
+    uint64_t totalResumes;
+    size_t frameBytes;     // per behaviour, after rounding
+    size_t reservedBytes;  // frame pool blocks
+};
+
+BehaviourTask enemyBehaviour(GameObject * enemy, uint32 resumeTicks);
+
+void startBehaviour(GameObject * enemy, uint32 resumeTicks = 0); // 0 begins its step, otherwise it waits that many ticks more
+void stopBehaviour(GameObject * enemy);
+void resetBehaviours(); // every enemy in gameObjects from the start of its step
+void restartBehaviourClock(); // for a new run, stops them all and counts ticks from 0 again
+void updateBehaviours(); // once a tick, after the spatial grid is built
+void behaviourHit(GameObject * enemy);
+
+void captureBehaviours(BehaviourState& state);
+void restoreBehaviours(const BehaviourState& state);
+
+BehaviourStats behaviourStats();
+
+#endif
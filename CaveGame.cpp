@@ -4,9 +4,16 @@
 int wndWidth, wndHeight; // dimensions of window
 float deltaTime = 0.0f, // time elapsed between frames
 fixedDeltaTime = 16.0f; // 60fps
-float timer = 0.0f; // time spent in the cave
+float timer = 0.0f; // time spent in the cave, in CAVE_CLOCK_SECONDS
+float autosaveTimer = 0.0f; // time since the last autosave check
 bool gameIsPaused = 0, flashlightOn = 0;
 int pauseState = PAUSE;
+bool profilerOverlay = false; // phase timings, toggled with F3
+// enemy simulation level of detail, F7 toggles it
+LodSettings lodSettings = {true, 700.0f, 1600.0f, 4};
+uint32 lodTick = 0;
+bool largeCaveMode = false; // endless chunked cave instead of rooms, -largecave on the command line
+bool holdLoadZones = false; // the player can't leave the room, for lockstep's predicted ticks
 // flashlight
 float flashRange, flashWidth; // range of the flashlight
 float ambientLightPercent = 1.0f, flashlightBrightness = 1.0f; // 0 to 1, how bright the scene/flashlight are
@@ -28,13 +35,67 @@ Gdiplus::Image * playerImg;
 Gdiplus::Image * enemyImg;
 int bkgWidth, bkgHeight;
 
+// what GameObject::texture indexes, 0 is no image
+Gdiplus::Image ** const textureTable[NUM_TEXTURES] = {
+    nullptr, &playerImg, &bulletImg, &Wall0Img, &batteryImg, &gem0Img, &ammoImg, &enemyImg
+};
+
 // game objects
 std::vector<GameObject*> gameObjects;
-std::unordered_map<Vector2*, float> interiorWalls;
+CaveGrid roomCave; // the room's cave, kept so its buffers are reused
 GameObject * player;
 uint8 movementKeys = 0b00000000; // 0000wasd
 Vector2 playerToMouse = {1,0};
 
+// entity registry
+// every type except bullets can be collided with, walls and items are static and
+// don't check collisions themselves
+#define SOLID_TYPES (~0u & ~TYPE_BIT(PLAYER_BULLET))
+constexpr EntityInfo entityRegistry[NUM_ENTITY_TYPES] = {
+    // static, item, collidesWith, width, height, sprite, pickUp
+    {true,  false, 0,           0,  0,  nullptr,     nullptr},       // unused, types start at 1
+    {false, false, SOLID_TYPES, 30, 30, &playerImg,  nullptr},       // PLAYER
+    {false, false, SOLID_TYPES, 20, 20, &bulletImg,  nullptr},       // PLAYER_BULLET
+    {true,  false, 0,           100,100,&Wall0Img,   nullptr},       // WALL
+    {true,  true,  0,           30, 30, &batteryImg, pickUpBattery}, // BATTERY
+    {true,  true,  0,           30, 30, &gem0Img,    pickUpGem},     // GEM
+    {true,  true,  0,           30, 20, &ammoImg,    pickUpAmmo},    // AMMO
+    {false, false, SOLID_TYPES, 30, 30, &enemyImg,   nullptr}        // ENEMY
+};
+
+// traits of an entity type, for code that is specialised per type
+template <int type> struct EntityTraits {
+    static_assert(type > 0 && type < NUM_ENTITY_TYPES, "unknown entity type");
+    static constexpr const EntityInfo& info = entityRegistry[type];
+    static constexpr bool isStatic = info.isStatic;
+    static constexpr bool isItem = info.isItem;
+    static constexpr unsigned int collidesWith = info.collidesWith;
+};
+static_assert(EntityTraits<WALL>::isStatic && !EntityTraits<ENEMY>::isStatic, "walls are static, enemies move");
+static_assert(EntityTraits<BATTERY>::isItem && EntityTraits<AMMO>::isItem && !EntityTraits<ENEMY>::isItem, "items are BATTERY - AMMO");
+constexpr bool staticTypesCollide()
+{
+    for (int type = 1; type < NUM_ENTITY_TYPES; type++) if (entityRegistry[type].isStatic && entityRegistry[type].collidesWith) return true;
+    return false;
+}
+static_assert(!staticTypesCollide(), "handleCollisions only checks from the moving types");
+
+// runtime lookups for when the type is only known at runtime
+constexpr const EntityInfo& entityInfo(int type) { return entityRegistry[type]; }
+constexpr bool isItem(int type) { return entityRegistry[type].isItem; }
+
+// calls func on every game object of one type
+template <int type, typename Func> void forEachEntity(Func func)
+{
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        if (gameObjects[i]->entityType == type) func(gameObjects[i]);
+    }
+}
+
+// random numbers, kept in a global so runs can be snapshotted and replayed
+uint32 rngState = 1;
+uint16 nextEntityId = 0; // also part of the run, see newEntityId
+
 // for functions
 clock_t begin_time = clock(); // for tracking deltaTime
 // queue traking player movements
@@ -42,12 +103,13 @@ std::stack<int> roomQueue; // entries = direction they need to move
 
 // windows
 HBITMAP hOffscreenBitmap; // buffer frame not seen by user
+FrameBuffer frameBuffer = {nullptr, 0, 0, 0}; // its pixels
 HDC hOffscreenDC, g_hdc;  // DC for offscreen device context
 
 // main window display function
 int WINAPI wndMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow)
 {
-    srand(static_cast<unsigned int>(std::time(nullptr))); // set seed to surrent time
+    seedRandom(static_cast<unsigned int>(std::time(nullptr))); // set seed to surrent time
 
     // initialise GDI+
     Gdiplus::GdiplusStartupInput gdiplusStartupInput;
@@ -59,6 +121,8 @@ int WINAPI wndMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine,
     // load global variables
     loadGlobals();
     loadImages();
+    startAutosave();
+    startLogger();
 
     // register window class
     const wchar_t CLASS_NAME[] = L"Window Class";
@@ -85,8 +149,34 @@ int WINAPI wndMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine,
     );
     if (hwnd == NULL) return 1; // validate window creation
 
-    roomQueue.push(LEFT); // initialise roomQueue
-    generateRoom(Vector2 {150.0f, (float)bkgHeight/2.0f});
+    largeCaveMode = wcsstr(pCmdLine, L"-largecave") != NULL;
+    if (wcsstr(pCmdLine, L"-autoplay") != NULL) setController(autoplayPolicy, static_cast<uint32>(std::time(nullptr)));
+    if (wcsstr(pCmdLine, L"-capture") != NULL && startCapture() != 0) LOG_WARN("capture failed to start", "file", CAPTURE_FILE);
+    // -telemetry [keyframe ticks]
+    const wchar_t * telemetry = wcsstr(pCmdLine, L"-telemetry");
+    int keyframeTicks = TELEMETRY_KEYFRAME_TICKS;
+    if (telemetry) swscanf(telemetry, L"-telemetry %d", &keyframeTicks);
+    if (telemetry && startTelemetry(keyframeTicks) != 0) LOG_WARN("telemetry failed to start", "file", TELEMETRY_FILE);
+    // -coop <player> <players> [seed]
+    const wchar_t * coop = wcsstr(pCmdLine, L"-coop");
+    int coopPlayer = 0, coopPlayers = 0;
+    unsigned int coopSeed = LOCKSTEP_SEED;
+    if (coop && (swscanf(coop, L"-coop %d %d %u", &coopPlayer, &coopPlayers, &coopSeed) < 2 ||
+        startLockstep(coopPlayer, coopPlayers, coopSeed) != 0)) LOG_WARN("co-op failed to start", "player", coopPlayer, "players", coopPlayers);
+    // gameplay numbers, reloaded when the file is saved except in co-op
+    loadTuning();
+    applyTuning();
+    if (!lockstepActive()) startTuningWatch();
+
+    if (largeCaveMode) {
+        roomQueue.push(LEFT); // only emptied by leaving through the exit
+        startChunkWorld((uint32)randomInt());
+    }
+    // resume the last run if it was quit part way through, co-op starts its own
+    else if (lockstepActive() || loadSnapshot(RUN_SNAPSHOT_FILE) != 0) {
+        roomQueue.push(LEFT); // initialise roomQueue
+        generateRoom(Vector2 {150.0f, (float)bkgHeight/2.0f});
+    }
 
     ShowWindow(hwnd, nCmdShow); // open the game window
 
@@ -99,30 +189,27 @@ int WINAPI wndMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine,
         // find time elapsed between frames
         deltaTime = DeltaTime();
 
-        // win condition
-        if (roomQueue.empty()) {
-            gemsSaved += numGems; numGems = 0;
-            gameIsPaused = true;
-            pauseState = VICTORY;
-        } else pauseState = PAUSE;
-
-        if (player->health == 0){
-            gameIsPaused = true;
-            pauseState = LOSS;
+        if (lockstepActive()) runLockstep(deltaTime);
+        else {
+            runController();
+            tickGame(deltaTime);
         }
+        publishTelemetry(deltaTime);
 
-        updateGameObjects();
-
-        // decrease flashlight charge, drain ambient light
-        drainLight();
-
-        // increment timer
-        if (!gameIsPaused) timer += 0.1 * deltaTime;
+        // periodically save progression in the background, co-op plays with someone else's upgrades
+        autosaveTimer += deltaTime;
+        if (autosaveTimer >= AUTOSAVE_INTERVAL && !lockstepActive()) {
+            autosaveTimer = 0.0f;
+            requestAutosave();
+        }
 
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
 
+    stopTelemetry();
+    stopTuningWatch();
+    stopLogger();
     // shut down GDI+
     Gdiplus::GdiplusShutdown(gdiplusToken);
     // cleanup
@@ -139,43 +226,68 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         case WM_CREATE: // window creation
             // get device context for the window
             InitialiseOffscreenDC(hwnd);
+            startCompositor();
             break;
 
         case WM_PAINT: { // called continuously
+            PROFILE_SCOPE("frame");
             createBufferFrame(hwnd);
             // copy buffer frame to visible window
             copyOffscreenToWindow(g_hdc);
+            inputPresented();
+            captureFrame(deltaTime);
+            endAllocFrame();
             break;
         }
 
         // W = 0x57, A = 0x41, S = 0x53, D = 0x44
         case WM_KEYDOWN:
+            // movement belongs to the controller while there is one
+            if (controllerPolicy && (wParam==0x57||wParam==0x41||wParam==0x53||wParam==0x44)) break;
             switch (wParam)
             {
                 case 0x57: // w
-                    movementKeys |= 8; break;
+                    pushInput(INPUT_KEY_DOWN, 0, 0, 8); break;
                 case 0x41: // a
-                    movementKeys |= 4; break;
+                    pushInput(INPUT_KEY_DOWN, 0, 0, 4); break;
                 case 0x53: // s
-                    movementKeys |= 2; break;
+                    pushInput(INPUT_KEY_DOWN, 0, 0, 2); break;
                 case 0x44: // d
-                    movementKeys |= 1; break;
-                case VK_ESCAPE:
-                    if (!roomQueue.empty()) gameIsPaused = !gameIsPaused;
+                    pushInput(INPUT_KEY_DOWN, 0, 0, 1); break;
+                case VK_ESCAPE: // nobody else would be paused in co-op
+                    if (!roomQueue.empty() && !lockstepActive()) gameIsPaused = !gameIsPaused;
+                    break;
+                case VK_F3: // profiler overlay
+                    profilerOverlay = !profilerOverlay; break;
+                case VK_F4:
+                    exportChromeTrace(TRACE_FILE); break;
+                case VK_F6: // stress test
+                    if (lockstepActive()) break; // only this process would have them
+                    spawnStressEnemies(1000); break;
+                case VK_F7:
+                    if (!lockstepActive()) lodSettings.enabled = !lodSettings.enabled;
+                    break;
+                case VK_F5: // quick snapshot, for reproducing bugs
+                    if (!largeCaveMode && !lockstepActive()) saveSnapshot(QUICK_SNAPSHOT_FILE);
+                    break;
+                case VK_F9:
+                    if (!largeCaveMode && !lockstepActive()) loadSnapshot(QUICK_SNAPSHOT_FILE);
+                    break;
             }
             break;
 
         case WM_KEYUP:
+            if (controllerPolicy) break;
             switch (wParam)
             {
                 case 0x57: // w
-                    movementKeys ^= 8; break;
+                    pushInput(INPUT_KEY_UP, 0, 0, 8); break;
                 case 0x41: // a
-                    movementKeys ^= 4; break;
+                    pushInput(INPUT_KEY_UP, 0, 0, 4); break;
                 case 0x53: // s
-                    movementKeys ^= 2; break;
+                    pushInput(INPUT_KEY_UP, 0, 0, 2); break;
                 case 0x44: // d
-                    movementKeys ^= 1; break;
+                    pushInput(INPUT_KEY_UP, 0, 0, 1); break;
             }
             break;
 
@@ -184,39 +296,59 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             int x = GET_X_LPARAM(lParam), y = GET_Y_LPARAM(lParam);
 
             // shoot a bullet
-            if (!gameIsPaused) shootBullet(x, y);
-            else interactWithPauseMenu(x, y, hwnd);
+            if (!gameIsPaused) { if (!controllerPolicy) pushInput(INPUT_FIRE, x, y); }
+            else if (!lockstepActive()) interactWithPauseMenu(x, y, hwnd);
             break;
         }
         case WM_RBUTTONDOWN:
-            flashlightOn = !flashlightOn;
+            if (!controllerPolicy) pushInput(INPUT_FLASHLIGHT);
 
         case WM_MOUSEMOVE: {// player moved mouse
             // get the mouse coordinates on screen
             int x = GET_X_LPARAM(lParam), y = GET_Y_LPARAM(lParam);
 
-            if (gameIsPaused) break;
-            // get coordinates in worldspace
-            Vector2 mousePos = getWorldSpaceCoords((float)x, (float)y);
-            // vector from player to mousePos
-            playerToMouse = {mousePos.x-(player->pos.x+player->size[0]/2), mousePos.y-(player->pos.y+player->size[1]/2)};
-            // normalised
-            playerToMouse.normalise();
+            if (gameIsPaused || controllerPolicy) break;
+            // aimed at the start of the next tick
+            pushInput(INPUT_AIM, x, y);
             break;
         }
 
         case WM_DESTROY: // window closed
             // clean up offscreen resources
+            {
+                SpriteCacheStats sprites = spriteCacheStats();
+                LOG_INFO("sprite cache", "surfaces", sprites.surfaces, "bytes", sprites.bytes, "pixels", sprites.pixels,
+                    "blit_ms", sprites.blitNanoseconds/1000000);
+                InputLatencyStats input = inputLatencyStats();
+                LOG_INFO("input latency", "samples", input.samples, "mean_ms", input.meanMs, "max_ms", input.maxMs, "dropped", input.dropped);
+                for (int tag = 0; tag < NUM_ALLOC_TAGS; tag++) {
+                    AllocTagStats allocs = allocTagStats(tag);
+                    LOG_INFO("allocations", "tag", allocs.name, "count", allocs.allocations,
+                        "peak_bytes", allocs.peakBytes, "peak_frame_count", allocs.peakFrameAllocations);
+                }
+            }
+            stopCapture();
+            stopCompositor();
+            clearSpriteCache();
+            frameBuffer.pixels = nullptr;
             DeleteObject(hOffscreenBitmap);
             DeleteDC(hOffscreenDC);
             ReleaseDC(hwnd, g_hdc);
 
+            // keep an unfinished run so it can be resumed, snapshots only cover rooms
+            if (largeCaveMode) stopChunkWorld();
+            else if (lockstepActive()); // snapshots hold one player, and the single player run is still there
+            else if (!roomQueue.empty() && player->health > 0) saveSnapshot(RUN_SNAPSHOT_FILE);
+            else DeleteFileA(RUN_SNAPSHOT_FILE);
+
             // deallocate other resources
             gameObjects.clear();
             delete background;
 
-            // save globals to local storage
-            saveGlobals();
+            // save globals to local storage, after any autosave in flight (co-op ran on player 0's)
+            stopAutosave();
+            if (!lockstepActive()) saveGlobals();
+            stopLockstep();
 
             PostQuitMessage(0);
             break;
@@ -238,7 +370,21 @@ void InitialiseOffscreenDC(HWND hwnd)
     g_hdc = GetDC(hwnd); // assign global device context
     // create a compatible DC for the offscreen bitmap
     hOffscreenDC = CreateCompatibleDC(g_hdc);
-    hOffscreenBitmap = CreateCompatibleBitmap(g_hdc, wndWidth, wndHeight);
+    // a DIB section so sprites can be blitted into its memory directly
+    BITMAPINFO info = {};
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = wndWidth;
+    info.bmiHeader.biHeight = -wndHeight; // top down
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void * bits = NULL;
+    hOffscreenBitmap = CreateDIBSection(g_hdc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (hOffscreenBitmap) frameBuffer = FrameBuffer {(uint32*)bits, wndWidth, wndHeight, wndWidth};
+    else {
+        LOG_WARN("no DIB section, sprites go through GDI+", "width", wndWidth, "height", wndHeight);
+        hOffscreenBitmap = CreateCompatibleBitmap(g_hdc, wndWidth, wndHeight);
+    }
     SelectObject(hOffscreenDC, hOffscreenBitmap);
 
     RECT rect = { 0, 0, wndWidth, wndHeight };
@@ -254,6 +400,7 @@ void copyOffscreenToWindow(HDC hdc)
 
 void createBufferFrame(HWND hwnd)
 {
+    PROFILE_SCOPE("createBufferFrame");
     // update window dimensions
     RECT clientRect;
     GetClientRect(hwnd, &clientRect);
@@ -262,24 +409,42 @@ void createBufferFrame(HWND hwnd)
 
     Gdiplus::Graphics graphics(hOffscreenDC); // graphics object for drawing
 
-    // draw background
-    drawBackgroundSection(graphics, background);
+    ALLOC_SCOPE(ALLOC_RENDER);
+    trimSpriteCache(); // between frames, composeFrame holds on to the surfaces it bins
+    if (frameBuffer.pixels) {
+        // background, game objects and flashlight straight into the buffer, in parallel tiles
+        GdiFlush();
+        composeFrame();
+    } else {
+        // draw background
+        drawBackgroundSection(graphics, background);
+
+        // draw game objects
+        for (int i = 0; i < gameObjects.size(); i++) {
+            drawGameObject(gameObjects[i], &graphics);
+        }
 
-    // draw game objects
-    for (int i = 0; i < gameObjects.size(); i++) {
-        drawGameObject(gameObjects[i], &graphics);
+        // flashlight
+        illuminateFlashLight(graphics);
     }
 
-    // flashlight
-    illuminateFlashLight(graphics);
-
-    // UI text
-    std::wstring flashText = L"Flashlight Charge: "+
-        std::to_wstring((int)flashLightCharge)+L'.'+
-        std::to_wstring(int((flashLightCharge-(int)flashLightCharge)*100))+L's';
-    placeText(10, 10, L"Bullets: " + std::to_wstring(numBullets), Gdiplus::Color(255,255,255), 12, graphics);
-    placeText(10, 30, flashText, Gdiplus::Color(255,255,255), 12, graphics);
-    placeText(10, 50, L"Gems: "+std::to_wstring(numGems), Gdiplus::Color(255,255,255), 12, graphics);
+    // UI text, and everything after it
+    ALLOC_SCOPE(ALLOC_UI);
+    {
+        PROFILE_SCOPE("hud");
+        std::wstring flashText = L"Flashlight Charge: "+
+            std::to_wstring((int)flashLightCharge)+L'.'+
+            std::to_wstring(int((flashLightCharge-(int)flashLightCharge)*100))+L's';
+        placeText(10, 10, L"Bullets: " + std::to_wstring(numBullets), Gdiplus::Color(255,255,255), 12, graphics);
+        placeText(10, 30, flashText, Gdiplus::Color(255,255,255), 12, graphics);
+        placeText(10, 50, L"Gems: "+std::to_wstring(numGems), Gdiplus::Color(255,255,255), 12, graphics);
+
+        LockstepStats coop = lockstepStats();
+        if (lockstepActive() && !coop.started) {
+            placeText(wndWidth/2-120, wndHeight/2, L"Waiting for "+std::to_wstring(coop.waitingFor)+L" more players",
+                Gdiplus::Color(255,255,255), 16, graphics);
+        }
+    }
 
     if (gameIsPaused) {
         Gdiplus::Rect rect(0, 0, wndWidth, wndHeight);
@@ -289,9 +454,96 @@ void createBufferFrame(HWND hwnd)
         drawPauseMenuUI(graphics, pauseState);
     }
 
+    if (profilerOverlay) {
+        drawProfilerOverlay(graphics);
+
+        SpriteCacheStats sprites = spriteCacheStats();
+        char line[128], kbLine[128];
+        int len = snprintf(line, sizeof(line), "sprite cache %d surfaces %zu KB, blit %.1f Mpx/s",
+            sprites.surfaces, sprites.bytes/1024, sprites.blitNanoseconds ? sprites.pixels*1000.0/sprites.blitNanoseconds : 0.0);
+        placeText(10, wndHeight-25, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        InputLatencyStats input = inputLatencyStats();
+        len = snprintf(line, sizeof(line), "input to photon %.1f ms, mean %.1f ms, max %.1f ms",
+            input.lastMs, input.meanMs, input.maxMs);
+        placeText(10, wndHeight-45, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        if (lockstepActive()) {
+            LockstepStats coop = lockstepStats();
+            len = snprintf(line, sizeof(line), "co-op tick %u (%u ahead), %u rollbacks, %u stalls, %u desyncs, %.1f bytes/tick sent",
+                coop.confirmedTick, coop.currentTick-coop.confirmedTick, coop.rollbacks, coop.stalls, coop.desyncs,
+                coop.currentTick ? double(coop.bytesSent)/coop.currentTick : 0.0);
+            placeText(10, wndHeight-85, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+        }
+
+        BehaviourStats behaviours = behaviourStats();
+        len = snprintf(line, sizeof(line), "behaviours %d live, %d chasing, %u resumed, %zu byte frames, %zu KB pool",
+            behaviours.live, behaviours.chasing, behaviours.resumes, behaviours.frameBytes, behaviours.reservedBytes/1024);
+        placeText(10, wndHeight-125, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        TimerStats timers = timerStats();
+        len = snprintf(line, sizeof(line), "timers %d live, %u fired, %u cascaded", timers.live, timers.fired, timers.cascaded);
+        placeText(10, wndHeight-145, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        ParticleStats particles = particleStats();
+        len = snprintf(line, sizeof(line), "particles %d live, %u emitted, %u dropped", particles.live, particles.emitted, particles.dropped);
+        placeText(10, wndHeight-105, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        if (telemetryActive()) {
+            TelemetryStats telemetry = telemetryStats();
+            len = snprintf(line, sizeof(line), "telemetry %u ticks sent, %u dropped, %u keyframes, %.1f KB",
+                telemetry.published, telemetry.dropped, telemetry.keyframes, telemetry.bytes/1024.0);
+            placeText(10, wndHeight-165, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+        }
+
+        // last frame's allocations per tag, then live and peak KB
+        len = snprintf(line, sizeof(line), "allocations");
+        int kbLen = snprintf(kbLine, sizeof(kbLine), "heap KB");
+        for (int tag = 0; tag < NUM_ALLOC_TAGS; tag++) {
+            AllocTagStats allocs = allocTagStats(tag);
+            len += snprintf(line+len, sizeof(line)-len, " %s %u (max %u)", allocs.name, allocs.frameAllocations, allocs.peakFrameAllocations);
+            kbLen += snprintf(kbLine+kbLen, sizeof(kbLine)-kbLen, " %s %lld/%lld", allocs.name,
+                (long long)allocs.liveBytes/1024, (long long)allocs.peakBytes/1024);
+            len = MIN(len, 127); kbLen = MIN(kbLen, 127);
+        }
+        placeText(10, wndHeight-185, std::wstring(line, line+len), Gdiplus::Color(255,255,0), 9, graphics);
+        placeText(10, wndHeight-205, std::wstring(kbLine, kbLine+kbLen), Gdiplus::Color(255,255,0), 9, graphics);
+
+        SteeringStats steering = steeringStats();
+        len = snprintf(line, sizeof(line), "steering %d chasing, %.1f neighbours each, %u capped", steering.agents,
+            steering.agents ? (double)steering.neighbours/steering.agents : 0.0, steering.capped);
+        placeText(10, wndHeight-225, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+
+        if (capturing()) {
+            CaptureStats capture = captureStats();
+            len = snprintf(line, sizeof(line), "capturing " CAPTURE_FILE ", %u frames written, %u dropped", capture.written, capture.dropped);
+            placeText(10, wndHeight-65, std::wstring(line, line+(MIN(len, 127))), Gdiplus::Color(255,255,0), 9, graphics);
+        }
+    }
+
     // deallocate resources
 }
 
+// xorshift32, used instead of rand() so the generator state can be saved
+int randomInt()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return int(rngState >> 1); // 0 - 2^31-1
+}
+
+uint16 newEntityId()
+{
+    if (++nextEntityId == 0) nextEntityId = 1; // 0 is a record without one
+    return nextEntityId;
+}
+
+void seedRandom(uint32 seed)
+{
+    rngState = seed ? seed : 1; // xorshift gets stuck on 0
+}
+
 float DeltaTime()
 {
     clock_t t = clock(); // current time
@@ -300,100 +552,192 @@ float DeltaTime()
     return MIN(dt, fixedDeltaTime);
 }
 
+uint8 textureIndex(Gdiplus::Image * image)
+{
+    if (!image) return 0;
+    for (int i = 1; i < NUM_TEXTURES; i++) {
+        if (*textureTable[i] == image) return (uint8)i;
+    }
+    return 0;
+}
+
+Gdiplus::Image * textureImage(uint8 index)
+{
+    return index ? *textureTable[index] : nullptr;
+}
+
 void drawGameObject(GameObject * obj, Gdiplus::Graphics * graphics)
 {
-    if (obj->img->GetLastStatus() == Gdiplus::Ok)
+    Gdiplus::Image * img = obj->image();
+    if (img->GetLastStatus() == Gdiplus::Ok)
     {
-        int pos0, pos1;
-        int width = wndWidth/2, height = wndHeight/2; // half the width and height
+        Vector2 camera = cameraOffset();
 
-        if      (player->pos.x < width || bkgWidth < wndWidth) pos0 = (int)obj->pos.x;
-        else if (player->pos.x > bkgWidth-width)               pos0 = wndWidth+(int)obj->pos.x-bkgWidth;
-        else    pos0 = (obj==player)?                          width : width-player->pos.x+obj->pos.x;
-        if      (pos0 < -obj->size[0] || pos0>wndWidth) return; // off screen, don't render
+        int pos0 = int(obj->pos.x-camera.x);
+        if (pos0 < -obj->size[0] || pos0>wndWidth) return; // off screen, don't render
 
-        if      (player->pos.y < height || bkgHeight < wndHeight) pos1 = (int)obj->pos.y;
-        else if (player->pos.y > bkgHeight-height)                pos1 = wndHeight+(int)obj->pos.y-bkgHeight;
-        else    pos1 = (obj==player)?                             height : height-player->pos.y+obj->pos.y;
-        if      (pos1 < -obj->size[1] || pos1 > wndWidth) return; // off screen, don't render
+        int pos1 = int(obj->pos.y-camera.y);
+        if (pos1 < -obj->size[1] || pos1 > wndHeight) return; // off screen, don't render
 
-        graphics->DrawImage(obj->img, pos0, pos1, obj->size[0], obj->size[1]);
-    } else std::cout << "error loading image\n";
+        // prescaled copy when the buffer's memory is there, GDI+ scaling otherwise
+        const SpriteSurface * sprite = frameBuffer.pixels ? spriteSurface(img, obj->size[0], obj->size[1]) : nullptr;
+        if (sprite) blitSprite(*sprite, pos0, pos1);
+        else graphics->DrawImage(img, pos0, pos1, obj->size[0], obj->size[1]);
+    } else LOG_ERROR("error loading image", "type", obj->entityType);
 }
 
-void updateVelocities()
+void removeDeadObjects()
 {
+    // kill entities with no health left
     for (int i = 0; i < gameObjects.size(); i++) {
-        // kill entities with no health left
         if (gameObjects[i]->health <= 0) {
             delete gameObjects[i];
             gameObjects.erase(gameObjects.begin() + i--);
-        }
-
-
-        switch (gameObjects[i]->entityType)
-        {
-            case PLAYER:
-                player->velocity.x = player->moveSpeed * (bool(movementKeys&1) - bool(movementKeys&4));
-                player->velocity.y = player->moveSpeed * (bool(movementKeys&2) - bool(movementKeys&8));
-                break;
+        } else if (gameObjects[i]->entityType <= 0 || gameObjects[i]->entityType >= NUM_ENTITY_TYPES)
+            LOG_WARN("unknown entity", "index", i, "type", gameObjects[i]->entityType);
+    }
+}
 
+void assignLodTiers()
+{
+    PROFILE_SCOPE("assignLodTiers");
+    lodTick++;
+
+    // everything is far unless the broadphase finds it near the player
+    forEachEntity<ENEMY>([](GameObject * enemy) { enemy->lodTier = lodSettings.enabled ? LOD_FAR : LOD_NEAR; });
+    if (lodSettings.enabled) {
+        float px = player->pos.x+player->size[0]/2, py = player->pos.y+player->size[1]/2;
+        float near2 = lodSettings.nearDistance*lodSettings.nearDistance,
+              mid2 = lodSettings.midDistance*lodSettings.midDistance;
+
+        queryRadius(px, py, lodSettings.midDistance, [=](GameObject * obj) {
+            if (obj->entityType != ENEMY) return;
+            float dx = obj->pos.x+obj->size[0]/2-px, dy = obj->pos.y+obj->size[1]/2-py;
+            float dist2 = dx*dx + dy*dy;
+            if (dist2 <= near2) obj->lodTier = LOD_NEAR;
+            else if (dist2 <= mid2) obj->lodTier = LOD_MID;
+        });
+    }
 
-            case PLAYER_BULLET: break; // constant velocity, no need to update
+    // near ticks every frame, mid every midInterval frames (staggered) with the
+    // time it missed, far sleeps and doesn't build up time
+    forEachEntity<ENEMY>([](GameObject * enemy) {
+        if (enemy->lodTier == LOD_FAR) {
+            enemy->lodAwake = false;
+            enemy->lodTime = 0.0f;
+            enemy->velocity = Vector2 {0.0f, 0.0f};
+            return;
+        }
+        enemy->lodTime += deltaTime;
+        uint32 stagger = enemy->id; // the same on every co-op peer, an address wouldn't be
+        enemy->lodAwake = enemy->lodTier == LOD_NEAR || (lodTick + stagger) % lodSettings.midInterval == 0;
+    });
+}
 
-            case ENEMY:
-                if(gameObjects[i]->idle == false){
-                    int delta_x = (player->pos.x) - gameObjects[i]->pos.x;
-                    int delta_y = (player->pos.y) - gameObjects[i]->pos.y;
+void updateVelocities()
+{
+    PROFILE_SCOPE("updateVelocities");
+    // player moves with the movement keys
+    player->velocity.x = player->moveSpeed * (bool(movementKeys&1) - bool(movementKeys&4));
+    player->velocity.y = player->moveSpeed * (bool(movementKeys&2) - bool(movementKeys&8));
 
-                    gameObjects[i]->velocity.x = (delta_x/10) * gameObjects[i]->moveSpeed;
-                    gameObjects[i]->velocity.y = (delta_y/10) * gameObjects[i]->moveSpeed;
-                    break;
-                }
-                break;
+    // enemies chase the player while their behaviour says so, keeping apart from each other
+    steerEnemies();
 
-            // static objects, shouldnt move
-            case WALL:    break;
-            case BATTERY: break;
-            case GEM:     break;
-            case AMMO:    break;
-            default: std::cout << "unknown entity: " << i << '\n'; break;
-        }
-    }
+    // bullets have constant velocity, static objects never move
 }
 
 void updatePositions()
 {
+    PROFILE_SCOPE("updatePositions");
     for (int i = 0; i < gameObjects.size(); i++)
     {
-        gameObjects[i]->pos.x += gameObjects[i]->velocity.x * deltaTime;
-        gameObjects[i]->pos.y += gameObjects[i]->velocity.y * deltaTime;
+        GameObject * obj = gameObjects[i];
+        if (entityInfo(obj->entityType).isStatic) continue; // walls and items never move
+
+        // enemies on a reduced tick rate catch up all at once
+        float dt = deltaTime;
+        if (obj->entityType == ENEMY) {
+            if (!obj->lodAwake) continue;
+            dt = obj->lodTime;
+            obj->lodTime = 0.0f;
+        }
+        obj->pos.x += obj->velocity.x * dt;
+        obj->pos.y += obj->velocity.y * dt;
     }
 }
 
 void updateGameObjects()
 {
     if (gameIsPaused) return;
-    checkidle();
+    removeDeadObjects();
+    buildSpatialGrid();
+    assignLodTiers();
+    updateBehaviours();
     updateVelocities();
     updatePositions();
+    buildSpatialGrid(); // again, everything has moved
     handleCollisions();
+    if (largeCaveMode) updateChunks();
+}
+
+void tickGame(float dt)
+{
+    ALLOC_SCOPE(ALLOC_SIM);
+    applyTuning(); // a reload lands between ticks
+    deltaTime = dt;
+    if (!lockstepActive()) applyInput(); // what happened since the last tick, in order, lockstep sends it instead
+
+    // win condition
+    if (roomQueue.empty()) {
+        gemsSaved += numGems; numGems = 0;
+        gameIsPaused = true;
+        pauseState = VICTORY;
+    } else pauseState = PAUSE;
+
+    // enemies can take the player below 0 in one tick
+    if (player->health <= 0){
+        gameIsPaused = true;
+        pauseState = LOSS;
+    }
+
+    {
+        PROFILE_SCOPE("tick");
+        updateGameObjects();
+
+        // decrease flashlight charge, drain ambient light
+        drainLight();
+    }
+
+    // timed effects, the cave clock carries on from run to run
+    if (!gameIsPaused) {
+        if (!timersPending(TIMER_CAVE_CLOCK)) scheduleTimer(TIMER_CAVE_CLOCK, CAVE_CLOCK_SECONDS);
+        advanceTimers(deltaTime);
+    }
 }
 
 void drawBackgroundSection(Gdiplus::Graphics& graphics, Gdiplus::Image* image)
 {
+    Vector2 camera = cameraOffset();
+
+    // the large cave has no edges, the background repeats in every direction
+    if (largeCaveMode) {
+        int src0 = ((int)camera.x % bkgWidth + bkgWidth) % bkgWidth,
+            src1 = ((int)camera.y % bkgHeight + bkgHeight) % bkgHeight;
+        for (int y = -src1; y < wndHeight; y += bkgHeight) {
+            for (int x = -src0; x < wndWidth; x += bkgWidth) {
+                graphics.DrawImage(image, Gdiplus::Rect(x, y, bkgWidth, bkgHeight), 0, 0,
+                bkgWidth, bkgHeight, Gdiplus::UnitPixel);
+            }
+        }
+        return;
+    }
+
     // offsets
-    int src0 = 0, src1 = 0, bkgx = 0, bkgy = 0;
+    int src0 = (int)camera.x, src1 = (int)camera.y, bkgx = 0, bkgy = 0;
 
     if (bkgWidth<wndWidth) bkgx = (wndWidth-bkgWidth)/2;
-    else if (player->pos.x<wndWidth/2) src0 = 0;
-    else if (player->pos.x>bkgWidth-wndWidth/2) src0 = bkgWidth-wndWidth;
-    else src0 = (int)player->pos.x - (wndWidth/2);
-
     if (bkgHeight<wndHeight) bkgy = (wndHeight-bkgHeight)/2;
-    else if (player->pos.y<wndHeight/2) src1 = 0;
-    else if (player->pos.y>bkgHeight-wndHeight/2) src1 = bkgHeight-wndHeight;
-    else src1 = (int)player->pos.y - (wndHeight/2);
 
     // destination rectangle
     Gdiplus::Rect destRect(bkgx, bkgy, wndWidth, wndHeight);
@@ -405,48 +749,58 @@ void drawBackgroundSection(Gdiplus::Graphics& graphics, Gdiplus::Image* image)
     srcRect.Width, srcRect.Height, Gdiplus::UnitPixel);
 }
 
-// finds the in game coordinates for a position on the window
-Vector2 getWorldSpaceCoords(float x, float y)
+// world space position of the top left of the window, follows the player
+// (this process' one in co-op) and stops at the edges of the room
+Vector2 cameraOffset()
 {
     int width = wndWidth/2, height = wndHeight/2; // half the width and height
+    Vector2 offset = {0.0f, 0.0f};
+    const GameObject * target = viewedPlayer();
+
+    if (largeCaveMode) return Vector2 {target->pos.x-width, target->pos.y-height}; // no edges
 
-    if (player->pos.x < width || bkgWidth < wndWidth);
-    else if (player->pos.x > bkgWidth-width) x += bkgWidth-wndWidth;
-    else x += player->pos.x-width;
+    if (target->pos.x < width || bkgWidth < wndWidth);
+    else if (target->pos.x > bkgWidth-width) offset.x = bkgWidth-wndWidth;
+    else offset.x = target->pos.x-width;
 
-    if (player->pos.y < height || bkgHeight < wndHeight);
-    else if (player->pos.y > bkgHeight-height) y += bkgHeight-wndHeight;
-    else y += player->pos.y-height;
+    if (target->pos.y < height || bkgHeight < wndHeight);
+    else if (target->pos.y > bkgHeight-height) offset.y = bkgHeight-wndHeight;
+    else offset.y = target->pos.y-height;
+
+    return offset;
+}
 
-    return Vector2 {x, y};
+// finds the in game coordinates for a position on the window
+Vector2 getWorldSpaceCoords(float x, float y)
+{
+    Vector2 camera = cameraOffset();
+    return Vector2 {x+camera.x, y+camera.y};
 }
 
 // finds the on screen coordinates of a world space coordinate
 Gdiplus::Point getScreenCoords(float x, float y)
 {
-    int width = wndWidth/2, height = wndHeight/2; // half the width and height
-
-    if (player->pos.x < width || bkgWidth < wndWidth);
-    else if (player->pos.x > bkgWidth-width) x -= bkgWidth-wndWidth;
-    else x -= player->pos.x-width;
-
-    if (player->pos.y < height || bkgHeight < wndHeight);
-    else if (player->pos.y > bkgHeight-height) y -= bkgHeight-wndHeight;
-    else y -= player->pos.y-height;
-
-    return Gdiplus::Point((INT)x, (INT)y);
+    Vector2 camera = cameraOffset();
+    return Gdiplus::Point((INT)(x-camera.x), (INT)(y-camera.y));
 }
 
-void illuminateFlashLight(Gdiplus::Graphics& graphics)
+// screen space corners of the flashlight beam, the player first
+void flashlightTriangle(Gdiplus::Point * vertices)
 {
-    // define vertices for triangle
     Gdiplus::Point playerPos = getScreenCoords(player->pos.x+(player->size[0]/2), player->pos.y+(player->size[1]/2)),
     bisector(INT(playerPos.X+(flashRange*playerToMouse.x)), INT(playerPos.Y+(flashRange*playerToMouse.y))),
     p1(INT(bisector.X-(playerToMouse.y*flashRange*flashWidth)), INT(bisector.Y+(playerToMouse.x*flashRange*flashWidth))),
     p2(INT(bisector.X+(playerToMouse.y*flashRange*flashWidth)), INT(bisector.Y-(playerToMouse.x*flashRange*flashWidth)));
 
+    vertices[0] = playerPos; vertices[1] = p1; vertices[2] = p2;
+}
+
+void illuminateFlashLight(Gdiplus::Graphics& graphics)
+{
+    PROFILE_SCOPE("illuminateFlashLight");
     // vertices for the flashlight triangle
-    Gdiplus::Point flashlightVertices[3] = {playerPos, p1, p2};
+    Gdiplus::Point flashlightVertices[3];
+    flashlightTriangle(flashlightVertices);
 
     // create a GraphicsPath to represent the triangle
     Gdiplus::GraphicsPath path;
@@ -473,8 +827,6 @@ void illuminateFlashLight(Gdiplus::Graphics& graphics)
 
 void shootBullet(int x, int y)
 {
-    if (numBullets==0) return;
-    else numBullets--;
     // get position in world space
     Vector2 dest = getWorldSpaceCoords((float)x, (float)y);
 
@@ -484,286 +836,296 @@ void shootBullet(int x, int y)
 
     // normalised
     dest.normalise();
+    fireBullet(dest);
+}
 
-    // instantiate a bullet on the player moving in the direction of dest
-    GameObject * bullet = new GameObject(bulletImg, 1,
+void fireBullet(Vector2 dir)
+{
+    ALLOC_SCOPE(ALLOC_BULLETS);
+    if (numBullets==0) return;
+    else numBullets--;
+    // instantiate a bullet on the player moving in the direction of dir
+    GameObject * bullet = new GameObject(bulletImg, tuning->bulletDamage,
         player->pos.x+player->size[0]/2-10, player->pos.y+player->size[1]/2-10,
-        400.0f, PLAYER_BULLET, 400.0f*dest.x, 400.0f*dest.y);
+        tuning->bulletSpeed, PLAYER_BULLET, tuning->bulletSpeed*dir.x, tuning->bulletSpeed*dir.y);
     gameObjects.push_back(bullet);
+    emitParticles(PARTICLE_MUZZLE, bullet->pos.x+10+dir.x*15.0f, bullet->pos.y+10+dir.y*15.0f, dir.x, dir.y);
+}
+
+// one pair, obj0 of the given type against obj1, the boxes as they were when obj0
+// started checking. true when a bullet hit takes obj0 away
+template <int type> bool collidePair(GameObject * obj0, GameObject * obj1, int l0, int t0, int r0, int b0, int l1, int t1, int r1, int b1)
+{
+    // every case below needs the boxes to overlap, most pairs don't
+    if (r0<=l1 || l0>=r1 || b0<=t1 || t0>=b1) return false;
+
+    if (l0<r1&&r0>r1) {
+        if ((t0>t1&&b0<b1)||(t0<t1&&b0>b1)) {
+            if (type==PLAYER_BULLET) {
+                int res = bulletHit(obj0, obj1);
+                if (res == 0) return false;
+                else return true;
+            } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+            //NEW FOR ENEMY
+            else if (type == PLAYER && obj1->entityType == ENEMY){
+                hurtPlayer(1);
+            }
+            else obj0->pos.x = r1;
+        } else {
+            int dTop    = (b1-t0)*(b0>b1),
+                dBottom = (b0-t1)*(t0<t1),
+                dLeft   = r1-l0;
+            if (dTop>0) {
+                if (type==PLAYER_BULLET) {
+                    int res = bulletHit(obj0, obj1);
+                    if (res == 0) return false;
+                    else return true;
+                } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+                //NEW FOR ENEMY
+                if (type == PLAYER && obj1->entityType == ENEMY){
+                    hurtPlayer(1);
+                }
+                else if (dLeft>dTop) obj0->pos.y = b1;
+                else obj0->pos.x = r1;
+            } else if (dBottom>0) {
+                if (type==PLAYER_BULLET) {
+                    int res = bulletHit(obj0, obj1);
+                    if (res == 0) return false;
+                    else return true;
+                } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+                //NEW FOR ENEMY
+                if (type == PLAYER && obj1->entityType == ENEMY){
+                    hurtPlayer(1);
+                }
+                else if (dLeft>dBottom) obj0->pos.y = t1-obj0->size[1];
+                else obj0->pos.x = r1;
+            }
+        }
+    } else if (r0>l1&&l0<l1) {
+        if ((t0>t1&&b0<b1)||(t0<t1&&b0>b1)) {
+            if (type==PLAYER_BULLET) {
+                int res = bulletHit(obj0, obj1);
+                if (res == 0) return false;
+                else return true;
+            } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+            //NEW FOR ENEMY
+            if (type == PLAYER && obj1->entityType == ENEMY){
+                hurtPlayer(1);
+            }
+            else obj0->pos.x = l1-obj0->size[0];
+        } else {
+            int dTop    = (b1-t0)*(b0>b1),
+                dBottom = (b0-t1)*(t0<t1),
+                dRight  = r0-l1;
+            if (dTop>0) {
+                if (type==PLAYER_BULLET) {
+                    int res = bulletHit(obj0, obj1);
+                    if (res == 0) return false;
+                    else return true;
+                } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+                //NEW FOR ENEMY
+                if (type == PLAYER && obj1->entityType == ENEMY){
+                    hurtPlayer(1);
+                }
+                else if (dRight>dTop) obj0->pos.y = b1;
+                else obj0->pos.x = l1-obj0->size[0];
+            } else if (dBottom>0) {
+                if (type==PLAYER_BULLET) {
+                    int res = bulletHit(obj0, obj1);
+                    if (res == 0) return false;
+                    else return true;
+                } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+                //NEW FOR ENEMY
+                if (type == PLAYER && obj1->entityType == ENEMY){
+                    hurtPlayer(1);
+                }
+                else if (dRight>dBottom) obj0->pos.y = t1-obj0->size[1];
+                else obj0->pos.x = l1-obj0->size[0];
+            }
+        }
+    } else if (b0>t1&&t0<t1) {
+        if ((l0>l1&&r0<r1)||(l0<l1&&r0>r1)) {
+            if (type==PLAYER_BULLET) {
+                int res = bulletHit(obj0, obj1);
+                if (res == 0) return false;
+                else return true;
+            } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+            //NEW FOR ENEMY
+            else if (type == PLAYER && obj1->entityType == ENEMY){
+                hurtPlayer(1);
+            }
+            else obj0->pos.y = t1-obj0->size[1];
+        }
+    } else if (t0<b1&&b0>b1) {
+        if ((l0>l1&&r0<r1)||(l0<l1&&r0>r1)) {
+            if (type==PLAYER_BULLET) {
+                int res = bulletHit(obj0, obj1);
+                if (res == 0) return false;
+                else return true;
+            } else if (isItem(obj1->entityType)) pickUpItem(obj0, obj1);
+            //NEW FOR ENEMY
+            if (type == PLAYER && obj1->entityType == ENEMY){
+                hurtPlayer(1);
+            }
+            else obj0->pos.y = b1;
+        }
+    }
+    return false;
+}
+
+// the biggest thing that isn't a wall, everything but walls is found through the
+// spatial grid by its centre
+constexpr int largestNonWallSize()
+{
+    int size = 0;
+    for (int type = 1; type < NUM_ENTITY_TYPES; type++) {
+        if (type == WALL) continue;
+        size = MAX(size, entityRegistry[type].width);
+        size = MAX(size, entityRegistry[type].height);
+    }
+    return size;
+}
+
+// checks obj0, of the given type, against the types it collides with. what it hits or
+// picks up (and obj0 itself, for a bullet that hits) is only marked removed
+template <int type> void collideEntity(GameObject * obj0)
+{
+    constexpr unsigned int collidesWith = EntityTraits<type>::collidesWith;
+    static_assert(collidesWith && !EntityTraits<type>::isStatic, "only moving types check collisions");
+    // hitbox for obj0
+    int l0 = obj0->pos.x,      t0 = obj0->pos.y,
+        r0 = l0+obj0->size[0], b0 = t0+obj0->size[1];
+
+    // walls come from the wall index, only the ones under the hitbox
+    bool gone = false;
+    if (collidesWith & TYPE_BIT(WALL)) {
+        queryWalls(l0, t0, r0, b0, [&](const WallShape& wall) {
+            return gone = collidePair<type>(obj0, wall.obj, l0, t0, r0, b0, wall.l, wall.t, wall.r, wall.b);
+        });
+        if (gone) return;
+    }
+
+    // the rest from the grid: anything overlapping has its centre within half of both
+    // sizes, and an object checked earlier this pass can have been pushed by up to its size
+    constexpr int reach = largestNonWallSize();
+    float half = MAX(obj0->size[0], obj0->size[1])/2.0f + reach/2.0f + reach;
+    queryRadius((l0+r0)/2.0f, (t0+b0)/2.0f, half, [&](GameObject * obj1) {
+        // object wont collide with itself or bullets
+        if (gone || obj1 == obj0 || obj1->removed || !(collidesWith & TYPE_BIT(obj1->entityType))) return;
+        int l1 = obj1->pos.x,      t1 = obj1->pos.y,
+            r1 = l1+obj1->size[0], b1 = t1+obj1->size[1];
+        gone = collidePair<type>(obj0, obj1, l0, t0, r0, b0, l1, t1, r1, b1);
+    });
+}
+
+int collidedRemovals = 0; // marked this pass
+
+// taken out of the game, it stays in gameObjects and the spatial grid until the pass is over
+void markRemoved(GameObject * obj)
+{
+    obj->removed = true;
+    collidedRemovals++;
+}
+
+// deletes what handleCollisions marked removed
+void removeCollided()
+{
+    if (!collidedRemovals) return;
+    collidedRemovals = 0;
+    for (int i = 0; i < gameObjects.size(); i++) {
+        if (!gameObjects[i]->removed) continue;
+        delete gameObjects[i];
+        gameObjects.erase(gameObjects.begin() + i--);
+    }
 }
 
 void handleCollisions()
 {
+    PROFILE_SCOPE("handleCollisions");
     for (int i = 0; i < gameObjects.size(); i++)
     {
-        // check if player is in load zone
-        if (gameObjects[i]==player) {
+        if (gameObjects[i]->removed) continue;
+        // check if player is in load zone, what's been removed goes before the room is stored
+        if (gameObjects[i]==player && !largeCaveMode && !holdLoadZones) {
+            bool leaving = player->pos.x > bkgWidth || player->pos.y > bkgHeight ||
+                player->pos.x < -player->size[0] || player->pos.y < -player->size[1];
+            if (leaving) removeCollided();
             if (player->pos.x > bkgWidth) { // right load zone
-                if (roomQueue.top()==RIGHT) roomQueue.pop();
-                else roomQueue.push(LEFT);
-                generateRoom(Vector2 {5.0f, player->pos.y});
+                changeRoom(RIGHT, Vector2 {5.0f, player->pos.y});
                 break;
             } else if (player->pos.y > bkgHeight) { // bottom load zone
-                if (roomQueue.top()==DOWN) roomQueue.pop();
-                else roomQueue.push(UP);
-                generateRoom(Vector2 {player->pos.x, 5.0f});
+                changeRoom(DOWN, Vector2 {player->pos.x, 5.0f});
                 break;
             } else if (player->pos.x < -player->size[0]) { // left load zone
-                if (roomQueue.top()==LEFT) roomQueue.pop();
-                else roomQueue.push(RIGHT);
-                generateRoom(Vector2 {bkgWidth-player->size[0]-5.0f, player->pos.y});
+                changeRoom(LEFT, Vector2 {bkgWidth-player->size[0]-5.0f, player->pos.y});
                 break;
             } else if (player->pos.y < -player->size[1]) { // top load zone
-                if (roomQueue.top()==UP) roomQueue.pop();
-                else roomQueue.push(4);
-                generateRoom(Vector2 {player->pos.x, bkgHeight-player->size[1]-5.0f});
+                changeRoom(UP, Vector2 {player->pos.x, bkgHeight-player->size[1]-5.0f});
                 break;
             }
         }
 
-        // other objects collide with walls, not the other way around
-        if (gameObjects[i]->entityType == WALL) continue;
-        // hitbox for gameObjects[i]
-        GameObject * obj0 = gameObjects[i];
-        int l0 = obj0->pos.x,      t0 = obj0->pos.y,
-            r0 = l0+obj0->size[0], b0 = t0+obj0->size[1];
-
-        for (int j = 0; j < gameObjects.size(); j++)
-        {
-            GameObject * obj1 = gameObjects[j];
-            if (i == j || obj1->entityType==PLAYER_BULLET) continue; // object wont collide with itself or bullets
-
-            int l1 = obj1->pos.x,      t1 = obj1->pos.y,
-                r1 = l1+obj1->size[0], b1 = t1+obj1->size[1];
-
-            if (l0<r1&&r0>r1) {
-                if ((t0>t1&&b0<b1)||(t0<t1&&b0>b1)) {
-                    if (obj0->entityType==PLAYER_BULLET) {
-                        int res = bulletHit(obj0, obj1, &i, &j);
-                        if (res == 0) continue;
-                        else break;
-                    } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                    //NEW FOR ENEMY
-                    else if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                        player->health -= 1;
-                        std::cout << player->health << std::endl;
-                    }
-                    else obj0->pos.x = r1;
-                } else {
-                    int dTop    = (b1-t0)*(b0>b1),
-                        dBottom = (b0-t1)*(t0<t1),
-                        dLeft   = r1-l0;
-                    if (dTop>0) {
-                        if (obj0->entityType==PLAYER_BULLET) {
-                            int res = bulletHit(obj0, obj1, &i, &j);
-                            if (res == 0) continue;
-                            else break;
-                        } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                        //NEW FOR ENEMY
-                        if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                            player->health -= 1;
-                            std::cout << player->health << std::endl;
-                        }
-                        else if (dLeft>dTop) obj0->pos.y = b1;
-                        else obj0->pos.x = r1;
-                    } else if (dBottom>0) {
-                        if (obj0->entityType==PLAYER_BULLET) {
-                            int res = bulletHit(obj0, obj1, &i, &j);
-                            if (res == 0) continue;
-                            else break;
-                        } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                        //NEW FOR ENEMY
-                        if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                            player->health -= 1;
-                            std::cout << player->health << std::endl;
-                        }
-                        else if (dLeft>dBottom) obj0->pos.y = t1-obj0->size[1];
-                        else obj0->pos.x = r1;
-                    }
-                }
-            } else if (r0>l1&&l0<l1) {
-                if ((t0>t1&&b0<b1)||(t0<t1&&b0>b1)) {
-                    if (obj0->entityType==PLAYER_BULLET) {
-                        int res = bulletHit(obj0, obj1, &i, &j);
-                        if (res == 0) continue;
-                        else break;
-                    } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                    //NEW FOR ENEMY
-                    if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                        player->health -= 1;
-                        std::cout << player->health << std::endl;
-                    }
-                    else obj0->pos.x = l1-obj0->size[0];
-                } else {
-                    int dTop    = (b1-t0)*(b0>b1),
-                        dBottom = (b0-t1)*(t0<t1),
-                        dRight  = r0-l1;
-                    if (dTop>0) {
-                        if (obj0->entityType==PLAYER_BULLET) {
-                            int res = bulletHit(obj0, obj1, &i, &j);
-                            if (res == 0) continue;
-                            else break;
-                        } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                        //NEW FOR ENEMY
-                        if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                            player->health -= 1;
-                            std::cout << player->health << std::endl;
-                        }
-                        else if (dRight>dTop) obj0->pos.y = b1;
-                        else obj0->pos.x = l1-obj0->size[0];
-                    } else if (dBottom>0) {
-                        if (obj0->entityType==PLAYER_BULLET) {
-                            int res = bulletHit(obj0, obj1, &i, &j);
-                            if (res == 0) continue;
-                            else break;
-                        } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                        //NEW FOR ENEMY
-                        if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                            player->health -= 1;
-                            std::cout << player->health << std::endl;
-                        }
-                        else if (dRight>dBottom) obj0->pos.y = t1-obj0->size[1];
-                        else obj0->pos.x = l1-obj0->size[0];
-                    }
-                }
-            } else if (b0>t1&&t0<t1) {
-                if ((l0>l1&&r0<r1)||(l0<l1&&r0>r1)) {
-                    if (obj0->entityType==PLAYER_BULLET) {
-                        int res = bulletHit(obj0, obj1, &i, &j);
-                        if (res == 0) continue;
-                        else break;
-                    } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                    //NEW FOR ENEMY
-                    else if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                        player->health -= 1;
-                        std::cout << player->health << std::endl;
-                    }
-                    else obj0->pos.y = t1-obj0->size[1];
-                }
-            } else if (t0<b1&&b0>b1) {
-                if ((l0>l1&&r0<r1)||(l0<l1&&r0>r1)) {
-                    if (obj0->entityType==PLAYER_BULLET) {
-                        int res = bulletHit(obj0, obj1, &i, &j);
-                        if (res == 0) continue;
-                        else break;
-                    } else if (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO) pickUpItem(gameObjects[i], gameObjects[j], &j);
-                    //NEW FOR ENEMY
-                    if (obj0->entityType == PLAYER && obj1->entityType == ENEMY){
-                        player->health -= 1;
-                        std::cout << player->health << std::endl;
-                    }
-                    else obj0->pos.y = b1;
-                }
-            }
+        // the rest is specialised on the type of gameObjects[i], walls and items don't check
+        // collisions themselves, they only get checked against
+        switch (gameObjects[i]->entityType) {
+            case PLAYER:        collideEntity<PLAYER>(gameObjects[i]); break;
+            case PLAYER_BULLET: collideEntity<PLAYER_BULLET>(gameObjects[i]); break;
+            case ENEMY:         collideEntity<ENEMY>(gameObjects[i]); break;
         }
     }
+    removeCollided();
 }
 
-int bulletHit(GameObject* obj0, GameObject* obj1, int* i, int* j)
+int bulletHit(GameObject* obj0, GameObject* obj1)
 {
     // return codes: 0: hit player/other bullet, continue
     //               1: hit wall, delete self, break
     //               2: hit enemy, delete self, reduce hp from target, break
     // obj0->entityType == PLAYER_BULLET
     if (obj1->entityType==PLAYER_BULLET||obj1->entityType==PLAYER||
-    (obj1->entityType>=BATTERY&&obj1->entityType<=AMMO)) return 0;
+    isItem(obj1->entityType)) return 0;
+    float hitX = obj0->pos.x+obj0->size[0]/2, hitY = obj0->pos.y+obj0->size[1]/2;
     if (obj1->entityType==WALL) {
+        emitParticles(PARTICLE_IMPACT, hitX, hitY, -obj0->velocity.x, -obj0->velocity.y);
         // delete self
-        delete obj0;
-        gameObjects.erase(gameObjects.begin() + (*i)--);
+        markRemoved(obj0);
         return 1;
     } else {
+        emitParticles(PARTICLE_HIT, hitX, hitY, obj0->velocity.x, obj0->velocity.y);
         // reduce target hp
         obj1->health -= obj0->health;
         // delete self
-        delete obj0;
-        gameObjects.erase(gameObjects.begin() + (*i)--);
+        markRemoved(obj0);
         // if target has no more hp, delete
-        if (obj1->health <= 0) {
-            delete obj1;
-            gameObjects.erase(gameObjects.begin() + (*j)--);
-        }
+        if (obj1->health <= 0) markRemoved(obj1);
+        else behaviourHit(obj1);
         return 2;
     }
 }
 
-void checkidle(){
-    for (int i = 0; i < gameObjects.size(); i++){
-        if(gameObjects[i]->entityType == ENEMY){
-            int delta_x = (player->pos.x) - gameObjects[i]->pos.x;
-            int delta_y = (player->pos.y) - gameObjects[i]->pos.y;
-
-            float dist = sqrt((abs(delta_x))^2 + (abs(delta_y)^2));
-
-            if(dist <= 20){
-                gameObjects[i]->idle = false;
-                if(delta_x == 0){
-                    break;
-                }
-                else {
-                    float slope = (delta_y) / (delta_x);
-
-                    for(int j = player->pos.x; j < gameObjects[i]->pos.x; j++){
-                        int y_pos = (slope*j) + player->pos.x;
-
-                        //supposed to start idleness if there is a wall in the way but...
-                        for(int k = 0; k < gameObjects.size(); k++){
-                            if(gameObjects[k]->entityType == WALL){
-                                GameObject* temp = gameObjects[k];
-                                int l0 = temp->pos.x,      t0 = temp->pos.y,
-                                    r0 = l0+temp->size[0], b0 = t0+temp->size[1];
-                                if(j>l0 && j<r0 && y_pos<t0 && y_pos>b0) {
-                                    gameObjects[i]->idle = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if(gameObjects[i]->idle){
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-    }
-}
-
 void placeWalls()
 {
-    // BOUNDING WALLS
-    // top walls
-    GameObject * wall = new GameObject(Wall0Img, 100, 0.0f, 0.0f, 0.0f, WALL, (bkgWidth/2)-75, 100);
-    gameObjects.push_back(wall);
-    wall = new GameObject(Wall0Img, 100, (bkgWidth/2)+75, 0, 0.0f, WALL, (bkgWidth/2)-75, 100);
-    gameObjects.push_back(wall);
-
-    // left walls
-    wall = new GameObject(Wall0Img, 100, 0.0f, 0.0f, 0.0f, WALL, 100, (bkgHeight/2)-75);
-    gameObjects.push_back(wall);
-    wall = new GameObject(Wall0Img, 100, 0.0f, (bkgHeight/2)+75, 0.0f, WALL, 100, (bkgHeight/2)-75);
-    gameObjects.push_back(wall);
-
-    // right walls
-    wall = new GameObject(Wall0Img, 100, float(bkgWidth-100), 0.0f, 0.0f, WALL, 100, (bkgHeight/2)-75);
-    gameObjects.push_back(wall);
-    wall = new GameObject(Wall0Img, 100, float(bkgWidth-100), (bkgHeight/2)+75, 0.0f, WALL, 100, (bkgHeight/2)-75);
-    gameObjects.push_back(wall);
-
-    // bottom walls
-    wall = new GameObject(Wall0Img, 100, 0.0f, float(bkgHeight-100), 0.0f, WALL, (bkgWidth/2)-75, 100);
-    gameObjects.push_back(wall);
-    wall = new GameObject(Wall0Img, 100, (bkgWidth/2)+75, float(bkgHeight-100), 0.0f, WALL, (bkgWidth/2)-75, 100);
-    gameObjects.push_back(wall);
-
-    // random walls
-    interiorWalls.clear(); // remove existing walls
-    interiorWalls = generateWalls(); // generate a new set of walls
-    for (auto i : interiorWalls) {
-        Vector2 *pos = i.first;
-        float scale = i.second;
-
-        wall = new GameObject(Wall0Img, 100, pos->x, pos->y, 0.0f, WALL, int(100.0f*scale), int(100.0f*scale));
+    // the room is a cave the size of the background, the load zones are gaps in the
+    // middle of each side
+    int cols = (bkgWidth+CAVE_CELL_SIZE-1) / CAVE_CELL_SIZE, rows = (bkgHeight+CAVE_CELL_SIZE-1) / CAVE_CELL_SIZE;
+    CaveSpan exitRows = {(bkgHeight-CAVE_EXIT_WIDTH)/2 / CAVE_CELL_SIZE, ((bkgHeight+CAVE_EXIT_WIDTH)/2 + CAVE_CELL_SIZE-1) / CAVE_CELL_SIZE};
+    CaveSpan exitCols = {(bkgWidth-CAVE_EXIT_WIDTH)/2 / CAVE_CELL_SIZE, ((bkgWidth+CAVE_EXIT_WIDTH)/2 + CAVE_CELL_SIZE-1) / CAVE_CELL_SIZE};
+    uint64_t seed = (uint64_t)randomInt() << 32;
+    seed ^= (uint64_t)randomInt();
+    generateCave(roomCave, cols, rows, seed, exitRows, exitCols);
+
+    std::vector<CaveRect> rects;
+    mergeCaveWalls(roomCave, rects);
+    for (size_t i = 0; i < rects.size(); i++) {
+        // the last row and column of cells stick out past the room
+        int x = rects[i].x*CAVE_CELL_SIZE, y = rects[i].y*CAVE_CELL_SIZE;
+        int right = (rects[i].x+rects[i].w)*CAVE_CELL_SIZE, bottom = (rects[i].y+rects[i].h)*CAVE_CELL_SIZE;
+        if (right > bkgWidth) right = bkgWidth;
+        if (bottom > bkgHeight) bottom = bkgHeight;
+
+        GameObject * wall = new GameObject(Wall0Img, 100, (float)x, (float)y, 0.0f, WALL, right-x, bottom-y);
         gameObjects.push_back(wall);
+        blockSpawnArea(spawnMask, (float)x, (float)y, float(right-x), float(bottom-y));
     }
 }
 
@@ -777,84 +1139,65 @@ void placeText(int x, int y, std::wstring text, Gdiplus::Color color, int size,
     graphics.DrawString(text.c_str(), -1, &font, Gdiplus::PointF(x, y), &brush);
 }
 
-void drainLight()
+// enemy contact, then nothing more until the invulnerability window is over
+void hurtPlayer(int damage)
 {
-    if (!gameIsPaused&&flashlightOn) flashLightCharge = MAX(flashLightCharge-deltaTime, 0.0f);
-    // flashlight gets dimmer as it loses charge (interpolation)
-    float inerpolationCharge = MIN(flashLightCharge,maxCharge);
-    float t = 1 - 1.0f*inerpolationCharge/maxCharge; t *= t*t*t*t; // f(t) = t^5
-    flashlightBrightness = (1-t) + (ambientLightPercent * t);
+    if (timersPending(TIMER_INVULNERABLE)) return;
+    player->health -= damage;
+    scheduleTimer(TIMER_INVULNERABLE, PLAYER_INVULNERABLE_SECONDS);
+    LOG_DEBUG("player hit", "health", player->health);
+}
 
-    ambientLightPercent = 0.5f / (float)roomQueue.size();
-    if (roomQueue.size() >= 3 ) ambientLightPercent /= float(roomQueue.size()/3);
+// the charge goes a step at a time, taken when the step starts so switching
+// the flashlight off and on again never gets light for free
+void drainBatteryStep(uint32 data)
+{
+    if (!flashlightOn || flashLightCharge <= 0.0f) return; // the next switch on starts a new step
+    flashLightCharge = MAX(flashLightCharge-BATTERY_DRAIN_STEP, 0.0f);
+    scheduleTimer(TIMER_BATTERY_DRAIN, BATTERY_DRAIN_STEP);
 }
 
-std::unordered_map<Vector2*, float> generateWalls()
+void advanceCaveClock(uint32 data)
 {
-    std::unordered_map<Vector2*,float> umap;
-    int n = rand() % 16; // 0 - 15 walls will be placed
-    // umap entries: first = position, second = scale
-    // all walls will be square
-
-    for (int i = 0; i < n; i++) {
-        // random x, 100 - bkgWidth-200
-        int range = bkgWidth-300;
-        float x = 100.0f + float(rand() % range);
-        // random y, 100 - bkgHeight-200
-        range = bkgHeight-300;
-        float y = 100.0f + float(rand() % range);
-
-        // scale, 0.5 - 2.0
-        float s = float(1 + (rand() % 4))/2.0f; // (1-4)/2 = .5-2
-
-        // create umap entry
-        umap[new Vector2 {x, y}] = s;
-    }
-    return umap;
+    timer += 1.0f;
+    scheduleTimer(TIMER_CAVE_CLOCK, CAVE_CLOCK_SECONDS);
+}
+
+void drainLight()
+{
+    if (!gameIsPaused && !timersPending(TIMER_BATTERY_DRAIN)) drainBatteryStep(0);
+    // flashlight gets dimmer as it loses charge (interpolation)
+    float inerpolationCharge = MIN(flashLightCharge,maxCharge);
+    float t = 1 - 1.0f*inerpolationCharge/maxCharge, falloff = 1.0f;
+    for (int i = 0; i < tuning->lightFalloff; i++) falloff *= t; // f(t) = t^lightFalloff, t^5 by default
+    flashlightBrightness = (1-falloff) + (ambientLightPercent * falloff);
+
+    // the large cave gets darker with distance from the start instead of with rooms
+    int depth = largeCaveMode ? chunkDistanceFromStart()+1 : (int)roomQueue.size();
+    ambientLightPercent = tuning->ambientLight / (float)depth;
+    if (depth >= tuning->darkerEvery) ambientLightPercent /= float(depth/tuning->darkerEvery);
 }
 
 void generateEnemies(int n){
-    //Make n new enemies
-    for (int i = 0; i < n; i++){
-        bool isinwall = true;
-        float enemy_x;
-        float enemy_y;
-
-        while (isinwall) {
-            bool repeat = false;
-            //Find a random position in the window for the enemy to spawn
-            int range = bkgWidth - 300;
-            float test_x = 100.0f + float(rand() % range);
-            enemy_x = test_x;
-
-            range = bkgHeight - 300;
-            float test_y = 100.0f + float(rand() % range);
-            enemy_y = test_y;
-
-            //Compare these values with the positions of walls
-            for (int i; i < gameObjects.size(); i++) {
-                GameObject* temp = gameObjects[i];
-
-                if(temp->entityType == WALL) {
-                    int l0 = temp->pos.x, t0 = temp->pos.y,
-                        r0 = l0 + temp->size[0], b0 = t0 + temp->size[1];
-
-                    if (enemy_x>l0 && enemy_x<r0 && enemy_y<t0 && enemy_y>b0) {
-                        repeat = true;
-                        break;
-                    }
-                }
-            }
+    //Make n new enemies, away from walls, the player and each other
+    std::vector<Vector2> positions;
+    placeSpawns(spawnMask, n, 30.0f, 30.0f, SPAWN_ENEMY_SPACING, positions);
 
-            if(not repeat){
-                isinwall = false;
-            }
-        }
-        GameObject* enemy = new GameObject(enemyImg, 5, enemy_x, enemy_y, 5.0f, ENEMY);
+    for (size_t i = 0; i < positions.size(); i++) {
+        GameObject* enemy = new GameObject(enemyImg, tuning->enemyHealth, positions[i].x, positions[i].y, tuning->enemySpeed, ENEMY);
         gameObjects.push_back(enemy);
     }
 }
 
+// the F6 stress test, n more enemies in the room as it is now, chasing like the rest
+void spawnStressEnemies(int n)
+{
+    beginSpawnPlacement();
+    size_t first = gameObjects.size();
+    generateEnemies(n);
+    for (size_t i = first; i < gameObjects.size(); i++) startBehaviour(gameObjects[i]);
+}
+
 void loadImages()
 {
     // load background
@@ -874,115 +1217,120 @@ void loadImages()
     ammoImg = Gdiplus::Image::FromFile(L"images/Ammo.png");
 }
 
+int largestItemSize()
+{
+    int itemSize = 0;
+    for (int type = BATTERY; type <= AMMO; type++) {
+        const EntityInfo& info = entityInfo(type);
+        itemSize = MAX(itemSize, info.width);
+        itemSize = MAX(itemSize, info.height);
+    }
+    return itemSize;
+}
+
 void placeItems()
 {
-    int n = (int)timer+(rand() % (6+(int)timer)); // spawns q-5+2q items (increases as time moves on)
+    int n = (int)timer+(randomInt() % (6+(int)timer)); // spawns q-5+2q items (increases as time moves on)
 
-    for (int i = 0; i < n; i++)
-    {
-        // random x
-        int range = bkgWidth-140;
-        float x = 100.0f + float(rand() % range);
-        // random y
-        range = bkgHeight-140;
-        float y = 100.0f + float(rand() % range);
+    // spots big enough for any item, crowded rooms just get fewer
+    int itemSize = largestItemSize();
+    std::vector<Vector2> positions;
+    placeSpawns(spawnMask, n, (float)itemSize, (float)itemSize, SPAWN_ITEM_SPACING, positions);
 
+    for (size_t i = 0; i < positions.size(); i++)
+    {
         // coose item type, BATTERY - AMMO
-        int type = BATTERY + (rand() % (AMMO-BATTERY+1));
-        Gdiplus::Image *img;
-        int width, height;
-        switch (type)
-        {
-            case BATTERY: 
-                img = batteryImg; 
-                width = 30; height = 30;
-                break;
-            case GEM:
-                img = gem0Img;
-                width = 30; height = 30;
-                break;
-            case AMMO: 
-                img = ammoImg; 
-                width = 30; height = 20;
-                break;
-        }
+        int type = BATTERY + (randomInt() % (AMMO-BATTERY+1));
+        const EntityInfo& info = entityInfo(type);
 
         // instantiate item
-        GameObject * item = new GameObject(img, 1, x, y, 0.0f, type, width, height);
+        GameObject * item = new GameObject(*info.sprite, 1, positions[i].x, positions[i].y, 0.0f, type, info.width, info.height);
         gameObjects.push_back(item);
     }
 }
 
-void pickUpItem(GameObject* obj0, GameObject* obj1, int* j)
+void pickUpItem(GameObject* obj0, GameObject* obj1)
 {
-    // obj1 = gameObjects[j], will be of type ITEM
+    // obj1 will be of type ITEM
     if (obj0->entityType == PLAYER) {
-        switch (obj1->entityType)
-        {
-            case BATTERY:
-                flashLightCharge += 5.0f;
-                break;
-            case GEM:
-                numGems += obj1->health;
-                break;
-            case AMMO:
-                numBullets += 5;
-                break;
-        }
+        entityInfo(obj1->entityType).pickUp(obj1);
+        emitParticles(PARTICLE_PICKUP, obj1->pos.x+obj1->size[0]/2, obj1->pos.y+obj1->size[1]/2, 1.0f, 0.0f);
         // destroy obj1
-        delete obj1;
-        gameObjects.erase(gameObjects.begin() + (*j)--);
+        markRemoved(obj1);
     }
 }
 
-void generateRoom(Vector2 playerPos)
+void pickUpBattery(GameObject* item) { flashLightCharge += tuning->batteryCharge; }
+void pickUpGem(GameObject* item)     { numGems += item->health; }
+void pickUpAmmo(GameObject* item)    { numBullets += tuning->ammoPickup; }
+
+void spawnPlayer(Vector2 playerPos)
 {
-    gameObjects.clear(); // delete existing game objects
     // instantiate player object
     player = new GameObject(playerImg,
-    10, playerPos.x, playerPos.y, 200.0f, PLAYER);
+    tuning->playerHealth, playerPos.x, playerPos.y, tuning->playerSpeed, PLAYER);
     gameObjects.push_back(player);
+}
 
-    placeItems();
+void generateRoom(Vector2 playerPos)
+{
+    PROFILE_SCOPE("generateRoom");
+    ALLOC_SCOPE(ALLOC_ROOM);
+    gameObjects.clear(); // delete existing game objects
+    spawnPlayer(playerPos);
+
+    // walls first so items and enemies are placed around them
+    beginSpawnPlacement();
     placeWalls();
+    placeItems();
     generateEnemies(numEnemies);
+    resetBehaviours();
 }
 
-int loadGlobals()
+// moves the player through the load zone on side dir
+void changeRoom(int dir, Vector2 playerPos)
 {
-    // txt file, tab separated:
-    // flashRange   flashWidth  initialBullets  initialCharge   gemsSaved
+    ALLOC_SCOPE(ALLOC_ROOM);
+    // keep the room being left
+    storeRoom(currentRoomKey());
+
+    // moving back the way the queue says is progress, anything else is a room deeper
+    int opposite[] = {0, RIGHT, LEFT, DOWN, UP};
+    if (roomQueue.top()==dir) roomQueue.pop();
+    else roomQueue.push(opposite[dir]);
+
+    // a room that was visited before comes back as it was left
+    if (restoreRoom(currentRoomKey())) {
+        spawnPlayer(playerPos);
+        resetBehaviours();
+    } else generateRoom(playerPos);
+
+    RoomCacheStats stats = roomCacheStats();
+    LOG_INFO("room changed", "depth", (uint32)roomQueue.size(),
+        "hitRate", float(stats.hotHits+stats.coldHits) / float(stats.hotHits+stats.coldHits+stats.misses),
+        "hotBytes", stats.hotBytes, "coldBytes", stats.coldBytes);
+}
 
-    FILE* file;
-    file = fopen("playerData.txt", "r");
-    if (!file) return -1;
+int loadGlobals()
+{
+    // defaults for anything the save doesn't have
+    SaveFields fields = collectSaveFields();
 
-    // read in data
-    fscanf(file, "%f\t%f\t%d\t%f\t%d",
-        &flashRange, &flashWidth,
-        &initialBullets, &maxCharge, &gemsSaved);
+    // binary save, falling back to importing the old tab separated file
+    if (readSaveFile(&fields) != 0 && importLegacySave(&fields) != 0) return -1;
 
     // set globals
+    applySaveFields(fields);
     numBullets = initialBullets;
     flashLightCharge = maxCharge;
-
-    fclose(file);
     return 0;
 }
 
 int saveGlobals()
 {
-    FILE* file;
-    file = fopen("playerData.txt", "w");
-    if (!file) return -1;
-
-    // write data
-    fprintf(file, "%f\t%f\t%d\t%f\t%d",
-        flashRange, flashWidth,
-        initialBullets, maxCharge, gemsSaved);
-
-    fclose(file);
-    return 0;
+    int res = writeSaveFile(collectSaveFields());
+    if (res != 0) LOG_ERROR("failed to save progression", "file", SAVE_FILE);
+    return res;
 }
 
 void drawPauseMenuUI(Gdiplus::Graphics& graphics, int state)
@@ -1023,7 +1371,7 @@ void drawPauseMenuUI(Gdiplus::Graphics& graphics, int state)
         std::to_wstring(int((maxCharge-(int)maxCharge)*100))+L's';
     placeText(25+(3*wndWidth/4), wndHeight/2, text, Gdiplus::Color(255,255,255), 12, graphics);
 
-    text = L"Click on a stat to improve it for 10 gems!";
+    text = L"Click on a stat to improve it for "+std::to_wstring(tuning->upgradeCost)+L" gems!";
     placeText(wndWidth/2-150, wndHeight/4, text, Gdiplus::Color(255,255,255), 12, graphics);
     text = L"Available gems: "+std::to_wstring(gemsSaved);
     placeText(wndWidth/2-70, wndHeight/4+30, text, Gdiplus::Color(255,255,255), 12, graphics);
@@ -1062,31 +1410,50 @@ void interactWithPauseMenu(int x, int y, HWND hwnd)
                 improveStat(CHARGE);
             }
         } else if (y>3*wndHeight/4-30 && y<3*wndHeight/4+20) { // reset button
-            // clear queue
-            while (!roomQueue.empty()) roomQueue.pop();
-            // reset inventory
-            numBullets = initialBullets;
-            flashLightCharge = maxCharge; flashlightOn = 0;
-            numGems = 0;
-            // reset game
-            roomQueue.push(LEFT);
-            generateRoom(Vector2 {150.0f, (float)bkgHeight/2.0f});
-            gameIsPaused = false;
+            newRun();
         } else if (y>3*wndHeight/4+50 && y<3*wndHeight/4+100) { // exit button
             SendMessage(hwnd, WM_CLOSE, 0, 0); // close the window
         }
     }
 }
 
+void newRun()
+{
+    ALLOC_SCOPE(ALLOC_ROOM);
+    // clear queue
+    while (!roomQueue.empty()) roomQueue.pop();
+    clearRoomCache();
+    // reset inventory
+    numBullets = initialBullets;
+    flashLightCharge = maxCharge; flashlightOn = 0;
+    numGems = 0;
+    resetTimers();
+    // counters that feed the simulation start again, so a run only depends on its seed
+    restartBehaviourClock();
+    lodTick = 0;
+    nextEntityId = 0;
+    playerToMouse = Vector2 {1, 0};
+    // reset game
+    roomQueue.push(LEFT);
+    if (largeCaveMode) startChunkWorld((uint32)randomInt());
+    else {
+        for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+        gameObjects.clear();
+        generateRoom(Vector2 {150.0f, (float)bkgHeight/2.0f});
+    }
+    gameIsPaused = false;
+}
+
 void improveStat(int stat)
 {
-    if (gemsSaved < 10) return;
-    gemsSaved -= 10;
+    if (gemsSaved < (unsigned int)tuning->upgradeCost) return;
+    gemsSaved -= tuning->upgradeCost;
     switch (stat)
     {
-        case WIDTH: flashWidth += 0.01f; break;
-        case RANGE: flashRange += 1.0f; break;
-        case BULLET_COUNT: initialBullets++; break;
-        case CHARGE: maxCharge += 1.0f; break;
+        case WIDTH: flashWidth += tuning->upgradeWidth; break;
+        case RANGE: flashRange += tuning->upgradeRange; break;
+        case BULLET_COUNT: initialBullets += tuning->upgradeBullets; break;
+        case CHARGE: maxCharge += tuning->upgradeCharge; break;
     }
+    requestAutosave(); // gems were spent, don't lose the upgrade if the game closes badly
 }
@@ -2,15 +2,20 @@
 #define UNICODE
 #endif
 
-// macros
-#define PLAYER 1
-#define PLAYER_BULLET 2
-#define WALL 3
-#define BATTERY 4
-#define GEM 5
-#define AMMO 6
-#define ENEMY 7
+// entity types, indexes into entityRegistry
+enum EntityType {
+    PLAYER = 1,
+    PLAYER_BULLET,
+    WALL,
+    BATTERY,
+    GEM,
+    AMMO,
+    ENEMY,
+    NUM_ENTITY_TYPES
+};
+#define TYPE_BIT(type) (1u << (type)) // bit for an entity type in a collision mask
 
+// macros
 #define LEFT 1
 #define RIGHT 2
 #define UP 3
@@ -21,25 +26,43 @@
 #define BULLET_COUNT 3
 #define CHARGE 4
 
+#define LOD_NEAR 0 // simulated every tick
+#define LOD_MID 1  // simulated every few ticks
+#define LOD_FAR 2  // asleep
+
+// steps of enemyBehaviour, patrol and chase are what the idle flag was
+#define BEHAVIOUR_CHASE 0
+#define BEHAVIOUR_PATROL 1
+#define BEHAVIOUR_LISTEN 2
+#define BEHAVIOUR_FLEE 3
+#define BEHAVIOUR_SLEEP 4
+
 #define PAUSE 0
 #define VICTORY 1
 #define LOSS 2
 
-#define MIN(a,b) (a<b)? a : b
-#define MAX(a,b) (a>b)? a : b
+#define PLAYER_INVULNERABLE_SECONDS 0.5f // after contact damage, shared in co-op like health
+#define BATTERY_DRAIN_STEP 0.1f          // seconds of charge taken at a time
+#define CAVE_CLOCK_SECONDS 10.0f         // of unpaused play, timer goes up by 1 each
+
+#define MIN(a,b) ((a)<(b)? (a) : (b))
+#define MAX(a,b) ((a)>(b)? (a) : (b))
 // typedefs
 typedef unsigned char uint8; // 8 bit unsigned integer
+typedef unsigned short uint16; // 16 bit unsigned integer
+typedef unsigned int uint32; // 32 bit unsigned integer
 
 /* 
 REMEMBER TO LINK WITH -lgdi32 and -lgdiplus WHEN COMPILING !!!!!
 
     example command line:
-    cd "folder path" ; if ($?) { g++ Runner.cpp -o Runner -lgdi32 -lgdiplus } ; if ($?) { .\Runner } 
+    cd "folder path" ; if ($?) { g++ -std=c++20 Runner.cpp -o Runner -lgdi32 -lgdiplus } ; if ($?) { .\Runner } 
     
     - remember to run Runner.cpp, not CaveGame.cpp
 */
 
-// windows
+// windows, winsock has to come first
+#include <winsock2.h>
 #include <Windows.h>
 #include <windowsx.h>
 #include <WinUser.h>
@@ -56,6 +79,7 @@ REMEMBER TO LINK WITH -lgdi32 and -lgdiplus WHEN COMPILING !!!!!
 #include <cmath>
 
 #pragma comment (lib, "Gdiplus.lib")
+#pragma comment (lib, "Ws2_32.lib")
 
 // structs & classes
 // stores x and y dimensions as floats
@@ -74,48 +98,116 @@ struct Vector2{
     }
 };
 
+// textures, a GameObject keeps an index into textureTable instead of the image
+#define NUM_TEXTURES 8
+uint8 textureIndex(Gdiplus::Image * image); // 0 if it isn't in the table
+Gdiplus::Image * textureImage(uint8 index);
+
+struct GameObject;
+void stopBehaviour(GameObject * enemy); // Behaviour.hpp
+uint16 newEntityId(); // for a new GameObject, counts up with the run's state and wraps
+
+// a speed in 1/SPEED_STEPS pixels per second, 0 - 4095.9375, read and written as a float
+#define SPEED_STEPS 16.0f
+struct QuantizedSpeed {
+    uint16 steps;
+
+    QuantizedSpeed& operator=(float speed) {
+        float s = speed*SPEED_STEPS + 0.5f;
+        steps = s <= 0.0f ? 0 : s >= 65535.0f ? 65535 : (uint16)s;
+        return *this;
+    }
+    operator float() const { return steps / SPEED_STEPS; }
+};
+
 // information about a game object
-struct GameObject{
-    // bullets wont have health, so hp can be used to identify how much damage a bullet does
-    int health;
+// one 32 byte record, allocated from EntityPool so two share each cache line
+struct alignas(32) GameObject{
     Vector2 pos;
     Vector2 velocity = {0.0f, 0.0f};
-    float moveSpeed;
-    int entityType;
-    bool idle = true;
+    float lodTime = 0.0f; // simulation level of detail, enemies only: time since the last simulated tick
+    // bullets wont have health, so hp can be used to identify how much damage a bullet does
+    int16_t health;
+    int16_t size[2]; // image dimensions
+    QuantizedSpeed moveSpeed;
+    uint8 entityType : 4;
+    uint8 texture : 4; // rendering, index into textureTable
+    // flags
+    uint8 behaviour : 3; // step of enemyBehaviour
+    uint8 lodAwake : 1;  // simulated this tick
+    uint8 lodTier : 2;
+    uint8 removed : 1;   // hit or picked up, deleted at the end of handleCollisions
+    uint16 id; // the same for the entity's whole life, kept in snapshots, unlike its address
 
-    // rendering
-    Gdiplus::Image * img;
-    int size[2]; // image dimensions
+    Gdiplus::Image * image() const { return textureImage(texture); }
 
     // constructors
     GameObject(Gdiplus::Image * image, int hp, float x, float y, float speed, int type) {
-        img = image;
+        texture = textureIndex(image);
         size[0] = 30; size[1] = 30;
-        health = hp;
+        health = (int16_t)hp;
         pos.x = x; pos.y = y;
         moveSpeed = speed;
-        entityType = type;
+        entityType = (uint8)type;
+        behaviour = BEHAVIOUR_PATROL; lodAwake = true; lodTier = LOD_NEAR; removed = false;
+        id = newEntityId();
     }
 
     GameObject(Gdiplus::Image * image, int hp, float x, float y, float speed, int type, float velX, float velY) {
-        img = image;
+        texture = textureIndex(image);
         size[0] = 20; size[1] = 20;
-        health = hp;
+        health = (int16_t)hp;
         pos.x = x; pos.y = y;
         moveSpeed = speed;
-        entityType = type;
+        entityType = (uint8)type;
+        behaviour = BEHAVIOUR_PATROL; lodAwake = true; lodTier = LOD_NEAR; removed = false;
+        id = newEntityId();
         velocity.x = velX; velocity.y = velY;
     }
 
     GameObject(Gdiplus::Image * image, int hp, float x, float y, float speed, int type, int sizeX, int sizeY) {
-        img = image;
-        size[0] = sizeX; size[1] = sizeY;
-        health = hp;
+        texture = textureIndex(image);
+        size[0] = (int16_t)sizeX; size[1] = (int16_t)sizeY;
+        health = (int16_t)hp;
         pos.x = x; pos.y = y;
         moveSpeed = speed;
-        entityType = type;
+        entityType = (uint8)type;
+        behaviour = BEHAVIOUR_PATROL; lodAwake = true; lodTier = LOD_NEAR; removed = false;
+        id = newEntityId();
+    }
+
+    ~GameObject() {
+        if (entityType == ENEMY) stopBehaviour(this);
     }
+
+    // new and delete go through EntityPool
+    static void * operator new(size_t bytes);
+    static void operator delete(void * record);
+};
+
+// compile time information about an entity type
+struct EntityInfo {
+    bool isStatic;              // never moves, skipped by velocity/position updates
+    bool isItem;                // can be picked up by the player
+    unsigned int collidesWith;  // TYPE_BIT mask of the types this type checks collisions against
+    int width, height;          // default dimensions
+    Gdiplus::Image ** sprite;   // texture, loaded at runtime
+    void (*pickUp)(GameObject * item); // effect on the player's inventory when picked up
+};
+
+// pixels of the offscreen buffer, 32 bit BGRA top down
+struct FrameBuffer {
+    uint32 * pixels; // null if the DIB section couldn't be made, then only GDI draws to it
+    int width, height;
+    int stride; // pixels per row
+};
+
+// distances (in pixels from the player) for enemy simulation tiers
+struct LodSettings {
+    bool enabled;
+    float nearDistance; // closer than this ticks every frame
+    float midDistance;  // closer than this ticks every midInterval frames, further sleeps
+    uint32 midInterval;
 };
 
 // windows
@@ -133,32 +225,50 @@ void createBufferFrame(HWND hwnd);
 void loadImages();
 
 float DeltaTime(); // time elapsed between frames
+int randomInt(); // replacement for rand()
+void seedRandom(uint32 seed);
 
 // drawing
 void drawGameObject(GameObject * obj, Gdiplus::Graphics * graphics);
 void drawBackgroundSection(Gdiplus::Graphics& graphics, Gdiplus::Image* image);
+void flashlightTriangle(Gdiplus::Point * vertices); // screen space, the player first
 void illuminateFlashLight(Gdiplus::Graphics& graphics);
 // text
 void placeText(int x, int y, std::wstring text, Gdiplus::Color color, int size, Gdiplus::Graphics& graphics);
 void drawPauseMenuUI(Gdiplus::Graphics& graphics, int state);
 
 // game objects
-void shootBullet(int x, int y);
+void shootBullet(int x, int y); // at a point on the window
+void fireBullet(Vector2 dir); // along a unit vector
 void generateEnemies(int n);
+void spawnStressEnemies(int n); // into a live room
+void removeDeadObjects();
+void assignLodTiers();
 void updateVelocities();
 void updatePositions();
 void updateGameObjects();
+void tickGame(float dt); // one step of the game rules, without input or drawing
+void newRun(); // empties the cave and starts again from the first room
 
 void placeWalls();
 
 void drainLight();
+void hurtPlayer(int damage); // nothing while invulnerable
+// timer effects
+void drainBatteryStep(uint32 data);
+void advanceCaveClock(uint32 data);
 
 void handleCollisions();
-int bulletHit(GameObject* obj0, GameObject* obj1, int* i, int* j);
-void checkidle();
-void pickUpItem(GameObject* obj0, GameObject* obj1, int* j);
+int bulletHit(GameObject* obj0, GameObject* obj1);
+void markRemoved(GameObject * obj);
+void pickUpItem(GameObject* obj0, GameObject* obj1);
+// item pickup effects
+void pickUpBattery(GameObject* item);
+void pickUpGem(GameObject* item);
+void pickUpAmmo(GameObject* item);
 
 // conversions/logic
+Vector2 cameraOffset(); // world space position of the top left of the window
 Vector2 getWorldSpaceCoords(float x, float y); // converts from window coordinates to corridinates in game
 Gdiplus::Point getScreenCoords(float x, float y);
 int loadGlobals();
@@ -167,6 +277,33 @@ void interactWithPauseMenu(int x, int y, HWND hwnd);
 void improveStat(int stat);
 
 // generation
-std::unordered_map<Vector2*, float> generateWalls();
 void placeItems();
-void generateRoom(Vector2 playerPos);
\ No newline at end of file
+int largestItemSize(); // width or height of the biggest item, spawn spots fit any of them
+void spawnPlayer(Vector2 playerPos);
+void generateRoom(Vector2 playerPos);
+void changeRoom(int dir, Vector2 playerPos);
+
+// subsystems
+#include "EntityPool.hpp"
+#include "AllocTracker.hpp"
+#include "SaveData.hpp"
+#include "Snapshot.hpp"
+#include "RoomCache.hpp"
+#include "ChunkWorld.hpp"
+#include "SpatialGrid.hpp"
+#include "SpawnPlacement.hpp"
+#include "CaveGenerator.hpp"
+#include "Behaviour.hpp"
+#include "Steering.hpp"
+#include "TimerWheel.hpp"
+#include "Tuning.hpp"
+#include "Controller.hpp"
+#include "Input.hpp"
+#include "Lockstep.hpp"
+#include "SpriteCache.hpp"
+#include "Compositor.hpp"
+#include "Particles.hpp"
+#include "FrameCapture.hpp"
+#include "Telemetry.hpp"
+#include "Logger.hpp"
+#include "Profiler.hpp"
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "CaveGenerator.hpp"
+
+CaveGrid caveScratch; // the other half of the smoothing double buffer
+CaveTimings lastCaveTimings;
+
+uint64_t caveRandom(uint64_t * state) // splitmix64
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// bits lo - hi-1 of a word
+uint64_t bitRange(int lo, int hi)
+{
+    uint64_t below = hi == 64 ? ~0ull : (1ull << hi) - 1;
+    return below & (~0ull << lo);
+}
+
+// the bits past width in the last word of a row
+uint64_t cavePadding(const CaveGrid& grid)
+{
+    int used = grid.width - (grid.words-1)*64;
+    return used == 64 ? 0 : ~0ull << used;
+}
+
+// calls func(word, mask) for each word of a row holding cells x0 - x1-1
+template <typename Func> void forRange(int x0, int x1, Func func)
+{
+    for (int w = x0 >> 6; w <= (x1-1) >> 6; w++) {
+        int lo = w == x0 >> 6 ? x0 & 63 : 0;
+        int hi = w == (x1-1) >> 6 ? ((x1-1) & 63) + 1 : 64;
+        func(w, bitRange(lo, hi));
+    }
+}
+
+void fillRange(uint64_t * row, int x0, int x1, bool set)
+{
+    if (x0 >= x1) return;
+    forRange(x0, x1, [&](int w, uint64_t mask) { row[w] = set ? row[w] | mask : row[w] & ~mask; });
+}
+
+bool rangeSet(const uint64_t * row, int x0, int x1)
+{
+    bool all = true;
+    forRange(x0, x1, [&](int w, uint64_t mask) { all = all && (row[w] & mask) == mask; });
+    return all;
+}
+
+// first cell in x - end-1 whose bit of (a | b) ^ flip is set, end if there isn't one
+int nextCell(const uint64_t * a, const uint64_t * b, uint64_t flip, int x, int end)
+{
+    while (x < end) {
+        int w = x >> 6;
+        uint64_t bits = ((a[w] | b[w]) ^ flip) & (~0ull << (x & 63));
+        if (bits) {
+            int found = w*64 + __builtin_ctzll(bits);
+            return found < end ? found : end;
+        }
+        x = (w+1) * 64;
+    }
+    return end;
+}
+
+// last set cell before x, -1 if there isn't one
+int prevSetCell(const uint64_t * row, int x)
+{
+    int w = x >> 6;
+    uint64_t bits = row[w] & ((1ull << (x & 63)) - 1);
+    while (!bits) {
+        if (--w < 0) return -1;
+        bits = row[w];
+    }
+    return w*64 + 63 - __builtin_clzll(bits);
+}
+
+// clipped to the grid
+void fillCaveBox(CaveGrid& grid, int x0, int y0, int x1, int y1, bool wall)
+{
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > grid.width) x1 = grid.width;
+    if (y1 > grid.height) y1 = grid.height;
+    for (int y = y0; y < y1; y++) fillRange(&grid.cells[y*grid.words], x0, x1, wall);
+}
+
+void fillCaveBorder(CaveGrid& grid)
+{
+    fillCaveBox(grid, 0, 0, grid.width, CAVE_BORDER, true);
+    fillCaveBox(grid, 0, grid.height-CAVE_BORDER, grid.width, grid.height, true);
+    fillCaveBox(grid, 0, 0, CAVE_BORDER, grid.height, true);
+    fillCaveBox(grid, grid.width-CAVE_BORDER, 0, grid.width, grid.height, true);
+}
+
+void fillCave(CaveGrid& grid, uint64_t * rng)
+{
+    uint64_t padding = cavePadding(grid);
+    for (int y = 0; y < grid.height; y++) {
+        uint64_t * row = &grid.cells[y*grid.words];
+        for (int w = 0; w < grid.words; w++) {
+            // 3/8 + 5/8 * 1/8 = 29/64 of the bits are set, about the usual 45%
+            uint64_t a = caveRandom(rng), b = caveRandom(rng), c = caveRandom(rng);
+            uint64_t d = caveRandom(rng), e = caveRandom(rng), f = caveRandom(rng);
+            row[w] = (a & (b | c)) | (d & e & f);
+        }
+        row[grid.words-1] |= padding;
+    }
+}
+
+// one step of the 4-5 rule from src into dst
+void smoothCave(const CaveGrid& src, CaveGrid& dst)
+{
+    const int words = src.words;
+    std::vector<uint64_t> solid(words, ~0ull); // the rows off the top and bottom
+    uint64_t padding = cavePadding(src);
+
+    for (int y = 0; y < src.height; y++) {
+        const uint64_t * up = y > 0 ? &src.cells[(y-1)*words] : solid.data();
+        const uint64_t * mid = &src.cells[y*words];
+        const uint64_t * down = y+1 < src.height ? &src.cells[(y+1)*words] : solid.data();
+        uint64_t * out = &dst.cells[y*words];
+
+        for (int w = 0; w < words; w++) {
+            // bit i's west neighbour is bit i-1, so west is the row shifted up a bit with the
+            // previous word's top bit coming in, and wall off the edges
+            const uint64_t edgeW = 1ull, edgeE = 1ull << 63;
+            uint64_t nw = (up[w] << 1)   | (w > 0 ? up[w-1] >> 63 : edgeW);
+            uint64_t ne = (up[w] >> 1)   | (w+1 < words ? up[w+1] << 63 : edgeE);
+            uint64_t we = (mid[w] << 1)  | (w > 0 ? mid[w-1] >> 63 : edgeW);
+            uint64_t ea = (mid[w] >> 1)  | (w+1 < words ? mid[w+1] << 63 : edgeE);
+            uint64_t sw = (down[w] << 1) | (w > 0 ? down[w-1] >> 63 : edgeW);
+            uint64_t se = (down[w] >> 1) | (w+1 < words ? down[w+1] << 63 : edgeE);
+            uint64_t n = up[w], s = down[w];
+
+            // add up the 8 neighbours of all 64 cells at once, countK is bit K of the count
+            uint64_t a0 = nw ^ n ^ ne, a1 = (nw & n) | (ne & (nw ^ n));
+            uint64_t b0 = sw ^ s ^ se, b1 = (sw & s) | (se & (sw ^ s));
+            uint64_t c0 = we ^ ea,     c1 = we & ea;
+            uint64_t count0 = a0 ^ b0 ^ c0, d1 = (a0 & b0) | (c0 & (a0 ^ b0));
+            uint64_t e1 = a1 ^ b1 ^ c1,     e2 = (a1 & b1) | (c1 & (a1 ^ b1));
+            uint64_t count1 = e1 ^ d1,      f2 = e1 & d1;
+            uint64_t count2 = e2 ^ f2,      count3 = e2 & f2;
+
+            uint64_t fiveOrMore = count3 | (count2 & (count1 | count0));
+            uint64_t four = count2 & ~(count1 | count0);
+            out[w] = fiveOrMore | (four & mid[w]);
+        }
+        out[words-1] |= padding;
+    }
+}
+
+// clears a path from (x, y) to (tx, ty), mostly straight at it but wandering
+void carveTunnel(CaveGrid& grid, int x, int y, int tx, int ty, uint64_t * rng)
+{
+    int lo = CAVE_BORDER+CAVE_TUNNEL_RADIUS;
+    int right = grid.width-1-lo, bottom = grid.height-1-lo;
+    for (;;) {
+        fillCaveBox(grid, x-CAVE_TUNNEL_RADIUS, y-CAVE_TUNNEL_RADIUS, x+CAVE_TUNNEL_RADIUS+1, y+CAVE_TUNNEL_RADIUS+1, false);
+        if (x == tx && y == ty) break;
+
+        // a third of the steps go sideways, the rest close the longer distance
+        uint64_t r = caveRandom(rng);
+        int dx = tx-x, dy = ty-y;
+        bool alongX = abs(dx) >= abs(dy);
+        int side = (r & 8) ? 1 : -1;
+        if (r % 3 == 0) {
+            if (alongX) y += side;
+            else x += side;
+        } else if (alongX) x += dx > 0 ? 1 : -1;
+        else y += dy > 0 ? 1 : -1;
+
+        if (x < lo) x = lo;
+        if (x > right) x = right;
+        if (y < lo) y = lo;
+        if (y > bottom) y = bottom;
+    }
+}
+
+// walls in whatever can't be reached from (sx, sy)
+void fillUnreachable(CaveGrid& grid, int sx, int sy)
+{
+    const int words = grid.words;
+    std::vector<uint64_t> reached(grid.cells.size(), 0);
+    std::vector<int> stack {sx, sy};
+
+    while (!stack.empty()) {
+        int y = stack.back(); stack.pop_back();
+        int x = stack.back(); stack.pop_back();
+        const uint64_t * row = &grid.cells[y*words];
+        uint64_t * seen = &reached[y*words];
+        if (nextCell(row, seen, 0, x, x+1) == x) continue; // wall, or its run is done already
+
+        // the open run through x
+        int x0 = prevSetCell(row, x)+1, x1 = nextCell(row, row, 0, x, grid.width);
+        fillRange(seen, x0, x1, true);
+
+        // one seed for each open run above and below that touches it
+        for (int ny = y-1; ny <= y+1; ny += 2) {
+            if (ny < 0 || ny >= grid.height) continue;
+            const uint64_t * nrow = &grid.cells[ny*words];
+            const uint64_t * nseen = &reached[ny*words];
+            for (int nx = nextCell(nrow, nseen, ~0ull, x0, x1); nx < x1; nx = nextCell(nrow, nseen, ~0ull, nx, x1)) {
+                stack.push_back(nx);
+                stack.push_back(ny);
+                nx = nextCell(nrow, nseen, 0, nx, x1);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < grid.cells.size(); i++) grid.cells[i] |= ~reached[i];
+}
+
+double msSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void generateCave(CaveGrid& grid, int width, int height, uint64_t seed, CaveSpan exitRows, CaveSpan exitCols)
+{
+    PROFILE_SCOPE("generateCave");
+    auto start = std::chrono::steady_clock::now();
+    grid.width = width; grid.height = height;
+    grid.words = (width+63) / 64;
+    grid.cells.resize(grid.words*height);
+    uint64_t rng = seed;
+
+    fillCave(grid, &rng);
+    fillCaveBorder(grid);
+    lastCaveTimings.fill = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    CaveGrid& next = caveScratch;
+    next.width = width; next.height = height; next.words = grid.words;
+    next.cells.resize(grid.cells.size());
+    for (int step = 0; step < CAVE_SMOOTH_STEPS; step++) {
+        smoothCave(grid, next);
+        grid.cells.swap(next.cells);
+        fillCaveBorder(grid);
+    }
+    lastCaveTimings.smooth = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    int cx = width/2, cy = height/2;
+    int midRow = (exitRows.first+exitRows.end) / 2, midCol = (exitCols.first+exitCols.end) / 2;
+    fillCaveBox(grid, 0, exitRows.first, CAVE_MOUTH_DEPTH, exitRows.end, false);
+    fillCaveBox(grid, width-CAVE_MOUTH_DEPTH, exitRows.first, width, exitRows.end, false);
+    fillCaveBox(grid, exitCols.first, 0, exitCols.end, CAVE_MOUTH_DEPTH, false);
+    fillCaveBox(grid, exitCols.first, height-CAVE_MOUTH_DEPTH, exitCols.end, height, false);
+    carveTunnel(grid, CAVE_MOUTH_DEPTH-1, midRow, cx, cy, &rng);
+    carveTunnel(grid, width-CAVE_MOUTH_DEPTH, midRow, cx, cy, &rng);
+    carveTunnel(grid, midCol, CAVE_MOUTH_DEPTH-1, cx, cy, &rng);
+    carveTunnel(grid, midCol, height-CAVE_MOUTH_DEPTH, cx, cy, &rng);
+    fillUnreachable(grid, cx, cy);
+    lastCaveTimings.connect = msSince(start);
+}
+
+void mergeCaveWalls(const CaveGrid& grid, std::vector<CaveRect>& rects)
+{
+    PROFILE_SCOPE("mergeCaveWalls");
+    auto start = std::chrono::steady_clock::now();
+    rects.clear();
+
+    // wall not in a rectangle yet
+    std::vector<uint64_t> left = grid.cells;
+    for (int y = 0; y < grid.height; y++) left[y*grid.words + grid.words-1] &= ~cavePadding(grid);
+
+    for (int y = 0; y < grid.height; y++) {
+        uint64_t * row = &left[y*grid.words];
+        for (int x = nextCell(row, row, 0, 0, grid.width); x < grid.width; x = nextCell(row, row, 0, x, grid.width)) {
+            int end = nextCell(row, row, ~0ull, x, grid.width);
+            int h = 1;
+            while (y+h < grid.height && rangeSet(&left[(y+h)*grid.words], x, end)) h++;
+            for (int r = y; r < y+h; r++) fillRange(&left[r*grid.words], x, end, false);
+            rects.push_back(CaveRect {x, y, end-x, h});
+            x = end;
+        }
+    }
+    lastCaveTimings.merge = msSince(start);
+}
+
+uint64_t caveWallCount(const CaveGrid& grid)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < grid.cells.size(); i++) count += __builtin_popcountll(grid.cells[i]);
+    return count - (uint64_t)grid.height * __builtin_popcountll(cavePadding(grid));
+}
+
+CaveTimings caveTimings()
+{
+    return lastCaveTimings;
+}
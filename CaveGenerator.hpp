@@ -0,0 +1,57 @@
+#ifndef CAVE_GENERATOR_HPP
+#define CAVE_GENERATOR_HPP
+
+/*
+    cellular automaton caves, the walls of every room
+
+    the cave is a grid of cells, one bit each (1 = wall), 64 cells to a word.
+    it starts as noise, 29/64 of it wall, and is smoothed CAVE_SMOOTH_STEPS
+    times with the 4-5 rule: a cell is wall if 5 or more of its 8 neighbours
+    are, or if it is wall and 4 are. the neighbour counts for a whole word
+    come out of a bit sliced adder over the 8 shifted neighbour words, so a
+    step is a few dozen word operations per 64 cells. cells off the grid
+    count as wall.
+
+    then the exits are cut: a straight mouth at the middle of each side, and
+    a wandering tunnel from each mouth to the middle of the cave. whatever
+    can't be reached from the middle (4 connected, a scanline flood fill over
+    runs of bits) is filled in, so every open cell leads to every exit.
+
+    walls go into the room as rectangles merged greedily: the longest run of
+    wall in a row, then down for as long as the rows below have all of it.
+    a 1920x1080 room comes out at 45-75 rectangles, where the old rooms had
+    8 border walls and up to 15 squares. handleCollisions finds a mover's
+    walls through the wall index (SpatialGrid.hpp), so it only ever tests
+    the few rectangles under the mover however many the room has.
+*/
+
+#include <chrono>
+
+#define CAVE_CELL_SIZE 40      // pixels per cell in a room, bigger than the player so 1 cell passages are walkable
+#define CAVE_SMOOTH_STEPS 4
+#define CAVE_BORDER 2          // cells of wall kept around the edge
+#define CAVE_EXIT_WIDTH 150    // pixels, the load zone gaps
+#define CAVE_MOUTH_DEPTH 5     // cells the exit mouths go straight in
+#define CAVE_TUNNEL_RADIUS 1   // cells cleared either side of a tunnel's path
+
+struct CaveGrid {
+    int width, height; // cells
+    int words;         // per row
+    std::vector<uint64_t> cells; // row major, bits past width are always set
+
+    bool wall(int x, int y) const { return (cells[y*words + (x >> 6)] >> (x & 63)) & 1; }
+};
+
+struct CaveSpan { int first, end; }; // cells [first, end)
+struct CaveRect { int x, y, w, h; };  // cells
+
+struct CaveTimings { double fill, smooth, connect, merge; }; // ms, of the last cave made on this thread
+
+// exitRows are open on the left and right edges, exitCols on the top and bottom
+void generateCave(CaveGrid& grid, int width, int height, uint64_t seed, CaveSpan exitRows, CaveSpan exitCols);
+void mergeCaveWalls(const CaveGrid& grid, std::vector<CaveRect>& rects);
+uint64_t caveWallCount(const CaveGrid& grid);
+
+CaveTimings caveTimings();
+
+#endif
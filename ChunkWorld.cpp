@@ -0,0 +1,300 @@
+#include "ChunkWorld.hpp"
+
+std::unordered_map<uint64_t, Chunk> chunks; // streamed in chunks, main thread only
+uint32 chunkSeed = 1;
+
+// dropped chunks, least recently dropped first
+std::list<StoredChunk> chunkStoreOrder;
+std::unordered_map<uint64_t, std::list<StoredChunk>::iterator> chunkStore;
+
+// streaming thread
+std::thread chunkThread;
+std::mutex chunkMutex;
+std::condition_variable chunkCV;
+std::deque<uint64_t> chunkRequests;    // guarded by chunkMutex
+std::vector<ChunkResult> chunkResults; // guarded by chunkMutex
+const Tuning * chunkTuning = nullptr;  // guarded by chunkMutex, the game's when it last asked for a chunk
+const Tuning * chunkTuningInUse = nullptr; // guarded by chunkMutex, what the chunk being made is using
+bool chunkThreadRunning = false;       // guarded by chunkMutex
+
+uint64_t chunkKey(int x, int y)
+{
+    return ((uint64_t)(uint32)x << 32) | (uint32)y;
+}
+
+void chunkCoords(float x, float y, int * cx, int * cy)
+{
+    *cx = (int)floorf(x / bkgWidth);
+    *cy = (int)floorf(y / bkgHeight);
+}
+
+int chunkDistance(int x0, int y0, int x1, int y1)
+{
+    return MAX(abs(x0-x1), abs(y0-y1));
+}
+
+// runs on the streaming thread, only reads constants, numbers and its own rng and spawn mask
+void generateChunk(int cx, int cy, uint32 seed, const Tuning * numbers, std::vector<SnapshotEntity>& entities)
+{
+    uint32 state = (seed ^ ((uint32)cx * 73856093u) ^ ((uint32)cy * 19349663u)) | 1;
+    SpawnMask mask;
+    float left = float(cx*bkgWidth), top = float(cy*bkgHeight);
+    beginSpawnArea(mask, left, top, &state);
+    int depth = chunkDistance(cx, cy, 0, 0);
+
+    // keep the start position clear
+    if (cx == 0 && cy == 0) blockSpawnArea(mask, 130.0f, bkgHeight/2-20.0f, 70.0f, 70.0f);
+
+    // walls, 0 - 15 squares of 50 - 200 pixels that don't overlap
+    int n = spawnRandomInt(mask) % 16;
+    for (int i = 0; i < n; i++) {
+        int size = int(100.0f * float(1 + (spawnRandomInt(mask) % 4))/2.0f);
+        float x = left + SPAWN_EDGE_MARGIN + float(spawnRandomInt(mask) % (bkgWidth-2*SPAWN_EDGE_MARGIN-size));
+        float y = top + SPAWN_EDGE_MARGIN + float(spawnRandomInt(mask) % (bkgHeight-2*SPAWN_EDGE_MARGIN-size));
+        if (!spawnAreaFree(mask, x, y, (float)size, (float)size)) continue;
+        blockSpawnArea(mask, x, y, (float)size, (float)size);
+        entities.push_back(SnapshotEntity {x, y, 0.0f, 0.0f, 0.0f, 100, (int16_t)size, (int16_t)size, WALL, 1, 0});
+    }
+
+    // items, more of them further from the start
+    n = depth + (spawnRandomInt(mask) % (6+depth));
+    std::vector<Vector2> positions;
+    float itemSize = (float)largestItemSize();
+    placeSpawns(mask, n, itemSize, itemSize, SPAWN_ITEM_SPACING, positions);
+    for (size_t i = 0; i < positions.size(); i++) {
+        int type = BATTERY + (spawnRandomInt(mask) % (AMMO-BATTERY+1));
+        const EntityInfo& info = entityInfo(type);
+        entities.push_back(SnapshotEntity {positions[i].x, positions[i].y, 0.0f, 0.0f, 0.0f, 1,
+            (int16_t)info.width, (int16_t)info.height, (uint8)type, 1, 0});
+    }
+
+    // enemies, none in the starting chunk
+    if (depth == 0) return;
+    placeSpawns(mask, (int)numEnemies, 30.0f, 30.0f, SPAWN_ENEMY_SPACING, positions);
+    for (size_t i = 0; i < positions.size(); i++) {
+        entities.push_back(SnapshotEntity {positions[i].x, positions[i].y, 0.0f, 0.0f, numbers->enemySpeed,
+            (int16_t)numbers->enemyHealth, 30, 30, ENEMY, 1, 0});
+    }
+}
+
+void chunkThreadLoop()
+{
+    ALLOC_SCOPE(ALLOC_ROOM);
+    std::unique_lock<std::mutex> lock(chunkMutex);
+    while (true) {
+        chunkCV.wait(lock, []() { return !chunkRequests.empty() || !chunkThreadRunning; });
+        if (!chunkThreadRunning) return;
+
+        uint64_t key = chunkRequests.front();
+        chunkRequests.pop_front();
+        uint32 seed = chunkSeed;
+        const Tuning * numbers = chunkTuningInUse = chunkTuning;
+        lock.unlock();
+
+        ChunkResult result = {key, {}};
+        generateChunk((int)(key >> 32), (int)(uint32)key, seed, numbers, result.entities);
+
+        lock.lock();
+        chunkTuningInUse = nullptr;
+        chunkResults.push_back(std::move(result));
+    }
+}
+
+// streams a chunk in from the store, or asks the streaming thread for it
+void requestChunk(int cx, int cy)
+{
+    uint64_t key = chunkKey(cx, cy);
+    Chunk& chunk = chunks[key];
+    chunk.x = cx; chunk.y = cy;
+
+    auto stored = chunkStore.find(key);
+    if (stored != chunkStore.end()) {
+        chunk.state = CHUNK_RESIDENT;
+        std::vector<SnapshotEntity>& entities = stored->second->entities;
+        for (size_t i = 0; i < entities.size(); i++) chunk.objects.push_back(unpackEntity(entities[i]));
+        chunkStoreOrder.erase(stored->second);
+        chunkStore.erase(stored);
+        return;
+    }
+
+    chunk.state = CHUNK_PENDING;
+    {
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        chunkRequests.push_back(key);
+        chunkTuning = tuning;
+    }
+    chunkCV.notify_one();
+}
+
+// packs a resident chunk into the store and forgets it
+void dropChunk(Chunk& chunk)
+{
+    if (chunk.state == CHUNK_RESIDENT) {
+        // a chunk is only stored while it isn't loaded, so its key can't be in the store already
+        StoredChunk stored = {chunkKey(chunk.x, chunk.y), {}};
+        for (size_t i = 0; i < chunk.objects.size(); i++) stored.entities.push_back(packEntity(chunk.objects[i]));
+        chunkStoreOrder.push_back(std::move(stored));
+        chunkStore[chunkStoreOrder.back().key] = std::prev(chunkStoreOrder.end());
+    }
+    // a chunk still pending has never been seen, what was parked in it goes with it
+    for (size_t i = 0; i < chunk.objects.size(); i++) delete chunk.objects[i];
+    chunk.objects.clear();
+
+    // the least recently dropped chunks go, they'll be regenerated if the player comes back
+    while (chunkStore.size() > CHUNK_STORE_MAX) {
+        chunkStore.erase(chunkStoreOrder.front().key);
+        chunkStoreOrder.pop_front();
+    }
+}
+
+uint32 chunkTuningVersion()
+{
+    std::lock_guard<std::mutex> lock(chunkMutex);
+    uint32 version = chunkTuning ? chunkTuning->version : UINT32_MAX;
+    if (chunkTuningInUse && chunkTuningInUse->version < version) version = chunkTuningInUse->version;
+    return version;
+}
+
+void activateChunk(Chunk& chunk)
+{
+    for (size_t i = 0; i < chunk.objects.size(); i++) {
+        if (chunk.objects[i]->entityType == ENEMY) startBehaviour(chunk.objects[i]);
+    }
+    gameObjects.insert(gameObjects.end(), chunk.objects.begin(), chunk.objects.end());
+    chunk.objects.clear();
+    chunk.state = CHUNK_ACTIVE;
+}
+
+void clearChunks()
+{
+    for (auto& entry : chunks) {
+        for (size_t i = 0; i < entry.second.objects.size(); i++) delete entry.second.objects[i];
+    }
+    chunks.clear();
+    chunkStore.clear();
+    chunkStoreOrder.clear();
+
+    std::lock_guard<std::mutex> lock(chunkMutex);
+    chunkRequests.clear();
+    chunkResults.clear();
+}
+
+void startChunkWorld(uint32 seed)
+{
+    stopChunkWorld();
+    clearChunks();
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    chunkSeed = seed;
+
+    spawnPlayer(Vector2 {150.0f, (float)bkgHeight/2.0f});
+
+    // the chunks the player can see are made straight away, the rest stream in
+    for (int y = -CHUNK_ACTIVE_RADIUS; y <= CHUNK_ACTIVE_RADIUS; y++) {
+        for (int x = -CHUNK_ACTIVE_RADIUS; x <= CHUNK_ACTIVE_RADIUS; x++) {
+            std::vector<SnapshotEntity> entities;
+            generateChunk(x, y, chunkSeed, tuning, entities);
+            Chunk& chunk = chunks[chunkKey(x, y)];
+            chunk.x = x; chunk.y = y;
+            for (size_t i = 0; i < entities.size(); i++) chunk.objects.push_back(unpackEntity(entities[i]));
+            activateChunk(chunk);
+        }
+    }
+
+    chunkThreadRunning = true;
+    chunkThread = std::thread(chunkThreadLoop);
+}
+
+void stopChunkWorld()
+{
+    {
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        chunkThreadRunning = false;
+    }
+    chunkCV.notify_one();
+    if (chunkThread.joinable()) chunkThread.join();
+}
+
+void updateChunks()
+{
+    ALLOC_SCOPE(ALLOC_ROOM);
+    PROFILE_SCOPE("updateChunks");
+    int px, py;
+    chunkCoords(player->pos.x+player->size[0]/2, player->pos.y+player->size[1]/2, &px, &py);
+
+    // the way out is west of the starting chunk
+    if (px == -1 && py == 0) {
+        while (!roomQueue.empty()) roomQueue.pop();
+        return;
+    }
+
+    // finished chunks from the streaming thread
+    std::vector<ChunkResult> results;
+    {
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        results.swap(chunkResults);
+    }
+    for (ChunkResult& result : results) {
+        auto chunk = chunks.find(result.key);
+        if (chunk == chunks.end() || chunk->second.state != CHUNK_PENDING) continue; // dropped while generating
+        for (size_t i = 0; i < result.entities.size(); i++) chunk->second.objects.push_back(unpackEntity(result.entities[i]));
+        chunk->second.state = CHUNK_RESIDENT;
+    }
+
+    // activate/deactivate, one chunk of slack before a chunk stops being simulated
+    for (auto& entry : chunks) {
+        Chunk& chunk = entry.second;
+        int d = chunkDistance(chunk.x, chunk.y, px, py);
+        if (chunk.state == CHUNK_RESIDENT && d <= CHUNK_ACTIVE_RADIUS) activateChunk(chunk);
+        else if (chunk.state == CHUNK_ACTIVE && d > CHUNK_ACTIVE_RADIUS+1) chunk.state = CHUNK_RESIDENT;
+    }
+
+    // objects outside active chunks are parked in their chunk, bullets that leave are gone
+    size_t kept = 0;
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        GameObject * obj = gameObjects[i];
+        if (obj != player) {
+            int cx, cy;
+            chunkCoords(obj->pos.x, obj->pos.y, &cx, &cy);
+            auto chunk = chunks.find(chunkKey(cx, cy));
+            if (chunk == chunks.end() || chunk->second.state != CHUNK_ACTIVE) {
+                if (obj->entityType == PLAYER_BULLET) {
+                    delete obj;
+                    continue;
+                }
+                // a chunk that isn't loaded yet holds it while it streams in
+                if (chunk == chunks.end()) {
+                    requestChunk(cx, cy);
+                    chunk = chunks.find(chunkKey(cx, cy));
+                }
+                stopBehaviour(obj); // its step stays in the record
+                chunk->second.objects.push_back(obj);
+                continue;
+            }
+        }
+        gameObjects[kept++] = obj;
+    }
+    gameObjects.resize(kept);
+
+    // drop far chunks, one chunk of slack past the streaming radius
+    for (auto entry = chunks.begin(); entry != chunks.end();) {
+        if (chunkDistance(entry->second.x, entry->second.y, px, py) > CHUNK_RESIDENT_RADIUS+1) {
+            dropChunk(entry->second);
+            entry = chunks.erase(entry);
+        } else entry++;
+    }
+
+    // stream in everything near the player
+    for (int y = py-CHUNK_RESIDENT_RADIUS; y <= py+CHUNK_RESIDENT_RADIUS; y++) {
+        for (int x = px-CHUNK_RESIDENT_RADIUS; x <= px+CHUNK_RESIDENT_RADIUS; x++) {
+            if (!chunks.count(chunkKey(x, y))) requestChunk(x, y);
+        }
+    }
+}
+
+int chunkDistanceFromStart()
+{
+    int px, py;
+    chunkCoords(player->pos.x, player->pos.y, &px, &py);
+    return chunkDistance(px, py, 0, 0);
+}
@@ -0,0 +1,66 @@
+#ifndef CHUNK_WORLD_HPP
+#define CHUNK_WORLD_HPP
+
+/*
+    large cave mode (run with -largecave)
+
+    instead of rooms joined by load zones the cave is an endless grid of
+    chunks the size of the background image. each chunk's walls, items and
+    enemies are generated from its coordinates on a background thread as the
+    player approaches, placed with SpawnPlacement so nothing spawns inside a
+    wall or another object.
+
+    chunks around the player, by chebyshev distance in chunks:
+        <= CHUNK_ACTIVE_RADIUS      objects are in gameObjects and simulated
+        <= CHUNK_RESIDENT_RADIUS    streamed in, objects kept aside and frozen
+        >  CHUNK_RESIDENT_RADIUS+1  dropped, packed into the chunk store
+    a chunk only changes state once it is a chunk past the radius that brought
+    it in, so walking along a chunk edge doesn't thrash. an enemy that walks
+    out of the active chunks is parked in the chunk it walked into, which is
+    requested if it isn't loaded yet, and comes back when that chunk does.
+
+    the chunk store keeps the CHUNK_STORE_MAX most recently dropped chunks as
+    SnapshotEntity records, older ones are regenerated from scratch. memory and
+    tick cost depend on those constants, not on how far the cave goes.
+
+    the exit is west of the starting chunk.
+*/
+
+#include <deque>
+#include <list>
+
+#define CHUNK_ACTIVE_RADIUS 1
+#define CHUNK_RESIDENT_RADIUS 2
+#define CHUNK_STORE_MAX 256
+
+enum ChunkState { CHUNK_PENDING, CHUNK_RESIDENT, CHUNK_ACTIVE };
+
+struct Chunk {
+    int x, y; // chunk coordinates
+    ChunkState state;
+    std::vector<GameObject*> objects; // while resident or parked in it while pending, the world owns them while active
+};
+
+struct StoredChunk {
+    uint64_t key;
+    std::vector<SnapshotEntity> entities;
+};
+
+struct ChunkResult {
+    uint64_t key;
+    std::vector<SnapshotEntity> entities;
+};
+
+uint64_t chunkKey(int x, int y);
+void chunkCoords(float x, float y, int * cx, int * cy); // chunk containing a world position
+
+struct Tuning;
+void generateChunk(int cx, int cy, uint32 seed, const Tuning * numbers, std::vector<SnapshotEntity>& entities);
+
+void startChunkWorld(uint32 seed); // clears the world, loads the chunks around the start position
+void stopChunkWorld();
+void updateChunks(); // once per tick, streams chunks around the player
+int chunkDistanceFromStart(); // how deep the player is, in chunks
+uint32 chunkTuningVersion();  // the oldest Tuning the streaming thread can still read, UINT32_MAX for none
+
+#endif
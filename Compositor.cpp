@@ -0,0 +1,244 @@
+#include "Compositor.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COMPOSITOR_SSE2
+#endif
+
+// per frame, written by the painting thread before the tiles start
+std::vector<SpriteDraw> spriteDraws;
+std::vector<std::vector<int>> tileBins; // indexes into spriteDraws per tile
+std::vector<LightSpan> lightSpans;      // one per row
+const SpriteSurface * backgroundSurface = nullptr;
+Vector2 frameCamera;
+int tileColumns = 0, tileRows = 0;
+uint32 flashlightScale = 255, ambientScale = 255; // 0 - 255 brightness inside/outside the flashlight
+
+// pool
+std::vector<std::thread> compositorThreads;
+std::mutex compositorMutex;
+std::condition_variable compositorWake, compositorDone;
+uint32 compositorFrame = 0;       // guarded by compositorMutex
+bool compositorRunning = false;   // guarded by compositorMutex
+std::atomic<int> nextTile {0}, tilesDone {0};
+
+// multiplies every channel of count pixels by scale/255
+void scaleRow(uint32 * row, int count, uint32 scale)
+{
+    if (scale >= 255) return;
+    int i = 0;
+#ifdef COMPOSITOR_SSE2
+    const __m128i zero = _mm_setzero_si128(), factor = _mm_set1_epi16((short)scale), round = _mm_set1_epi16(128);
+    for (; i+4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(row+i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), factor), round);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), factor), round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(row+i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        uint32 rb = (row[i] & 0x00ff00ff) * scale + 0x00800080;
+        uint32 ag = ((row[i] >> 8) & 0x00ff00ff) * scale + 0x00800080;
+        rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+        ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+        row[i] = rb | ag;
+    }
+}
+
+// the background pixels behind one row of a tile
+void copyBackgroundRow(int y, int x0, int x1)
+{
+    uint32 * dst = frameBuffer.pixels + (size_t)y*frameBuffer.stride;
+    if (!backgroundSurface) {
+        memset(dst+x0, 0, (x1-x0)*4);
+        return;
+    }
+    const SpriteSurface& bkg = *backgroundSurface;
+
+    // the large cave repeats the background in every direction
+    if (largeCaveMode) {
+        int by = (((int)frameCamera.y + y) % bkg.height + bkg.height) % bkg.height;
+        const uint32 * src = bkg.pixels + (size_t)by*bkg.stride;
+        int bx = (((int)frameCamera.x + x0) % bkg.width + bkg.width) % bkg.width;
+        for (int x = x0; x < x1;) {
+            int run = MIN(x1-x, bkg.width-bx);
+            memcpy(dst+x, src+bx, run*4);
+            x += run; bx = 0;
+        }
+        return;
+    }
+
+    // a room smaller than the window is centred with black around it, like drawBackgroundSection
+    int offsetX = bkgWidth < wndWidth ? (wndWidth-bkgWidth)/2 : 0;
+    int offsetY = bkgHeight < wndHeight ? (wndHeight-bkgHeight)/2 : 0;
+    int by = y - offsetY + (int)frameCamera.y;
+    if (by < 0 || by >= bkg.height) {
+        memset(dst+x0, 0, (x1-x0)*4);
+        return;
+    }
+    int shift = (int)frameCamera.x - offsetX; // background x = screen x + shift
+    int s0 = MAX(x0, -shift), s1 = MIN(x1, bkg.width-shift);
+    if (s0 >= s1) { memset(dst+x0, 0, (x1-x0)*4); return; }
+    if (s0 > x0) memset(dst+x0, 0, (s0-x0)*4);
+    memcpy(dst+s0, bkg.pixels + (size_t)by*bkg.stride + s0+shift, (s1-s0)*4);
+    if (x1 > s1) memset(dst+s1, 0, (x1-s1)*4);
+}
+
+void composeTile(int tile)
+{
+    int x0 = (tile % tileColumns) * TILE_SIZE, y0 = (tile / tileColumns) * TILE_SIZE;
+    int x1 = MIN(x0+TILE_SIZE, frameBuffer.width), y1 = MIN(y0+TILE_SIZE, frameBuffer.height);
+
+    for (int y = y0; y < y1; y++) copyBackgroundRow(y, x0, x1);
+
+    const std::vector<int>& bin = tileBins[tile];
+    for (size_t i = 0; i < bin.size(); i++) {
+        const SpriteDraw& draw = spriteDraws[bin[i]];
+        blitSpriteClipped(*draw.sprite, draw.x, draw.y, x0, y0, x1, y1);
+    }
+
+    // darkness, the flashlight span of each row gets its own brightness
+    for (int y = y0; y < y1; y++) {
+        uint32 * row = frameBuffer.pixels + (size_t)y*frameBuffer.stride;
+        int s0 = MAX(lightSpans[y].start, x0), s1 = MIN(lightSpans[y].end, x1);
+        if (s0 >= s1) { scaleRow(row+x0, x1-x0, ambientScale); continue; }
+        scaleRow(row+x0, s0-x0, ambientScale);
+        scaleRow(row+s0, s1-s0, flashlightScale);
+        scaleRow(row+s1, x1-s1, ambientScale);
+    }
+
+    // particles glow, so they go on after the darkness
+    drawParticles(tile, x0, y0, x1, y1);
+}
+
+// takes tiles until there are none left
+void composeTiles()
+{
+    int count = tileColumns*tileRows;
+    for (int tile = nextTile++; tile < count; tile = nextTile++) {
+        composeTile(tile);
+        if (++tilesDone == count) {
+            std::lock_guard<std::mutex> lock(compositorMutex);
+            compositorDone.notify_one();
+        }
+    }
+}
+
+void compositorLoop()
+{
+    ALLOC_SCOPE(ALLOC_RENDER);
+    uint32 seen = 0;
+    std::unique_lock<std::mutex> lock(compositorMutex);
+    while (true) {
+        compositorWake.wait(lock, [&seen]() { return compositorFrame != seen || !compositorRunning; });
+        if (!compositorRunning) return;
+        seen = compositorFrame;
+        lock.unlock();
+        composeTiles();
+        lock.lock();
+    }
+}
+
+void startCompositor()
+{
+    stopCompositor();
+    compositorRunning = true;
+    int workers = (int)std::thread::hardware_concurrency() - 1;
+    for (int i = 0; i < workers; i++) compositorThreads.emplace_back(compositorLoop);
+}
+
+void stopCompositor()
+{
+    {
+        std::lock_guard<std::mutex> lock(compositorMutex);
+        compositorRunning = false;
+    }
+    compositorWake.notify_all();
+    for (std::thread& thread : compositorThreads) thread.join();
+    compositorThreads.clear();
+}
+
+// lit span of each row inside the flashlight triangle
+void buildLightSpans(const Gdiplus::Point * vertices)
+{
+    for (int y = 0; y < frameBuffer.height; y++) {
+        float yc = y + 0.5f, left = 1e9f, right = -1e9f;
+        for (int e = 0; e < 3; e++) {
+            const Gdiplus::Point& a = vertices[e];
+            const Gdiplus::Point& b = vertices[(e+1) % 3];
+            if ((yc < a.Y) == (yc < b.Y)) continue; // edge doesn't cross this row
+            float x = a.X + (yc - a.Y) * (b.X - a.X) / float(b.Y - a.Y);
+            left = MIN(left, x); right = MAX(right, x);
+        }
+        LightSpan& span = lightSpans[y];
+        span.start = span.end = 0;
+        if (left > right) continue;
+        span.start = MAX((int)ceilf(left-0.5f), 0);
+        span.end = MIN((int)ceilf(right-0.5f), frameBuffer.width);
+        if (span.end < span.start) span.end = span.start;
+    }
+}
+
+void composeFrame()
+{
+    PROFILE_SCOPE("composeFrame");
+    tileColumns = (frameBuffer.width + TILE_SIZE-1) / TILE_SIZE;
+    tileRows = (frameBuffer.height + TILE_SIZE-1) / TILE_SIZE;
+    int count = tileColumns*tileRows;
+    tileBins.resize(count);
+    for (int t = 0; t < count; t++) tileBins[t].clear();
+
+    frameCamera = cameraOffset();
+    backgroundSurface = spriteSurface(background, bkgWidth, bkgHeight);
+
+    // bin sprites, surfaces are looked up here since the cache isn't thread safe. none is freed
+    // until the next frame's trimSpriteCache, so the pointers last until the tiles are done
+    spriteDraws.clear();
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        GameObject * obj = gameObjects[i];
+        int x = int(obj->pos.x-frameCamera.x), y = int(obj->pos.y-frameCamera.y);
+        if (x >= frameBuffer.width || y >= frameBuffer.height || x+obj->size[0] <= 0 || y+obj->size[1] <= 0) continue;
+        const SpriteSurface * sprite = spriteSurface(obj->image(), obj->size[0], obj->size[1]);
+        if (!sprite) continue;
+
+        int index = (int)spriteDraws.size();
+        spriteDraws.push_back(SpriteDraw {sprite, x, y});
+        int tx0 = (MAX(x, 0)) / TILE_SIZE, ty0 = (MAX(y, 0)) / TILE_SIZE;
+        int tx1 = (MIN(x+sprite->width-1, frameBuffer.width-1)) / TILE_SIZE;
+        int ty1 = (MIN(y+sprite->height-1, frameBuffer.height-1)) / TILE_SIZE;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) tileBins[ty*tileColumns + tx].push_back(index);
+        }
+    }
+
+    // same triangle and alphas as illuminateFlashLight
+    lightSpans.resize(frameBuffer.height);
+    ambientScale = 255 - int(255.0f*(1.0f-ambientLightPercent));
+    flashlightScale = ambientScale;
+    if (flashLightCharge > 0.0f && flashlightOn) {
+        Gdiplus::Point vertices[3];
+        flashlightTriangle(vertices);
+        buildLightSpans(vertices);
+        flashlightScale = 255 - int(255.0f*(1.0f-flashlightBrightness));
+    } else {
+        for (int y = 0; y < frameBuffer.height; y++) lightSpans[y] = LightSpan {0, 0};
+    }
+
+    updateParticles();
+    binParticles(frameCamera, tileColumns, tileRows);
+
+    // go
+    {
+        std::lock_guard<std::mutex> lock(compositorMutex);
+        nextTile = 0;
+        tilesDone = 0;
+        compositorFrame++;
+    }
+    compositorWake.notify_all();
+    composeTiles();
+
+    std::unique_lock<std::mutex> lock(compositorMutex);
+    compositorDone.wait(lock, [count]() { return tilesDone.load() >= count; });
+}
@@ -0,0 +1,41 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+/*
+    tiled, multithreaded frame composition
+
+    the frame buffer is split into TILE_SIZE squares. each frame the visible
+    sprites are binned into the tiles they touch and the flashlight triangle
+    is turned into one lit span per row, then the tiles are composited in
+    parallel on a small thread pool (the painting thread helps too):
+        background copy -> sprite blits (in gameObjects order) -> light mask -> particles
+    a tile only writes its own pixels, so nothing is shared while drawing.
+
+    GDI+ still draws the HUD, pause menu and overlay on top afterwards, and
+    does everything if there is no DIB section to write to.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define TILE_SIZE 64
+
+struct SpriteDraw {
+    const SpriteSurface * sprite;
+    int x, y; // screen position of the top left
+};
+
+struct LightSpan {
+    int start, end; // lit pixels of a row, start == end when none
+};
+
+void startCompositor(); // one worker per extra core
+void stopCompositor();
+
+// background, sprites and lighting into frameBuffer
+void composeFrame();
+
+#endif
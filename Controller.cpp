@@ -0,0 +1,154 @@
+#include "Controller.hpp"
+
+ControllerPolicy controllerPolicy = nullptr;
+int autoplayDepth = 3;
+
+// autoplay bookkeeping
+struct AutoplayState {
+    int exploreDir;     // load zone taken while going deeper
+    int depth;          // depth the last tick
+    bool leaving;       // heading for the exit, for the rest of the run
+    Vector2 lastPos;
+    int stuckTicks, dodgeTicks;
+    uint8 dodgeKeys;
+    float shootCooldown;
+    uint32 rng;         // xorshift, apart from the game's
+};
+
+AutoplayState autoplay = {0, -1, false};
+
+void setController(ControllerPolicy policy, uint32 seed)
+{
+    controllerPolicy = policy;
+    movementKeys = 0;
+    autoplay = AutoplayState {0, -1, false};
+    autoplay.rng = seed ? seed : 1; // xorshift gets stuck on 0
+}
+
+int autoplayRandomInt(AutoplayState& bot)
+{
+    bot.rng ^= bot.rng << 13;
+    bot.rng ^= bot.rng >> 17;
+    bot.rng ^= bot.rng << 5;
+    return int(bot.rng >> 1);
+}
+
+void runController()
+{
+    if (!controllerPolicy || gameIsPaused || roomQueue.empty()) return;
+
+    ControllerView view;
+    view.player = player;
+    view.health = player->health;
+    view.bullets = numBullets; view.gems = numGems;
+    view.charge = flashLightCharge;
+    view.flashlightOn = flashlightOn;
+    view.depth = (int)roomQueue.size()-1;
+    view.exitDirection = roomQueue.top();
+
+    ControllerInput input;
+    controllerPolicy(view, &input);
+
+    // same effects as the keys and clicks in WndProc
+    movementKeys = input.movementKeys & 0b1111;
+    if (input.aim.x != 0.0f || input.aim.y != 0.0f) {
+        playerToMouse = input.aim;
+        playerToMouse.normalise();
+    }
+    if (input.fire) fireBullet(playerToMouse);
+    if (input.toggleFlashlight) flashlightOn = !flashlightOn;
+}
+
+const GameObject * nearestOfType(bool (*match)(int type), float maxDistance)
+{
+    const GameObject * best = nullptr;
+    float bestDist2 = maxDistance*maxDistance;
+    float px = player->pos.x+player->size[0]/2, py = player->pos.y+player->size[1]/2;
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        const GameObject * obj = gameObjects[i];
+        if (!match(obj->entityType)) continue;
+        float dx = obj->pos.x+obj->size[0]/2-px, dy = obj->pos.y+obj->size[1]/2-py;
+        if (dx*dx + dy*dy < bestDist2) { best = obj; bestDist2 = dx*dx + dy*dy; }
+    }
+    return best;
+}
+
+const GameObject * nearestEnemy(float maxDistance)
+{
+    return nearestOfType([](int type) { return type == ENEMY; }, maxDistance);
+}
+
+const GameObject * nearestItem(float maxDistance)
+{
+    return nearestOfType(isItem, maxDistance);
+}
+
+// autoplay
+
+// player position (top left) to stand on to walk through the load zone on side dir
+Vector2 loadZoneTarget(int dir, bool outside)
+{
+    float inset = outside ? -100.0f : 130.0f;
+    float midX = bkgWidth/2.0f - player->size[0]/2.0f, midY = bkgHeight/2.0f - player->size[1]/2.0f;
+    switch (dir) {
+        case LEFT:  return Vector2 {inset, midY};
+        case RIGHT: return Vector2 {bkgWidth-player->size[0]-inset, midY};
+        case UP:    return Vector2 {midX, inset};
+        default:    return Vector2 {midX, bkgHeight-player->size[1]-inset};
+    }
+}
+
+// heads through random load zones until autoplayDepth rooms in (or hurt), then
+// follows roomQueue out, grabbing nearby items and shooting whatever chases
+void autoplayPolicy(const ControllerView& view, ControllerInput * input)
+{
+    AutoplayState& bot = autoplay;
+    if (view.depth != bot.depth) { // walked into another room
+        bot.depth = view.depth;
+        do bot.exploreDir = 1 + autoplayRandomInt(bot) % 4; while (bot.exploreDir == view.exitDirection);
+        bot.stuckTicks = bot.dodgeTicks = 0;
+        bot.lastPos = view.player->pos;
+    }
+
+    // once deep enough or hurt, go back out (and don't turn round on the way)
+    if (view.depth >= autoplayDepth || view.health <= 3) bot.leaving = true;
+    int dir = bot.leaving ? view.exitDirection : bot.exploreDir;
+
+    Vector2 pos = view.player->pos;
+    Vector2 target = loadZoneTarget(dir, false);
+    bool lined = (dir == LEFT || dir == RIGHT) ? fabsf(pos.y-target.y) < 10.0f : fabsf(pos.x-target.x) < 10.0f;
+    if (lined) target = loadZoneTarget(dir, true);
+    else if (const GameObject * item = nearestItem(250.0f)) target = item->pos;
+
+    // walk straight at the target, sidestep randomly when a wall is in the way
+    if (bot.dodgeTicks > 0) {
+        bot.dodgeTicks--;
+        input->movementKeys = bot.dodgeKeys;
+    } else {
+        float dx = target.x-pos.x, dy = target.y-pos.y;
+        if (dx > 4.0f) input->movementKeys |= 1;
+        if (dx < -4.0f) input->movementKeys |= 4;
+        if (dy > 4.0f) input->movementKeys |= 2;
+        if (dy < -4.0f) input->movementKeys |= 8;
+
+        float moved = fabsf(pos.x-bot.lastPos.x) + fabsf(pos.y-bot.lastPos.y);
+        bot.stuckTicks = moved < 0.5f ? bot.stuckTicks+1 : 0;
+        if (bot.stuckTicks > 20) {
+            bot.dodgeKeys = uint8(1 << (autoplayRandomInt(bot) % 4));
+            bot.dodgeTicks = 40;
+            bot.stuckTicks = 0;
+        }
+    }
+    bot.lastPos = pos;
+
+    bot.shootCooldown -= deltaTime;
+    const GameObject * enemy = nearestEnemy(500.0f);
+    if (enemy && bot.shootCooldown <= 0.0f && view.bullets > 0) {
+        input->aim = Vector2 {enemy->pos.x+enemy->size[0]/2 - (pos.x+view.player->size[0]/2),
+                              enemy->pos.y+enemy->size[1]/2 - (pos.y+view.player->size[1]/2)};
+        input->fire = true;
+        bot.shootCooldown = 0.25f;
+    }
+
+    input->toggleFlashlight = view.flashlightOn != (view.charge > 0.0f);
+}
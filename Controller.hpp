@@ -0,0 +1,50 @@
+#ifndef CONTROLLER_HPP
+#define CONTROLLER_HPP
+
+/*
+    programmatic input, in place of the keyboard and mouse handling in WndProc
+
+    a policy is called once per tick, before the game rules run, with a read
+    only view of the world. it fills in a ControllerInput, which is applied the
+    same way keys and clicks are. while a policy is set the window ignores
+    gameplay keys and clicks (the pause menu still works).
+
+    -autoplay runs the game with autoplayPolicy, the balance runner and soak
+    test use it headless. the bot's random choices come from its own state,
+    seeded by setController, so playing never moves the game's randomInt()
+    and the cave a seed makes doesn't depend on what the bot did.
+*/
+
+struct ControllerInput {
+    uint8 movementKeys = 0;         // 0000wasd, like the keyboard
+    Vector2 aim = {0.0f, 0.0f};     // world space direction to face, zero keeps the last one
+    bool fire = false;              // shoot once along aim
+    bool toggleFlashlight = false;
+};
+
+// what a policy gets to look at
+struct ControllerView {
+    const GameObject * player;
+    int health;
+    uint32 bullets, gems;
+    float charge;        // flashlight charge left
+    bool flashlightOn;
+    int depth;           // rooms away from the first one
+    int exitDirection;   // load zone that leads back towards the exit (roomQueue.top()), 0 when out
+};
+
+typedef void (*ControllerPolicy)(const ControllerView& view, ControllerInput * input);
+
+extern ControllerPolicy controllerPolicy; // null when a person is playing
+extern int autoplayDepth; // rooms autoplay goes in before heading back
+
+void setController(ControllerPolicy policy, uint32 seed);
+void runController(); // asks the policy for this tick's input and applies it
+
+// world queries for policies, null when nothing is in range
+const GameObject * nearestEnemy(float maxDistance);
+const GameObject * nearestItem(float maxDistance);
+
+void autoplayPolicy(const ControllerView& view, ControllerInput * input);
+
+#endif
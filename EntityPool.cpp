@@ -0,0 +1,59 @@
+#include "EntityPool.hpp"
+
+static_assert(sizeof(GameObject) == ENTITY_RECORD_SIZE, "a GameObject should be one record");
+static_assert(ENTITY_LINE_SIZE % alignof(GameObject) == 0, "a GameObject shouldn't straddle cache lines");
+
+struct EntitySlot {
+    EntitySlot * next;
+};
+
+std::vector<void*> entityBlocks;
+EntitySlot * entityFreeList = nullptr;
+size_t liveEntities = 0;
+
+// a new block, its records linked in address order so objects made one after another are neighbours
+EntitySlot * refillEntities()
+{
+    char * block = static_cast<char*>(::operator new(ENTITY_BLOCK_RECORDS*ENTITY_RECORD_SIZE, std::align_val_t(ENTITY_LINE_SIZE)));
+    entityBlocks.push_back(block);
+    EntitySlot * head = nullptr;
+    for (int i = ENTITY_BLOCK_RECORDS-1; i >= 0; i--) {
+        EntitySlot * slot = reinterpret_cast<EntitySlot*>(block + (size_t)i*ENTITY_RECORD_SIZE);
+        slot->next = head;
+        head = slot;
+    }
+    return head;
+}
+
+void * allocEntity()
+{
+    if (!entityFreeList) entityFreeList = refillEntities();
+    EntitySlot * slot = entityFreeList;
+    entityFreeList = slot->next;
+    liveEntities++;
+    return slot;
+}
+
+void freeEntity(void * record)
+{
+    if (!record) return;
+    EntitySlot * slot = static_cast<EntitySlot*>(record);
+    slot->next = entityFreeList;
+    entityFreeList = slot;
+    liveEntities--;
+}
+
+void * GameObject::operator new(size_t bytes)
+{
+    return allocEntity();
+}
+
+void GameObject::operator delete(void * record)
+{
+    freeEntity(record);
+}
+
+EntityPoolStats entityPoolStats()
+{
+    return EntityPoolStats {entityBlocks.size(), entityBlocks.size()*ENTITY_BLOCK_RECORDS*ENTITY_RECORD_SIZE, liveEntities};
+}
@@ -0,0 +1,38 @@
+#ifndef ENTITY_POOL_HPP
+#define ENTITY_POOL_HPP
+
+/*
+    storage for gameObjects
+
+    a GameObject is one 32 byte record: position, velocity and the lod timer
+    as floats, health and size in 16 bits, the speed quantized to 1/16 pixels
+    per second, the type and an index into textureTable (where the image
+    pointer was) sharing a byte, the behaviour and lod flags packed into a
+    byte, and a 16 bit id. the old struct was 56 bytes plus a heap header
+    per object.
+
+    new and delete of a GameObject come here instead of the heap. records are
+    cut out of blocks aligned to a cache line, so exactly two share every
+    line, none straddles one, and there's no allocator header between them.
+    objects are only made and deleted on the game thread, so the free list is
+    a plain global and nothing is locked. blocks are never given back.
+*/
+
+#include <vector>
+
+#define ENTITY_RECORD_SIZE 32
+#define ENTITY_LINE_SIZE 64
+#define ENTITY_BLOCK_RECORDS 2048 // 64 KB per block
+
+struct EntityPoolStats {
+    size_t blocks;
+    size_t reservedBytes;
+    size_t live; // records in use
+};
+
+void * allocEntity();
+void freeEntity(void * record);
+
+EntityPoolStats entityPoolStats();
+
+#endif
@@ -0,0 +1,183 @@
+#include "FrameCapture.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CAPTURE_SSE2
+#endif
+
+CaptureRing captureRing;
+std::thread captureThread;
+std::atomic<bool> captureRunning {false};
+std::atomic<uint32> framesCaptured {0}, framesWritten {0}, framesDropped {0};
+FILE * captureFile = nullptr;
+float captureTimer = 0.0f;
+
+// full range BT.601 (C420jpeg in the header), 8 bit fixed point. pure blue and red come out at 256
+inline uint8 clampByte(int x) { return uint8(x < 0 ? 0 : x > 255 ? 255 : x); }
+inline uint8 lumaOf(int r, int g, int b) { return uint8((77*r + 150*g + 29*b + 128) >> 8); }
+inline uint8 blueDiffOf(int r, int g, int b) { return clampByte(((-43*r - 85*g + 128*b + 128) >> 8) + 128); }
+inline uint8 redDiffOf(int r, int g, int b) { return clampByte(((128*r - 107*g - 21*b + 128) >> 8) + 128); }
+
+void convertRowPair(const uint32 * row0, const uint32 * row1, int width, uint8 * y0, uint8 * y1, uint8 * u, uint8 * v)
+{
+    int x = 0;
+#ifdef CAPTURE_SSE2
+    const __m128i byteMask = _mm_set1_epi32(0xff), ones = _mm_set1_epi16(1), two = _mm_set1_epi32(2);
+    const __m128i yr = _mm_set1_epi16(77), yg = _mm_set1_epi16(150), yb = _mm_set1_epi16(29), round = _mm_set1_epi16(128);
+    const __m128i ur = _mm_set1_epi16(-43), ug = _mm_set1_epi16(-85), vg = _mm_set1_epi16(-107), vb = _mm_set1_epi16(-21);
+    // 8 pixels of one channel as 16 bit lanes
+    auto channel = [&](__m128i a, __m128i b, int shift) {
+        return _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, shift), byteMask), _mm_and_si128(_mm_srli_epi32(b, shift), byteMask));
+    };
+    auto luma = [&](__m128i r, __m128i g, __m128i b) {
+        // fits in 16 bits unsigned, wraparound in between doesn't matter
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, yr), _mm_mullo_epi16(g, yg)), _mm_add_epi16(_mm_mullo_epi16(b, yb), round));
+        return _mm_srli_epi16(sum, 8);
+    };
+    for (; x+8 <= width; x += 8) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(row0+x)), b0 = _mm_loadu_si128((const __m128i*)(row0+x+4));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(row1+x)), b1 = _mm_loadu_si128((const __m128i*)(row1+x+4));
+        __m128i r0 = channel(a0, b0, 16), g0 = channel(a0, b0, 8), bl0 = channel(a0, b0, 0);
+        __m128i r1 = channel(a1, b1, 16), g1 = channel(a1, b1, 8), bl1 = channel(a1, b1, 0);
+
+        __m128i l0 = luma(r0, g0, bl0), l1 = luma(r1, g1, bl1);
+        _mm_storel_epi64((__m128i*)(y0+x), _mm_packus_epi16(l0, l0));
+        _mm_storel_epi64((__m128i*)(y1+x), _mm_packus_epi16(l1, l1));
+
+        // average each 2x2 block, 4 blocks
+        __m128i r = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_add_epi16(r0, r1), ones), two), 2);
+        __m128i g = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_add_epi16(g0, g1), ones), two), 2);
+        __m128i b = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_add_epi16(bl0, bl1), ones), two), 2);
+        r = _mm_packs_epi32(r, r); g = _mm_packs_epi32(g, g); b = _mm_packs_epi32(b, b);
+
+        // signed and within +-32640, the rounding can take pure blue or red to 32768 so it saturates
+        __m128i cb = _mm_adds_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, ur), _mm_mullo_epi16(g, ug)), _mm_slli_epi16(b, 7)), round);
+        __m128i cr = _mm_adds_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(r, 7), _mm_mullo_epi16(g, vg)), _mm_mullo_epi16(b, vb)), round);
+        cb = _mm_add_epi16(_mm_srai_epi16(cb, 8), round);
+        cr = _mm_add_epi16(_mm_srai_epi16(cr, 8), round);
+        *(int*)(u+x/2) = _mm_cvtsi128_si32(_mm_packus_epi16(cb, cb));
+        *(int*)(v+x/2) = _mm_cvtsi128_si32(_mm_packus_epi16(cr, cr));
+    }
+#endif
+    for (; x < width; x += 2) {
+        int r = 0, g = 0, b = 0;
+        const uint32 * rows[2] = {row0, row1};
+        uint8 * lumas[2] = {y0, y1};
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                uint32 p = rows[i][x+j];
+                int pr = (p >> 16) & 0xff, pg = (p >> 8) & 0xff, pb = p & 0xff;
+                lumas[i][x+j] = lumaOf(pr, pg, pb);
+                r += pr; g += pg; b += pb;
+            }
+        }
+        r = (r+2) >> 2; g = (g+2) >> 2; b = (b+2) >> 2;
+        u[x/2] = blueDiffOf(r, g, b);
+        v[x/2] = redDiffOf(r, g, b);
+    }
+}
+
+void writeCaptureFrame(const uint32 * pixels, std::vector<uint8>& yuv)
+{
+    int width = captureRing.width, height = captureRing.height;
+    uint8 * y = yuv.data(), * u = y + width*height, * v = u + width*height/4;
+    for (int row = 0; row < height; row += 2) {
+        convertRowPair(pixels + (size_t)row*width, pixels + (size_t)(row+1)*width, width,
+            y + (size_t)row*width, y + (size_t)(row+1)*width, u + (size_t)row/2*width/2, v + (size_t)row/2*width/2);
+    }
+    fputs("FRAME\n", captureFile);
+    fwrite(yuv.data(), 1, yuv.size(), captureFile);
+    framesWritten++;
+}
+
+// writes out every queued frame, returns how many were written
+int drainCaptureRing(std::vector<uint8>& yuv)
+{
+    uint32 tail = captureRing.tail.load(std::memory_order_relaxed);
+    uint32 head = captureRing.head.load(std::memory_order_acquire);
+    for (uint32 i = tail; i != head; i++) {
+        writeCaptureFrame(captureRing.slots[i & (CAPTURE_RING-1)], yuv);
+        captureRing.tail.store(i+1, std::memory_order_release); // hand the slot back straight away
+    }
+    return int(head - tail);
+}
+
+int startCapture()
+{
+    if (captureRunning || !frameBuffer.pixels) return -1;
+    captureFile = fopen(CAPTURE_FILE, "wb");
+    if (!captureFile) return -1;
+
+    captureRing.width = frameBuffer.width & ~1;
+    captureRing.height = frameBuffer.height & ~1;
+    captureRing.head = 0;
+    captureRing.tail = 0;
+    captureRing.slots.resize(CAPTURE_RING);
+    for (uint32*& slot : captureRing.slots) {
+        // touched now so the first frames don't page fault on the painting thread
+        slot = new uint32[(size_t)captureRing.width*captureRing.height];
+        memset(slot, 0, (size_t)captureRing.width*captureRing.height*4);
+    }
+    framesCaptured = framesWritten = framesDropped = 0;
+    captureTimer = 0.0f;
+
+    fprintf(captureFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", captureRing.width, captureRing.height, CAPTURE_FPS);
+    captureRunning = true;
+    captureThread = std::thread([]() {
+        std::vector<uint8> yuv((size_t)captureRing.width*captureRing.height*3/2);
+        while (captureRunning.load(std::memory_order_relaxed)) {
+            if (drainCaptureRing(yuv) == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        drainCaptureRing(yuv);
+    });
+    LOG_INFO("capture started", "width", captureRing.width, "height", captureRing.height, "file", CAPTURE_FILE);
+    return 0;
+}
+
+void stopCapture()
+{
+    if (!captureRunning) return;
+    captureRunning = false;
+    captureThread.join();
+    fclose(captureFile);
+    captureFile = nullptr;
+    for (uint32 * slot : captureRing.slots) delete[] slot;
+    captureRing.slots.clear();
+
+    CaptureStats stats = captureStats();
+    LOG_INFO("capture stopped", "captured", stats.captured, "written", stats.written, "dropped", stats.dropped);
+}
+
+bool capturing()
+{
+    return captureRunning.load(std::memory_order_relaxed);
+}
+
+void captureFrame(float dt)
+{
+    if (!capturing()) return;
+    captureTimer += dt;
+    if (captureTimer < 1.0f/CAPTURE_FPS) return;
+    captureTimer = MIN(captureTimer-1.0f/CAPTURE_FPS, 1.0f/CAPTURE_FPS); // don't try to catch up after a stall
+    PROFILE_SCOPE("captureFrame");
+
+    uint32 head = captureRing.head.load(std::memory_order_relaxed);
+    if (head - captureRing.tail.load(std::memory_order_acquire) >= CAPTURE_RING) {
+        framesDropped++;
+        return;
+    }
+
+    // GDI+ drew the HUD, make sure it's in memory
+    GdiFlush();
+    uint32 * slot = captureRing.slots[head & (CAPTURE_RING-1)];
+    for (int y = 0; y < captureRing.height; y++) {
+        memcpy(slot + (size_t)y*captureRing.width, frameBuffer.pixels + (size_t)y*frameBuffer.stride, captureRing.width*4);
+    }
+    captureRing.head.store(head+1, std::memory_order_release);
+    framesCaptured++;
+}
+
+CaptureStats captureStats()
+{
+    return CaptureStats {framesCaptured.load(), framesWritten.load(), framesDropped.load()};
+}
@@ -0,0 +1,51 @@
+#ifndef FRAME_CAPTURE_HPP
+#define FRAME_CAPTURE_HPP
+
+/*
+    gameplay recording (run with -capture)
+
+    after each presented frame the offscreen buffer is copied into the next
+    free slot of a ring of CAPTURE_RING preallocated buffers, and that's all
+    the painting thread does. a background thread converts the slots to
+    YUV 4:2:0 (SSE2) and appends them to a Y4M file, which most players and
+    ffmpeg read as is.
+
+    frames are taken at most CAPTURE_FPS times a second so playback runs at
+    game speed. when the writer falls behind the ring fills up and frames are
+    dropped and counted, capture never waits on the disk.
+*/
+
+#include <atomic>
+#include <thread>
+
+#define CAPTURE_FILE "capture.y4m"
+#define CAPTURE_RING 8 // must be a power of 2
+#define CAPTURE_FPS 30
+
+struct CaptureStats {
+    uint32 captured; // copied into the ring
+    uint32 written;
+    uint32 dropped;  // ring was full
+};
+
+// single producer (painting thread), single consumer (writer thread)
+struct CaptureRing {
+    int width, height;               // even, odd frame buffers lose a row/column
+    std::vector<uint32*> slots;      // CAPTURE_RING frames of width*height pixels
+    std::atomic<uint32> head {0};    // next slot to fill, only changed by the producer
+    std::atomic<uint32> tail {0};    // next slot to write, only changed by the consumer
+};
+
+int startCapture(); // into CAPTURE_FILE, sized from frameBuffer, 0 on success
+void stopCapture(); // writes out what's queued
+bool capturing();
+
+// call after the frame is presented, dt is the frame's delta time
+void captureFrame(float dt);
+
+// one row pair of BGRA pixels into width Y samples per row and width/2 U and V
+void convertRowPair(const uint32 * row0, const uint32 * row1, int width, uint8 * y0, uint8 * y1, uint8 * u, uint8 * v);
+
+CaptureStats captureStats();
+
+#endif
@@ -0,0 +1,86 @@
+#include "Input.hpp"
+
+InputQueue inputQueue;
+
+// latency, painting thread only
+int64_t inputAppliedTime = 0; // oldest event applied since the last present, 0 when none
+uint32 latencySamples = 0;
+double latencyTotal = 0.0, latencyLast = 0.0, latencyMax = 0.0; // ns
+
+int64_t inputClock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void pushInput(InputEventType type, int x, int y, uint8 keys)
+{
+    uint32 head = inputQueue.head.load(std::memory_order_relaxed);
+    if (head - inputQueue.tail.load(std::memory_order_acquire) >= INPUT_QUEUE_SIZE) {
+        inputQueue.dropped++;
+        return;
+    }
+    inputQueue.events[head & (INPUT_QUEUE_SIZE-1)] = InputEvent {inputClock(), type, keys, x, y};
+    inputQueue.head.store(head+1, std::memory_order_release);
+}
+
+// player to a screen position, the camera is where this tick's frame will draw it
+void aimAt(int x, int y)
+{
+    Vector2 mousePos = getWorldSpaceCoords((float)x, (float)y);
+    playerToMouse = {mousePos.x-(player->pos.x+player->size[0]/2), mousePos.y-(player->pos.y+player->size[1]/2)};
+    playerToMouse.normalise();
+}
+
+bool popInput(InputEvent * event)
+{
+    uint32 tail = inputQueue.tail.load(std::memory_order_relaxed);
+    if (tail == inputQueue.head.load(std::memory_order_acquire)) return false;
+    *event = inputQueue.events[tail & (INPUT_QUEUE_SIZE-1)];
+    inputQueue.tail.store(tail+1, std::memory_order_release);
+    return true;
+}
+
+void applyInput()
+{
+    InputEvent event;
+    while (popInput(&event)) {
+        switch (event.type)
+        {
+            case INPUT_KEY_DOWN:
+                movementKeys |= event.keys; break;
+            case INPUT_KEY_UP:
+                movementKeys &= ~event.keys; break;
+            case INPUT_AIM:
+                aimAt(event.x, event.y); break;
+            case INPUT_FIRE:
+                if (!gameIsPaused) shootBullet(event.x, event.y);
+                break;
+            case INPUT_FLASHLIGHT:
+                flashlightOn = !flashlightOn; break;
+        }
+        if (!inputAppliedTime) inputAppliedTime = event.time;
+    }
+}
+
+void inputPresented()
+{
+    if (!inputAppliedTime) return;
+    double latency = double(inputClock() - inputAppliedTime);
+    inputAppliedTime = 0;
+
+    latencySamples++;
+    latencyTotal += latency;
+    latencyLast = latency;
+    latencyMax = MAX(latencyMax, latency);
+}
+
+InputLatencyStats inputLatencyStats()
+{
+    InputLatencyStats stats;
+    stats.samples = latencySamples;
+    stats.lastMs = float(latencyLast / 1e6);
+    stats.meanMs = latencySamples ? float(latencyTotal / latencySamples / 1e6) : 0.0f;
+    stats.maxMs = float(latencyMax / 1e6);
+    stats.dropped = inputQueue.dropped.load(std::memory_order_relaxed);
+    return stats;
+}
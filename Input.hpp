@@ -0,0 +1,63 @@
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+/*
+    timestamped input queue
+
+    WndProc doesn't touch the game state for gameplay input any more, it
+    stamps the event with the time and pushes it onto a lock free queue.
+    tickGame applies everything queued at the start of the tick, oldest
+    first, so a click after a mouse move shoots where the mouse went and
+    shots happen inside the simulation like the controller's.
+
+    input to photon latency is measured from an event being stamped to the
+    first frame presented after it was applied (copyOffscreenToWindow), the
+    time before WndProc sees the message isn't included.
+
+    menu clicks, escape and the debug keys still act straight away.
+*/
+
+#include <atomic>
+#include <chrono>
+
+#define INPUT_QUEUE_SIZE 256 // must be a power of 2
+
+enum InputEventType : uint8 {
+    INPUT_KEY_DOWN,  // keys = movementKeys bit
+    INPUT_KEY_UP,
+    INPUT_AIM,       // x, y = mouse position on screen
+    INPUT_FIRE,      // x, y = mouse position on screen
+    INPUT_FLASHLIGHT
+};
+
+struct InputEvent {
+    int64_t time; // ns, steady_clock
+    InputEventType type;
+    uint8 keys;
+    int x, y;
+};
+
+// single producer (WndProc), single consumer (tickGame)
+struct InputQueue {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    std::atomic<uint32> head {0}; // next slot to write, only changed by the producer
+    std::atomic<uint32> tail {0}; // next slot to read, only changed by the consumer
+    std::atomic<uint32> dropped {0};
+};
+
+struct InputLatencyStats {
+    uint32 samples;
+    float lastMs, meanMs, maxMs;
+    uint32 dropped; // events lost to a full queue
+};
+
+int64_t inputClock(); // ns
+
+void pushInput(InputEventType type, int x = 0, int y = 0, uint8 keys = 0);
+void applyInput(); // start of the tick
+bool popInput(InputEvent * event); // oldest queued event, false when there are none
+void inputPresented(); // after a frame is on screen
+
+InputLatencyStats inputLatencyStats();
+
+#endif
@@ -0,0 +1,524 @@
+#include "Lockstep.hpp"
+
+#define LOCKSTEP_MAGIC 0x4C
+#define LOCKSTEP_HELLO 0
+#define LOCKSTEP_INPUT 1
+#define LOCKSTEP_INPUT_CHECK 2   // inputs with our latest checksum
+#define LOCKSTEP_INPUT_HEADER 7  // magic, type|player, ack, first tick, count
+#define LOCKSTEP_CHECK_SIZE 6    // check tick, checksum
+#define LOCKSTEP_CHECKS 8        // local checksums kept to compare against late packets
+
+bool lockstepRunning = false, lockstepStarted = false;
+int localPlayer = 0, playerCount = 0;
+uint32 lockstepSeed = LOCKSTEP_SEED;
+SOCKET lockstepSocket = INVALID_SOCKET;
+
+// handshake
+uint32 hellos = 0;  // bit per player heard from
+uint32 refused = 0; // bit per player whose tuning isn't ours, logged once
+bool haveHostFields = false;
+SaveFields hostFields;
+float helloTimer = 0.0f, tickTimer = 0.0f;
+
+// inputs by player and tick
+TickInput tickInputs[LOCKSTEP_MAX_PLAYERS][LOCKSTEP_HISTORY];
+uint32 inputTicks[LOCKSTEP_MAX_PLAYERS][LOCKSTEP_HISTORY]; // tick each slot holds
+uint32 inputsReceived[LOCKSTEP_MAX_PLAYERS]; // every tick before this is known
+uint32 inputsAcked[LOCKSTEP_MAX_PLAYERS];    // every local input before this reached that player
+
+// local input between samples
+uint8 localKeys = 0;
+uint16 localAim = 0;
+int mouseX = 0, mouseY = 0;
+bool haveMouse = false, localFire = false, localToggle = false;
+
+// simulation
+GameObject * avatars[LOCKSTEP_MAX_PLAYERS];
+uint32 currentTick = 0;      // ticks that should have been simulated by now
+uint32 confirmedTick = 0;    // ticks simulated with everyone's input
+uint32 predictedThrough = 0; // ticks simulated in total, the ones past confirmedTick are guesses
+LockstepState confirmedState;
+bool confirmedStateSaved = false;
+
+// desync checks
+uint32 checkTicks[LOCKSTEP_CHECKS], checkSums[LOCKSTEP_CHECKS];
+uint32 lastCheckTick = 0, lastCheckSum = 0, lastDesyncTick = 0;
+uint32 checksUnsent = 0; // bit per peer that hasn't been sent the latest checksum
+
+LockstepStats lockstepCounters;
+
+inline void put32(uint8 * out, uint32 value) { memcpy(out, &value, 4); }
+inline uint32 get32(const uint8 * in) { uint32 value; memcpy(&value, in, 4); return value; }
+
+// ticks go over as their low 16 bits, every tick in a packet is within a few
+// histories of the receiver's confirmedTick so it puts back the rest from that
+inline void putTick(uint8 * out, uint32 tick) { out[0] = uint8(tick & 0xff); out[1] = uint8(tick >> 8); }
+inline uint32 getTick(const uint8 * in) { return confirmedTick + int16_t(uint16((in[0] | (in[1] << 8)) - confirmedTick)); }
+
+sockaddr_in peerAddress(int peer)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((u_short)(LOCKSTEP_PORT + peer));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+void sendPacket(int peer, const uint8 * data, int size)
+{
+    sockaddr_in address = peerAddress(peer);
+    sendto(lockstepSocket, (const char*)data, size, 0, (const sockaddr*)&address, sizeof(address));
+    lockstepCounters.bytesSent += size;
+}
+
+void sendHello(int peer)
+{
+    uint8 packet[7 + sizeof(SaveFields)];
+    packet[0] = LOCKSTEP_MAGIC;
+    packet[1] = uint8((LOCKSTEP_HELLO << 4) | localPlayer);
+    packet[2] = lockstepStarted;
+    put32(packet+3, tuningHash(*tuning));
+    int size = 7;
+    // everyone plays with the host's upgrades
+    if (localPlayer == 0) {
+        SaveFields fields = collectSaveFields();
+        memcpy(packet+7, &fields, sizeof(fields));
+        size += sizeof(fields);
+    }
+    sendPacket(peer, packet, size);
+}
+
+static_assert(LOCKSTEP_MAX_RESEND <= LOCKSTEP_HISTORY && LOCKSTEP_MAX_RESEND <= 255, "resent inputs have to be in the history and fit the count byte");
+
+// the local inputs each peer hasn't acknowledged, oldest first
+void sendInputs()
+{
+    uint8 packet[LOCKSTEP_INPUT_HEADER + LOCKSTEP_CHECK_SIZE + LOCKSTEP_MAX_RESEND*3];
+    uint32 latest = inputsReceived[localPlayer];
+    for (int peer = 0; peer < playerCount; peer++) {
+        if (peer == localPlayer) continue;
+        uint32 first = latest > LOCKSTEP_MAX_RESEND ? latest-LOCKSTEP_MAX_RESEND : 0;
+        if (inputsAcked[peer] > first) first = inputsAcked[peer];
+        uint32 count = latest - first;
+
+        // a checksum goes out once, in the next packet after it's recorded
+        bool check = checksUnsent & (1u << peer);
+        checksUnsent &= ~(1u << peer);
+
+        packet[0] = LOCKSTEP_MAGIC;
+        packet[1] = uint8(((check ? LOCKSTEP_INPUT_CHECK : LOCKSTEP_INPUT) << 4) | localPlayer);
+        putTick(packet+2, inputsReceived[peer]);
+        putTick(packet+4, first);
+        packet[6] = (uint8)count;
+        uint8 * out = packet + LOCKSTEP_INPUT_HEADER;
+        if (check) {
+            putTick(out, lastCheckTick);
+            put32(out+2, lastCheckSum);
+            out += LOCKSTEP_CHECK_SIZE;
+        }
+        for (uint32 tick = first; tick < latest; tick++) {
+            const TickInput& input = tickInputs[localPlayer][tick & (LOCKSTEP_HISTORY-1)];
+            *out++ = input.buttons;
+            *out++ = uint8(input.aim & 0xff);
+            *out++ = uint8(input.aim >> 8);
+        }
+        sendPacket(peer, packet, int(out - packet));
+    }
+}
+
+void storeInput(int player, uint32 tick, TickInput input)
+{
+    tickInputs[player][tick & (LOCKSTEP_HISTORY-1)] = input;
+    inputTicks[player][tick & (LOCKSTEP_HISTORY-1)] = tick;
+}
+
+// compares a peer's checksum with ours for the same tick
+void checkPeerState(int peer, uint32 tick, uint32 sum)
+{
+    if (!tick || tick == lastDesyncTick) return;
+    int slot = (tick / LOCKSTEP_CHECK_INTERVAL) % LOCKSTEP_CHECKS;
+    if (checkTicks[slot] != tick || checkSums[slot] == sum) return;
+    lastDesyncTick = tick;
+    lockstepCounters.desyncs++;
+    LOG_ERROR("co-op desync", "tick", tick, "player", peer);
+}
+
+// returns true when new remote input came in
+bool receivePackets()
+{
+    bool arrived = false;
+    uint8 packet[512];
+    while (true) {
+        int size = recvfrom(lockstepSocket, (char*)packet, sizeof(packet), 0, NULL, NULL);
+        if (size == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAECONNRESET) continue; // a peer that isn't up yet, not an error
+            break;
+        }
+        if (size < 2 || packet[0] != LOCKSTEP_MAGIC) continue;
+        int type = packet[1] >> 4, peer = packet[1] & 15;
+        if (peer >= playerCount || peer == localPlayer) continue;
+
+        if (type == LOCKSTEP_HELLO) {
+            if (size < 7) continue;
+            uint32 theirs = get32(packet+3), ours = tuningHash(*tuning);
+            if (theirs != ours) {
+                if (!(refused & (1u << peer))) LOG_ERROR("co-op peer has a different tuning file", "player", peer, "theirs", theirs, "ours", ours);
+                refused |= 1u << peer;
+                continue;
+            }
+            hellos |= 1u << peer;
+            if (peer == 0 && size >= 7 + (int)sizeof(SaveFields)) {
+                memcpy(&hostFields, packet+7, sizeof(hostFields));
+                haveHostFields = true;
+            }
+            if (lockstepStarted && !packet[2]) sendHello(peer); // still waiting, it missed ours
+            continue;
+        }
+        // inputs only count once everyone has the same starting state
+        if ((type != LOCKSTEP_INPUT && type != LOCKSTEP_INPUT_CHECK) || size < LOCKSTEP_INPUT_HEADER || !lockstepStarted) continue;
+
+        bool check = type == LOCKSTEP_INPUT_CHECK;
+        uint32 first = getTick(packet+4), count = packet[6];
+        if (size < LOCKSTEP_INPUT_HEADER + (check ? LOCKSTEP_CHECK_SIZE : 0) + (int)count*3) continue;
+        inputsAcked[peer] = MAX(inputsAcked[peer], getTick(packet+2));
+
+        const uint8 * in = packet + LOCKSTEP_INPUT_HEADER;
+        if (check) {
+            checkPeerState(peer, getTick(in), get32(in+2));
+            in += LOCKSTEP_CHECK_SIZE;
+        }
+        for (uint32 tick = first; tick < first+count; tick++, in += 3) {
+            // the slot before confirmedTick is still needed for prediction
+            if (tick < inputsReceived[peer] || tick >= confirmedTick + LOCKSTEP_HISTORY-1) continue;
+            storeInput(peer, tick, TickInput {in[0], uint16(in[1] | (in[2] << 8))});
+        }
+        uint32 before = inputsReceived[peer];
+        while (inputTicks[peer][inputsReceived[peer] & (LOCKSTEP_HISTORY-1)] == inputsReceived[peer]) inputsReceived[peer]++;
+        if (inputsReceived[peer] != before) arrived = true;
+    }
+    return arrived;
+}
+
+// what WndProc queued since the last sample
+TickInput sampleLocalInput()
+{
+    InputEvent event;
+    while (popInput(&event)) {
+        switch (event.type)
+        {
+            case INPUT_KEY_DOWN:
+                localKeys |= event.keys; break;
+            case INPUT_KEY_UP:
+                localKeys &= ~event.keys; break;
+            case INPUT_FIRE:
+                localFire = true; // aims as well
+            case INPUT_AIM:
+                mouseX = event.x; mouseY = event.y; haveMouse = true;
+                break;
+            case INPUT_FLASHLIGHT:
+                localToggle = true; break;
+        }
+    }
+
+    // sent as an angle so the simulation never sees this process' camera
+    if (haveMouse) {
+        const GameObject * avatar = avatars[localPlayer];
+        Vector2 mousePos = getWorldSpaceCoords((float)mouseX, (float)mouseY);
+        float dx = mousePos.x-(avatar->pos.x+avatar->size[0]/2), dy = mousePos.y-(avatar->pos.y+avatar->size[1]/2);
+        if (dx != 0.0f || dy != 0.0f) localAim = uint16(int(floorf(atan2f(dy, dx) * (65536.0f/6.2831853f) + 0.5f)) & 0xffff);
+    }
+
+    TickInput input = {uint8(localKeys | (localFire ? LOCKSTEP_FIRE : 0) | (localToggle ? LOCKSTEP_FLASHLIGHT : 0)), localAim};
+    localFire = localToggle = false;
+    return input;
+}
+
+// a player's input for a tick, the last one known when it hasn't arrived
+TickInput tickInput(int player, uint32 tick)
+{
+    if (tick < inputsReceived[player]) return tickInputs[player][tick & (LOCKSTEP_HISTORY-1)];
+    TickInput input = tickInputs[player][(inputsReceived[player]-1) & (LOCKSTEP_HISTORY-1)];
+    input.buttons &= 0b1111; // keys are held, clicks aren't
+    return input;
+}
+
+// the other players, next to player 0
+void spawnFollowers()
+{
+    avatars[0] = player;
+    for (int p = 1; p < playerCount; p++) {
+        float offset = 40.0f * ((p+1)/2) * (p % 2 ? 1.0f : -1.0f);
+        avatars[p] = new GameObject(playerImg, tuning->playerHealth, player->pos.x, player->pos.y+offset, tuning->playerSpeed, PLAYER);
+        gameObjects.push_back(avatars[p]);
+    }
+}
+
+void simulateTick(uint32 tick, bool confirmed)
+{
+    // predicted ticks will be simulated again, their shots and hits show up then
+    particlesMuted = !confirmed;
+    for (int p = 0; p < playerCount; p++) {
+        TickInput input = tickInput(p, tick);
+        GameObject * avatar = avatars[p];
+        float angle = input.aim * (6.2831853f/65536.0f);
+        Vector2 aim = {cosf(angle), sinf(angle)};
+        uint8 keys = input.buttons & 0b1111;
+
+        // updateVelocities moves player 0 with movementKeys, the rest move here
+        if (p == 0) {
+            movementKeys = keys;
+            playerToMouse = aim;
+        } else {
+            avatar->velocity.x = avatar->moveSpeed * (bool(keys&1) - bool(keys&4));
+            avatar->velocity.y = avatar->moveSpeed * (bool(keys&2) - bool(keys&8));
+        }
+        if ((input.buttons & LOCKSTEP_FIRE) && !gameIsPaused) {
+            // bullets come out of player
+            GameObject * self = player;
+            player = avatar;
+            fireBullet(aim);
+            player = self;
+        }
+        if (input.buttons & LOCKSTEP_FLASHLIGHT) flashlightOn = !flashlightOn;
+    }
+
+    holdLoadZones = !confirmed;
+    tickGame(1.0f/LOCKSTEP_TICK_RATE);
+    holdLoadZones = false;
+    particlesMuted = false;
+
+    // a new room, storeRoom deleted everyone and made a new player 0
+    if (player != avatars[0]) spawnFollowers();
+    // only player 0 goes through load zones
+    for (int p = 1; p < playerCount; p++) {
+        GameObject * avatar = avatars[p];
+        avatar->pos.x = MAX(avatar->pos.x, 0.0f);
+        avatar->pos.x = MIN(avatar->pos.x, float(bkgWidth-avatar->size[0]));
+        avatar->pos.y = MAX(avatar->pos.y, 0.0f);
+        avatar->pos.y = MIN(avatar->pos.y, float(bkgHeight-avatar->size[1]));
+    }
+}
+
+void captureState(LockstepState& state)
+{
+    state.globals = packState();
+    state.entities.resize(gameObjects.size());
+    state.lodTimes.resize(gameObjects.size());
+    state.lodTick = lodTick;
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        state.entities[i] = packEntity(gameObjects[i]);
+        state.lodTimes[i] = gameObjects[i]->lodTime;
+        for (int p = 0; p < playerCount; p++) if (gameObjects[i] == avatars[p]) state.avatars[p] = (int)i;
+    }
+    captureBehaviours(state.behaviours);
+    captureTimers(state.timers);
+}
+
+void restoreState(const LockstepState& state)
+{
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.resize(state.entities.size());
+    for (size_t i = 0; i < state.entities.size(); i++) {
+        gameObjects[i] = unpackEntity(state.entities[i]);
+        gameObjects[i]->lodTime = state.lodTimes[i];
+    }
+    lodTick = state.lodTick;
+    for (int p = 0; p < playerCount; p++) avatars[p] = gameObjects[state.avatars[p]];
+    player = avatars[0];
+    unpackState(state.globals);
+    restoreBehaviours(state.behaviours);
+    restoreTimers(state.timers);
+}
+
+void recordChecksum(uint32 tick)
+{
+    static LockstepState scratch;
+    captureState(scratch);
+    uint32 sum = saveChecksum(&scratch.globals, sizeof(scratch.globals)) * 16777619u ^
+        saveChecksum(scratch.entities.data(), scratch.entities.size()*sizeof(SnapshotEntity));
+    int slot = (tick / LOCKSTEP_CHECK_INTERVAL) % LOCKSTEP_CHECKS;
+    checkTicks[slot] = tick;
+    checkSums[slot] = sum;
+    lastCheckTick = tick;
+    lastCheckSum = sum;
+    checksUnsent = ~0u;
+}
+
+void beginSession()
+{
+    // same upgrades, seed and room for everyone
+    if (localPlayer != 0) applySaveFields(hostFields);
+    lodSettings.enabled = true; // whatever F7 left it at, everyone has to agree
+    seedRandom(lockstepSeed);
+    timer = 0.0f;
+    newRun();
+    spawnFollowers();
+
+    // nobody has input for the first LOCKSTEP_INPUT_DELAY ticks
+    for (int p = 0; p < playerCount; p++) {
+        for (int slot = 0; slot < LOCKSTEP_HISTORY; slot++) inputTicks[p][slot] = ~0u;
+        for (uint32 tick = 0; tick < LOCKSTEP_INPUT_DELAY; tick++) storeInput(p, tick, TickInput {0, 0});
+        inputsReceived[p] = inputsAcked[p] = LOCKSTEP_INPUT_DELAY;
+    }
+    currentTick = confirmedTick = predictedThrough = 0;
+    confirmedStateSaved = false;
+    lockstepStarted = true;
+    for (int p = 0; p < playerCount; p++) if (p != localPlayer) sendHello(p);
+    LOG_INFO("co-op started", "player", localPlayer, "players", playerCount, "seed", lockstepSeed);
+}
+
+void advanceSimulation(bool arrived)
+{
+    PROFILE_SCOPE("lockstep");
+    // new inputs, the guesses go
+    if (arrived && predictedThrough > confirmedTick) {
+        restoreState(confirmedState);
+        predictedThrough = confirmedTick;
+        lockstepCounters.rollbacks++;
+    }
+
+    if (predictedThrough == confirmedTick) {
+        uint32 confirmable = currentTick;
+        for (int p = 0; p < playerCount; p++) confirmable = MIN(confirmable, inputsReceived[p]);
+        while (confirmedTick < confirmable) {
+            simulateTick(confirmedTick, true);
+            confirmedTick++;
+            confirmedStateSaved = false;
+            if (confirmedTick % LOCKSTEP_CHECK_INTERVAL == 0) recordChecksum(confirmedTick);
+        }
+        predictedThrough = confirmedTick;
+    }
+
+    // guess the rest, keeping the confirmed state to come back to
+    if (predictedThrough < currentTick && !confirmedStateSaved) {
+        captureState(confirmedState);
+        confirmedStateSaved = true;
+    }
+    for (; predictedThrough < currentTick; predictedThrough++) {
+        simulateTick(predictedThrough, false);
+        lockstepCounters.predictedTicks++;
+    }
+}
+
+int startLockstep(int index, int players, uint32 seed)
+{
+    if (lockstepRunning || largeCaveMode) return -1;
+    if (players < 2 || players > LOCKSTEP_MAX_PLAYERS || index < 0 || index >= players) return -1;
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return -1;
+    lockstepSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in address = peerAddress(index);
+    u_long nonBlocking = 1;
+    if (lockstepSocket == INVALID_SOCKET || bind(lockstepSocket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+        ioctlsocket(lockstepSocket, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+        if (lockstepSocket != INVALID_SOCKET) closesocket(lockstepSocket);
+        lockstepSocket = INVALID_SOCKET;
+        WSACleanup();
+        return -1;
+    }
+
+    localPlayer = index;
+    playerCount = players;
+    lockstepSeed = seed;
+    hellos = 1u << index;
+    refused = 0;
+    haveHostFields = false;
+    helloTimer = LOCKSTEP_HELLO_INTERVAL; // say hello straight away
+    tickTimer = 0.0f;
+    lockstepCounters = LockstepStats {};
+    lockstepRunning = true;
+    lockstepStarted = false;
+    LOG_INFO("co-op waiting for players", "player", index, "players", players, "port", LOCKSTEP_PORT+index);
+    return 0;
+}
+
+void stopLockstep()
+{
+    if (!lockstepRunning) return;
+    LockstepStats stats = lockstepStats();
+    LOG_INFO("co-op stopped", "ticks", stats.confirmedTick, "rollbacks", stats.rollbacks, "stalls", stats.stalls,
+        "desyncs", stats.desyncs);
+    closesocket(lockstepSocket);
+    lockstepSocket = INVALID_SOCKET;
+    WSACleanup();
+    lockstepRunning = lockstepStarted = false;
+}
+
+bool lockstepActive()
+{
+    return lockstepRunning;
+}
+
+void runLockstep(float dt)
+{
+    if (!lockstepRunning) return;
+    bool arrived = receivePackets();
+
+    if (!lockstepStarted) {
+        helloTimer += dt;
+        if (helloTimer >= LOCKSTEP_HELLO_INTERVAL) {
+            helloTimer = 0.0f;
+            for (int p = 0; p < playerCount; p++) if (p != localPlayer) sendHello(p);
+        }
+        if (hellos == (1u << playerCount)-1 && (localPlayer == 0 || haveHostFields)) beginSession();
+        return;
+    }
+
+    // real time into fixed ticks, a long frame doesn't turn into a burst
+    bool newTicks = false;
+    tickTimer = MIN(tickTimer+dt, 4.0f/LOCKSTEP_TICK_RATE);
+    while (tickTimer >= 1.0f/LOCKSTEP_TICK_RATE) {
+        tickTimer -= 1.0f/LOCKSTEP_TICK_RATE;
+        if (currentTick - confirmedTick < LOCKSTEP_MAX_PREDICTION) {
+            storeInput(localPlayer, currentTick+LOCKSTEP_INPUT_DELAY, sampleLocalInput());
+            inputsReceived[localPlayer] = currentTick+LOCKSTEP_INPUT_DELAY+1;
+            currentTick++;
+            newTicks = true;
+        } else lockstepCounters.stalls++;
+        // also while stalled, the packet the others are waiting for may have been lost
+        sendInputs();
+    }
+
+    if (newTicks || arrived) advanceSimulation(arrived);
+}
+
+GameObject * viewedPlayer()
+{
+    return lockstepStarted ? avatars[localPlayer] : player;
+}
+
+const GameObject * nearestPlayer(float x, float y)
+{
+    if (!lockstepStarted) return player;
+    const GameObject * nearest = avatars[0];
+    float best = 0.0f;
+    for (int p = 0; p < playerCount; p++) {
+        float dx = avatars[p]->pos.x-x, dy = avatars[p]->pos.y-y;
+        float dist2 = dx*dx + dy*dy;
+        if (p == 0 || dist2 < best) { nearest = avatars[p]; best = dist2; }
+    }
+    return nearest;
+}
+
+int avatarCount()
+{
+    return lockstepStarted ? playerCount : 1;
+}
+
+const GameObject * playerAvatar(int p)
+{
+    return lockstepStarted ? avatars[p] : player;
+}
+
+LockstepStats lockstepStats()
+{
+    LockstepStats stats = lockstepCounters;
+    stats.started = lockstepStarted;
+    stats.players = playerCount;
+    stats.waitingFor = 0;
+    for (int p = 0; p < playerCount; p++) stats.waitingFor += !(hellos & (1u << p));
+    stats.confirmedTick = confirmedTick;
+    stats.currentTick = currentTick;
+    return stats;
+}
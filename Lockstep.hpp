@@ -0,0 +1,102 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+
+/*
+    deterministic lockstep co-op (run with -coop <player> <players> [seed])
+
+    2 to LOCKSTEP_MAX_PLAYERS copies of the game on one machine each simulate
+    the whole run. only inputs go over the network: every LOCKSTEP_TICK_RATE
+    tick each process samples its own input for LOCKSTEP_INPUT_DELAY ticks
+    ahead and sends it over UDP to the others, 3 bytes per player per tick
+    plus a 7 byte header (ticks go as 16 bit, unwrapped around confirmedTick).
+    with 3 players that measured about 29 bytes sent per tick per process, 14
+    to each peer, down from 55 with 4 byte ticks and the checksum in every
+    packet. player i listens on LOCKSTEP_PORT+i on 127.0.0.1.
+
+    a tick is confirmed once every player's input for it is in, confirmed
+    ticks are simulated once and never undone. the ticks after that are
+    predicted from each player's last input (without its shots and flashlight
+    clicks) so a late packet doesn't stop the game, and when new inputs come
+    in the predicted ticks are thrown away: the confirmed state is restored
+    and simulated forward again. prediction stops LOCKSTEP_MAX_PREDICTION
+    ticks past the last confirmed one and waits.
+
+    for every process to agree bit for bit:
+    - the tick is a fixed 1/LOCKSTEP_TICK_RATE
+    - everyone uses player 0's upgrades and the same seed
+    - everyone has the same tuning: the hello carries a hash of it and a
+      peer with a different one is refused, the session doesn't start
+    - enemy LOD is on for everyone and staggers by GameObject::id, rollback
+      keeps each enemy's lodTime and the LOD tick (tiers are redone every tick)
+    - load zones are held shut during predicted ticks, so rolling back never
+      has to undo the room cache
+    - the pause menu, the debug keys, autosave and the run snapshot are off
+    every LOCKSTEP_CHECK_INTERVAL ticks a checksum of the confirmed state goes
+    out with the next inputs to each peer (flagged in the type byte), a
+    mismatch is logged as a desync. it isn't resent, a lost one is a missed check.
+
+    player 0 is the game's player: it carries the flashlight and takes the
+    group through load zones, the others follow it into the next room. health,
+    bullets, gems and charge are shared. enemies chase whoever is nearest.
+*/
+
+#define LOCKSTEP_MAX_PLAYERS 4
+#define LOCKSTEP_PORT 27015
+#define LOCKSTEP_SEED 1
+#define LOCKSTEP_TICK_RATE 60
+#define LOCKSTEP_INPUT_DELAY 3      // ticks between sampling input and simulating it
+#define LOCKSTEP_MAX_PREDICTION 8   // ticks simulated past the last confirmed one
+#define LOCKSTEP_HISTORY 64         // ticks of input kept per player, must be a power of 2
+// unacknowledged inputs per packet. a peer that has our inputs up to R can confirm at most
+// R+LOCKSTEP_MAX_PREDICTION+LOCKSTEP_INPUT_DELAY of its own, so ours run at most twice that
+// past R and every packet still starts at or before the first input it's missing
+#define LOCKSTEP_MAX_RESEND (2*(LOCKSTEP_MAX_PREDICTION + LOCKSTEP_INPUT_DELAY))
+#define LOCKSTEP_CHECK_INTERVAL 60  // ticks between state checksums
+#define LOCKSTEP_HELLO_INTERVAL 0.1f // seconds between hellos while waiting for the others
+
+// buttons, the low 4 bits are movementKeys
+#define LOCKSTEP_FIRE 16
+#define LOCKSTEP_FLASHLIGHT 32
+
+struct TickInput {
+    uint8 buttons;
+    uint16 aim; // angle, 65536 steps per turn
+};
+
+// everything a predicted tick can change
+struct LockstepState {
+    SnapshotState globals;
+    std::vector<SnapshotEntity> entities;
+    std::vector<float> lodTimes;       // GameObject::lodTime of each entity, snapshots don't keep it
+    uint32 lodTick;
+    int avatars[LOCKSTEP_MAX_PLAYERS]; // index of each player's entity
+    BehaviourState behaviours;
+    TimerState timers;
+};
+
+struct LockstepStats {
+    bool started;
+    int players, waitingFor;  // players whose hello hasn't arrived
+    uint32 confirmedTick, currentTick;
+    uint32 rollbacks;         // times predicted ticks were thrown away
+    uint32 predictedTicks;    // simulated ahead of confirmation, including repeats
+    uint32 stalls;            // ticks spent waiting at LOCKSTEP_MAX_PREDICTION
+    uint32 desyncs;
+    uint64_t bytesSent;       // payload, all peers
+};
+
+int startLockstep(int index, int players, uint32 seed); // 0 on success, index is this process' player
+void stopLockstep();
+bool lockstepActive();
+
+// instead of runController and tickGame, dt is real time
+void runLockstep(float dt);
+
+GameObject * viewedPlayer(); // the camera follows this process' player
+const GameObject * nearestPlayer(float x, float y); // player when there is only one
+int avatarCount(); // 1 without lockstep
+const GameObject * playerAvatar(int p);
+
+LockstepStats lockstepStats();
+
+#endif
@@ -0,0 +1,105 @@
+#include "Logger.hpp"
+
+std::atomic<uint32> logClock {0};
+std::vector<LogQueue*> logQueues;     // every queue, guarded by logQueuesMutex
+std::vector<LogQueue*> freeLogQueues; // of threads that have exited, also guarded by logQueuesMutex
+std::mutex logQueuesMutex;
+std::thread loggerThread;
+std::atomic<bool> loggerRunning {false};
+
+const char * logLevelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// a thread's queue, handed back when the thread exits
+struct ThreadLogQueue {
+    LogQueue * queue = nullptr;
+    ~ThreadLogQueue() {
+        if (!queue) return;
+        std::lock_guard<std::mutex> lock(logQueuesMutex);
+        freeLogQueues.push_back(queue);
+    }
+};
+
+LogQueue * threadLogQueue()
+{
+    // queues stay in logQueues until the program exits. one handed back can still have
+    // records the writer hasn't drained, the next thread to take it just carries on
+    // after them, the mutex orders its writes after the old thread's
+    thread_local ThreadLogQueue owned;
+    if (!owned.queue) {
+        std::lock_guard<std::mutex> lock(logQueuesMutex);
+        if (!freeLogQueues.empty()) {
+            owned.queue = freeLogQueues.back();
+            freeLogQueues.pop_back();
+        } else {
+            owned.queue = new LogQueue;
+            logQueues.push_back(owned.queue);
+        }
+    }
+    return owned.queue;
+}
+
+void writeLogRecord(const LogRecord& record)
+{
+    const LogSite * site = record.site;
+    // just the file name, not the whole path
+    const char * file = site->file;
+    for (const char * c = site->file; *c; c++) if (*c == '/' || *c == '\\') file = c+1;
+
+    printf("%u.%03u %s %s:%d %s", record.time/1000, record.time%1000,
+        logLevelNames[site->level], file, site->line, site->message);
+
+    for (int i = 0; i < record.fieldCount; i++) {
+        const LogField& field = record.fields[i];
+        switch (field.type)
+        {
+            case LogField::INT:    printf(" %s=%lld", field.key, field.i); break;
+            case LogField::UINT:   printf(" %s=%llu", field.key, field.u); break;
+            case LogField::FLOAT:  printf(" %s=%g", field.key, field.f); break;
+            case LogField::STRING: printf(" %s=\"%s\"", field.key, field.s); break;
+        }
+    }
+    if (record.suppressed) printf(" (%u repeats suppressed)", record.suppressed);
+    putchar('\n');
+}
+
+// writes out every queued record, returns how many were written
+int drainLogQueues()
+{
+    int written = 0;
+    std::lock_guard<std::mutex> lock(logQueuesMutex);
+    for (LogQueue * queue : logQueues) {
+        uint32 tail = queue->tail.load(std::memory_order_relaxed);
+        uint32 head = queue->head.load(std::memory_order_acquire);
+        for (uint32 i = tail; i != head; i++) writeLogRecord(queue->records[i & (LOG_QUEUE_SIZE-1)]);
+        queue->tail.store(head, std::memory_order_release);
+        written += int(head - tail);
+
+        uint32 dropped = queue->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) printf("[log] %u records dropped, queue full\n", dropped);
+    }
+    return written;
+}
+
+void startLogger()
+{
+    loggerRunning = true;
+    loggerThread = std::thread([]() {
+        auto start = std::chrono::steady_clock::now();
+        while (loggerRunning.load(std::memory_order_relaxed)) {
+            logClock.store((uint32)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+            // flush once per batch, sleep when there was nothing to write
+            if (drainLogQueues() > 0) fflush(stdout);
+            else std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        drainLogQueues();
+        fflush(stdout);
+    });
+}
+
+void stopLogger()
+{
+    loggerRunning = false;
+    if (loggerThread.joinable()) loggerThread.join();
+}
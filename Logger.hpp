@@ -0,0 +1,169 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+/*
+    asynchronous structured logger
+
+    LOG_INFO("player hit", "health", player->health) copies the call site and up
+    to LOG_MAX_FIELDS key/value pairs into the calling thread's lock free queue
+    and returns. formatting and writing happen on a background thread, which
+    prints one line per record:
+
+        12.345 WARN CaveGame.cpp:420 unknown entity index=3
+
+    - levels below LOG_LEVEL are compiled out entirely
+    - each call site logs at most LOG_RATE_LIMIT records per second, the rest
+      are counted and reported on the site's next record
+    - a full queue drops the record and counts it, logging never waits
+    - keys, messages and string values must be string literals
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO // build with -DLOG_LEVEL=0 for debug logs
+#endif
+
+#define LOG_QUEUE_SIZE 1024 // per thread, must be a power of 2
+#define LOG_MAX_FIELDS 4
+#define LOG_RATE_LIMIT 10   // records per call site per second
+
+// one LOG_* call in the source
+struct LogSite {
+    const char * file;
+    int line;
+    int level;
+    const char * message;
+    // rate limiting
+    std::atomic<uint32> window {0};     // second the count is for
+    std::atomic<uint32> count {0};
+    std::atomic<uint32> suppressed {0}; // records dropped by the limit since the last one written
+};
+
+struct LogField {
+    enum Type : uint8 { INT, UINT, FLOAT, STRING };
+    const char * key;
+    Type type;
+    union {
+        long long i;
+        unsigned long long u;
+        double f;
+        const char * s;
+    };
+};
+
+struct LogRecord {
+    const LogSite * site;
+    uint32 time;       // ms since the logger started
+    uint32 suppressed; // repeats of this site dropped by the rate limit before this record
+    uint8 fieldCount;
+    LogField fields[LOG_MAX_FIELDS];
+};
+
+// single producer (the owning thread), single consumer (writer thread)
+struct LogQueue {
+    LogRecord records[LOG_QUEUE_SIZE];
+    std::atomic<uint32> head {0}; // next slot to write, only changed by the producer
+    std::atomic<uint32> tail {0}; // next slot to read, only changed by the consumer
+    std::atomic<uint32> dropped {0};
+};
+
+extern std::atomic<uint32> logClock; // coarse ms clock ticked by the writer thread, cheap to read
+
+void startLogger();
+void stopLogger(); // writes out anything still queued
+LogQueue * threadLogQueue(); // the calling thread's queue, registered or reused on first use
+
+// rate limit check for a call site, stores how many repeats were dropped since its last record
+inline bool logAllowed(LogSite * site, uint32 * suppressed)
+{
+    uint32 window = logClock.load(std::memory_order_relaxed) / 1000;
+    *suppressed = 0;
+    if (site->window.load(std::memory_order_relaxed) != window) {
+        site->window.store(window, std::memory_order_relaxed);
+        site->count.store(0, std::memory_order_relaxed);
+        *suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    if (site->count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT) return true;
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// field setters, picked by the value's type
+inline void setLogField(LogField& field, long long value)          { field.type = LogField::INT; field.i = value; }
+inline void setLogField(LogField& field, int value)                { field.type = LogField::INT; field.i = value; }
+inline void setLogField(LogField& field, unsigned long long value) { field.type = LogField::UINT; field.u = value; }
+inline void setLogField(LogField& field, unsigned int value)       { field.type = LogField::UINT; field.u = value; }
+inline void setLogField(LogField& field, long value)               { field.type = LogField::INT; field.i = value; }
+inline void setLogField(LogField& field, unsigned long value)      { field.type = LogField::UINT; field.u = value; }
+inline void setLogField(LogField& field, double value)             { field.type = LogField::FLOAT; field.f = value; }
+inline void setLogField(LogField& field, float value)              { field.type = LogField::FLOAT; field.f = value; }
+inline void setLogField(LogField& field, const char * value)       { field.type = LogField::STRING; field.s = value; }
+
+inline void fillLogFields(LogRecord&) {}
+template <typename T, typename... Rest>
+inline void fillLogFields(LogRecord& record, const char * key, T value, Rest... rest)
+{
+    LogField& field = record.fields[record.fieldCount++];
+    field.key = key;
+    setLogField(field, value);
+    fillLogFields(record, rest...);
+}
+
+template <typename... Fields>
+inline void logRecord(LogSite * site, Fields... fields)
+{
+    static_assert(sizeof...(Fields) % 2 == 0, "log fields come in key, value pairs");
+    static_assert(sizeof...(Fields) / 2 <= LOG_MAX_FIELDS, "too many log fields");
+
+    uint32 suppressed;
+    if (!logAllowed(site, &suppressed)) return;
+
+    LogQueue * queue = threadLogQueue();
+    uint32 head = queue->head.load(std::memory_order_relaxed);
+    if (head - queue->tail.load(std::memory_order_acquire) >= LOG_QUEUE_SIZE) { // full
+        queue->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord& record = queue->records[head & (LOG_QUEUE_SIZE-1)];
+    record.site = site;
+    record.time = logClock.load(std::memory_order_relaxed);
+    record.suppressed = suppressed;
+    record.fieldCount = 0;
+    fillLogFields(record, fields...);
+
+    queue->head.store(head+1, std::memory_order_release);
+}
+
+#define LOG_AT(level, msg, ...) do { \
+        static LogSite logSite_ = {__FILE__, __LINE__, level, msg}; \
+        logRecord(&logSite_, ##__VA_ARGS__); \
+    } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(msg, ...) LOG_AT(LOG_LEVEL_DEBUG, msg, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(msg, ...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(msg, ...) LOG_AT(LOG_LEVEL_INFO, msg, ##__VA_ARGS__)
+#else
+#define LOG_INFO(msg, ...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(msg, ...) LOG_AT(LOG_LEVEL_WARN, msg, ##__VA_ARGS__)
+#else
+#define LOG_WARN(msg, ...) ((void)0)
+#endif
+#define LOG_ERROR(msg, ...) LOG_AT(LOG_LEVEL_ERROR, msg, ##__VA_ARGS__)
+
+#endif
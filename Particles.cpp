@@ -0,0 +1,197 @@
+#include "Particles.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PARTICLES_SSE2
+#endif
+
+constexpr ParticleEffectInfo particleEffects[NUM_PARTICLE_EFFECTS] = {
+    // count, speedMin, speedMax, spread, lifeMin, lifeMax, damping, color
+    {14, 150.0f, 420.0f, 0.30f,      0.06f, 0.16f, 8.0f, 0xffb040}, // PARTICLE_MUZZLE
+    {20, 60.0f,  260.0f, 1.20f,      0.12f, 0.35f, 4.0f, 0xffe0a0}, // PARTICLE_IMPACT
+    {24, 80.0f,  300.0f, 0.70f,      0.15f, 0.40f, 4.0f, 0xff3020}, // PARTICLE_HIT
+    {32, 40.0f,  160.0f, 3.1415927f, 0.30f, 0.70f, 2.0f, 0x60ff90}  // PARTICLE_PICKUP
+};
+
+// live particles are 0 - particleCount-1
+struct ParticlePool {
+    alignas(16) float x[PARTICLE_CAPACITY];
+    alignas(16) float y[PARTICLE_CAPACITY];
+    alignas(16) float vx[PARTICLE_CAPACITY];
+    alignas(16) float vy[PARTICLE_CAPACITY];
+    alignas(16) float life[PARTICLE_CAPACITY];    // seconds left
+    alignas(16) float fade[PARTICLE_CAPACITY];    // 1 / starting life
+    alignas(16) float damping[PARTICLE_CAPACITY];
+    alignas(16) uint32 color[PARTICLE_CAPACITY];
+};
+
+ParticlePool particlePool;
+int particleCount = 0;
+uint32 particlesEmitted = 0, particlesDropped = 0;
+uint32 particleRandomState = 0x2545f491;
+bool particlesMuted = false;
+bool particleClockStarted = false;
+std::chrono::steady_clock::time_point lastParticleStep;
+
+// per frame, written by binParticles
+struct VisibleParticle {
+    ParticleSplat splat;
+    int tx0, ty0, tx1, ty1; // tiles it touches
+};
+std::vector<VisibleParticle> visibleParticles;
+std::vector<int> particleBinStart, particleCursor; // per tile
+std::vector<ParticleSplat> particleSplats;         // ordered by tile
+
+float particleRandom() // 0 - 1, not randomInt so particles never change the game
+{
+    particleRandomState ^= particleRandomState << 13;
+    particleRandomState ^= particleRandomState >> 17;
+    particleRandomState ^= particleRandomState << 5;
+    return float(particleRandomState >> 8) / 16777216.0f;
+}
+
+void emitParticles(int effect, float x, float y, float dirX, float dirY)
+{
+    if (!frameBuffer.pixels || particlesMuted) return;
+    const ParticleEffectInfo& info = particleEffects[effect];
+    ParticlePool& p = particlePool;
+
+    float direction = atan2f(dirY, dirX);
+    for (int k = 0; k < info.count; k++) {
+        if (particleCount >= PARTICLE_CAPACITY) {
+            particlesDropped += info.count-k;
+            return;
+        }
+        int i = particleCount++;
+        float angle = direction + (2.0f*particleRandom() - 1.0f) * info.spread;
+        float speed = info.speedMin + particleRandom() * (info.speedMax-info.speedMin);
+        float life = info.lifeMin + particleRandom() * (info.lifeMax-info.lifeMin);
+        p.x[i] = x; p.y[i] = y;
+        p.vx[i] = cosf(angle) * speed; p.vy[i] = sinf(angle) * speed;
+        p.life[i] = life; p.fade[i] = 1.0f / life;
+        p.damping[i] = info.damping;
+        p.color[i] = info.color;
+        particlesEmitted++;
+    }
+}
+
+void stepParticles(float dt)
+{
+    PROFILE_SCOPE("stepParticles");
+    ParticlePool& p = particlePool;
+
+    int i = 0;
+#ifdef PARTICLES_SSE2
+    // whole groups of 4, the slots past the last live particle are junk and moving them is harmless
+    const __m128 step = _mm_set1_ps(dt), one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    for (; i < particleCount; i += 4) {
+        __m128 vx = _mm_load_ps(p.vx+i), vy = _mm_load_ps(p.vy+i);
+        _mm_store_ps(p.x+i, _mm_add_ps(_mm_load_ps(p.x+i), _mm_mul_ps(vx, step)));
+        _mm_store_ps(p.y+i, _mm_add_ps(_mm_load_ps(p.y+i), _mm_mul_ps(vy, step)));
+        __m128 keep = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(_mm_load_ps(p.damping+i), step)));
+        _mm_store_ps(p.vx+i, _mm_mul_ps(vx, keep));
+        _mm_store_ps(p.vy+i, _mm_mul_ps(vy, keep));
+        _mm_store_ps(p.life+i, _mm_sub_ps(_mm_load_ps(p.life+i), step));
+    }
+#endif
+    for (; i < particleCount; i++) {
+        p.x[i] += p.vx[i] * dt;
+        p.y[i] += p.vy[i] * dt;
+        float keep = 1.0f - p.damping[i] * dt;
+        if (keep < 0.0f) keep = 0.0f;
+        p.vx[i] *= keep;
+        p.vy[i] *= keep;
+        p.life[i] -= dt;
+    }
+
+    // the last live particle takes the place of each dead one
+    for (int j = 0; j < particleCount;) {
+        if (p.life[j] > 0.0f) { j++; continue; }
+        int last = --particleCount;
+        p.x[j] = p.x[last]; p.y[j] = p.y[last];
+        p.vx[j] = p.vx[last]; p.vy[j] = p.vy[last];
+        p.life[j] = p.life[last]; p.fade[j] = p.fade[last];
+        p.damping[j] = p.damping[last];
+        p.color[j] = p.color[last];
+    }
+}
+
+void updateParticles()
+{
+    auto now = std::chrono::steady_clock::now();
+    float dt = particleClockStarted ? std::chrono::duration<float>(now - lastParticleStep).count() : 0.0f;
+    lastParticleStep = now;
+    particleClockStarted = true;
+    if (gameIsPaused || particleCount == 0) return;
+    stepParticles(dt < PARTICLE_MAX_STEP ? dt : PARTICLE_MAX_STEP);
+}
+
+void binParticles(Vector2 camera, int columns, int rows)
+{
+    PROFILE_SCOPE("binParticles");
+    const ParticlePool& p = particlePool;
+    int tiles = columns*rows;
+    particleBinStart.assign(tiles+1, 0);
+    visibleParticles.clear();
+
+    // what's on screen, faded by the life it has left, and how much goes in each tile
+    for (int i = 0; i < particleCount; i++) {
+        int x = int(p.x[i]-camera.x) - PARTICLE_SIZE/2, y = int(p.y[i]-camera.y) - PARTICLE_SIZE/2;
+        if (x >= frameBuffer.width || y >= frameBuffer.height || x+PARTICLE_SIZE <= 0 || y+PARTICLE_SIZE <= 0) continue;
+
+        uint32 strength = uint32(p.life[i] * p.fade[i] * 256.0f);
+        uint32 rb = (((p.color[i] & 0xff00ff) * strength) >> 8) & 0xff00ff;
+        uint32 g = (((p.color[i] & 0x00ff00) * strength) >> 8) & 0x00ff00;
+
+        VisibleParticle v;
+        v.splat = ParticleSplat {(int16_t)x, (int16_t)y, rb | g};
+        v.tx0 = (MAX(x, 0)) / TILE_SIZE;
+        v.ty0 = (MAX(y, 0)) / TILE_SIZE;
+        v.tx1 = (MIN(x+PARTICLE_SIZE-1, frameBuffer.width-1)) / TILE_SIZE;
+        v.ty1 = (MIN(y+PARTICLE_SIZE-1, frameBuffer.height-1)) / TILE_SIZE;
+        for (int ty = v.ty0; ty <= v.ty1; ty++) {
+            for (int tx = v.tx0; tx <= v.tx1; tx++) particleBinStart[ty*columns + tx + 1]++;
+        }
+        visibleParticles.push_back(v);
+    }
+
+    // counts into offsets, then place
+    for (int t = 0; t < tiles; t++) particleBinStart[t+1] += particleBinStart[t];
+    particleSplats.resize(particleBinStart[tiles]);
+    particleCursor.assign(particleBinStart.begin(), particleBinStart.end()-1);
+    for (size_t i = 0; i < visibleParticles.size(); i++) {
+        const VisibleParticle& v = visibleParticles[i];
+        for (int ty = v.ty0; ty <= v.ty1; ty++) {
+            for (int tx = v.tx0; tx <= v.tx1; tx++) particleSplats[particleCursor[ty*columns + tx]++] = v.splat;
+        }
+    }
+}
+
+// per channel a + b, stopping at 255
+uint32 addSaturate(uint32 a, uint32 b)
+{
+    // add the low 7 bits of each channel, then the top bits with the carry that came out of them
+    const uint32 high = 0x80808080;
+    uint32 sum = (a & ~high) + (b & ~high);
+    uint32 overflow = ((a & b) | (sum & (a ^ b))) & high;
+    sum ^= (a ^ b) & high;
+    return sum | ((overflow >> 7) * 0xff);
+}
+
+void drawParticles(int tile, int x0, int y0, int x1, int y1)
+{
+    for (int k = particleBinStart[tile]; k < particleBinStart[tile+1]; k++) {
+        const ParticleSplat& splat = particleSplats[k];
+        int sx0 = MAX((int)splat.x, x0), sy0 = MAX((int)splat.y, y0);
+        int sx1 = MIN(splat.x+PARTICLE_SIZE, x1), sy1 = MIN(splat.y+PARTICLE_SIZE, y1);
+        for (int y = sy0; y < sy1; y++) {
+            uint32 * row = frameBuffer.pixels + (size_t)y*frameBuffer.stride;
+            for (int x = sx0; x < sx1; x++) row[x] = addSaturate(row[x], splat.color);
+        }
+    }
+}
+
+ParticleStats particleStats()
+{
+    return ParticleStats {particleCount, particlesEmitted, particlesDropped};
+}
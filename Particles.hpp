@@ -0,0 +1,70 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+
+/*
+    particles for muzzle flashes, bullet impacts and pickups
+
+    purely visual: they aren't gameObjects, so handleCollisions never sees
+    them, they use their own random numbers and nothing in the game reads
+    them back. the pool is PARTICLE_CAPACITY slots stored a field per array
+    (x, y, vx, vy, ...) with the live ones packed at the front, so the update
+    moves 4 at a time with SSE over plain float arrays. a dead particle is
+    replaced by the last live one.
+
+    composeFrame updates them by the real time since the last frame, bins
+    them into its tiles with a counting sort, and each tile adds its batch
+    into the frame buffer after the darkness pass (PARTICLE_SIZE squared
+    pixels each, saturating adds), so they glow in the dark and the order
+    they're drawn in doesn't matter.
+
+    nothing is emitted without a frame buffer (the balance runner) or while
+    particlesMuted is set (lockstep's predicted ticks, which get simulated
+    again).
+*/
+
+#include <chrono>
+
+#define PARTICLE_CAPACITY 65536 // a multiple of 4
+#define PARTICLE_SIZE 2         // pixels square
+#define PARTICLE_MAX_STEP 0.1f  // seconds, longer frames are slowed down to this
+
+enum ParticleEffect {
+    PARTICLE_MUZZLE,  // bullet fired, along the shot
+    PARTICLE_IMPACT,  // bullet hit a wall, back towards the shooter
+    PARTICLE_HIT,     // bullet hit an enemy, through it
+    PARTICLE_PICKUP,  // item picked up, all round
+    NUM_PARTICLE_EFFECTS
+};
+
+struct ParticleEffectInfo {
+    int count;
+    float speedMin, speedMax; // pixels per second
+    float spread;             // radians either side of the direction
+    float lifeMin, lifeMax;   // seconds
+    float damping;            // fraction of speed lost per second
+    uint32 color;             // 0xRRGGBB, added at full strength, fading with life
+};
+
+struct ParticleSplat {
+    int16_t x, y; // screen position of the top left
+    uint32 color; // already faded
+};
+
+struct ParticleStats {
+    int live;
+    uint32 emitted, dropped; // dropped when the pool is full
+};
+
+extern bool particlesMuted;
+
+void emitParticles(int effect, float x, float y, float dirX, float dirY);
+void stepParticles(float dt); // moves everything dt seconds and drops the dead
+void updateParticles();       // steps by the time since the last call, nothing while paused
+
+// for composeFrame's tiles, binParticles runs before the tiles start
+void binParticles(Vector2 camera, int columns, int rows);
+void drawParticles(int tile, int x0, int y0, int x1, int y1);
+
+ParticleStats particleStats();
+
+#endif
@@ -0,0 +1,116 @@
+#include "Profiler.hpp"
+
+ProfileSample profileRing[PROFILE_RING_SIZE];
+std::atomic<uint32> profileHead {0};
+std::atomic<uint32> profileThreadCount {0};
+bool profilerEnabled = true;
+const std::chrono::steady_clock::time_point profileEpoch = std::chrono::steady_clock::now();
+
+int64_t profileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profileEpoch).count();
+}
+
+void recordSample(const char * name, int64_t start, int64_t end)
+{
+    thread_local uint32 threadId = profileThreadCount.fetch_add(1) + 1;
+
+    uint32 index = profileHead.fetch_add(1, std::memory_order_relaxed);
+    ProfileSample& sample = profileRing[index & (PROFILE_RING_SIZE-1)];
+
+    // seqlock style, readers skip a slot whose sequence changed while they copied it.
+    // the fence keeps the writes below from moving above the 0, a release store alone
+    // only orders what comes before it
+    sample.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    sample.name = name;
+    sample.start = start; sample.end = end;
+    sample.thread = threadId;
+    sample.sequence.store(index+1, std::memory_order_release);
+}
+
+// copies a slot if it holds a complete sample
+bool readSample(int slot, ProfileSample& out)
+{
+    ProfileSample& sample = profileRing[slot];
+    uint32 sequence = sample.sequence.load(std::memory_order_acquire);
+    if (sequence == 0) return false;
+
+    out.name = sample.name;
+    out.start = sample.start; out.end = sample.end;
+    out.thread = sample.thread;
+
+    // pairs with the writer's fence, the copy can't move below the re-check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sample.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+int collectPhaseStats(PhaseStats * stats, int maxPhases)
+{
+    // reused between calls so the overlay doesn't allocate every frame
+    static std::vector<float> durations[PROFILE_MAX_PHASES];
+    int phases = 0;
+    for (int i = 0; i < PROFILE_MAX_PHASES; i++) durations[i].clear();
+
+    ProfileSample sample;
+    for (int slot = 0; slot < PROFILE_RING_SIZE; slot++) {
+        if (!readSample(slot, sample)) continue;
+
+        int p = 0;
+        while (p < phases && stats[p].name != sample.name) p++;
+        if (p == phases) {
+            if (phases == (MIN(maxPhases, PROFILE_MAX_PHASES))) continue;
+            stats[phases++].name = sample.name;
+        }
+        durations[p].push_back(float(sample.end - sample.start) / 1000000.0f);
+    }
+
+    for (int p = 0; p < phases; p++) {
+        std::vector<float>& d = durations[p];
+        stats[p].count = (int)d.size();
+        std::nth_element(d.begin(), d.begin() + d.size()/2, d.end());
+        stats[p].p50 = d[d.size()/2];
+        std::nth_element(d.begin(), d.begin() + (d.size()*99)/100, d.end());
+        stats[p].p99 = d[(d.size()*99)/100];
+    }
+    return phases;
+}
+
+int exportChromeTrace(const char * path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) return -1;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    ProfileSample sample;
+    for (int slot = 0; slot < PROFILE_RING_SIZE; slot++) {
+        if (!readSample(slot, sample)) continue;
+        // complete events, timestamps in microseconds
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            first ? "" : ",\n", sample.name, sample.thread,
+            sample.start / 1000.0, (sample.end - sample.start) / 1000.0);
+        first = false;
+    }
+    fprintf(file, "\n]}\n");
+
+    fclose(file);
+    return 0;
+}
+
+void drawProfilerOverlay(Gdiplus::Graphics& graphics)
+{
+    PhaseStats stats[PROFILE_MAX_PHASES];
+    int phases = collectPhaseStats(stats, PROFILE_MAX_PHASES);
+
+    int x = wndWidth-260, y = 10;
+    Gdiplus::SolidBrush boxBrush(Gdiplus::Color(180, 0,0,0));
+    graphics.FillRectangle(&boxBrush, x-10, y-5, 260, 20*(phases+1)+10);
+
+    placeText(x, y, L"phase            p50 ms   p99 ms", Gdiplus::Color(255,255,0), 9, graphics);
+    for (int p = 0; p < phases; p++) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "%-16s %7.3f  %7.3f", stats[p].name, stats[p].p50, stats[p].p99);
+        placeText(x, y+20*(p+1), std::wstring(line, line+(MIN(len, 95))), Gdiplus::Color(255,255,255), 9, graphics);
+    }
+}
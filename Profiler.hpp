@@ -0,0 +1,63 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+/*
+    scoped phase timers
+
+    PROFILE_SCOPE("name") times the rest of the enclosing block and pushes a
+    sample into a lock free ring. the overlay (F3) shows p50/p99 per phase over
+    the samples in the ring, F4 exports the ring as a chrome trace
+    (chrome://tracing or ui.perfetto.dev).
+
+    names must be string literals, samples only keep the pointer.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#define PROFILE_RING_SIZE 8192 // must be a power of 2
+#define PROFILE_MAX_PHASES 32
+#define TRACE_FILE "trace.json"
+
+struct ProfileSample {
+    const char * name;
+    int64_t start, end; // nanoseconds since the profiler started
+    uint32 thread;
+    std::atomic<uint32> sequence {0}; // index+1 of the write that filled this slot, 0 while empty
+};
+
+// percentiles for one phase, in milliseconds
+struct PhaseStats {
+    const char * name;
+    int count;
+    float p50, p99;
+};
+
+extern bool profilerEnabled; // the balance runner turns it off, its threads would all fight over the ring
+
+int64_t profileNow();
+void recordSample(const char * name, int64_t start, int64_t end);
+
+// readers, safe to call while samples are being recorded
+int collectPhaseStats(PhaseStats * stats, int maxPhases);
+int exportChromeTrace(const char * path);
+
+void drawProfilerOverlay(Gdiplus::Graphics& graphics);
+
+struct ScopedTimer {
+    const char * name;
+    int64_t start;
+
+    ScopedTimer(const char * phase) {
+        name = phase;
+        start = profilerEnabled ? profileNow() : 0;
+    }
+    ~ScopedTimer() { if (profilerEnabled) recordSample(name, start, profileNow()); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(scopedTimer, __LINE__)(name)
+
+#endif
@@ -0,0 +1,103 @@
+#include "RoomCache.hpp"
+
+// most recently used at the front
+std::list<HotRoom> hotRooms;
+std::list<ColdRoom> coldRooms;
+size_t coldRoomBytes = 0;
+RoomCacheStats roomCacheCounters = {};
+
+RoomKey currentRoomKey()
+{
+    RoomKey key = {(uint32)roomQueue.size(), 14695981039346656037ull};
+    std::stack<int> queue = roomQueue;
+    for (; !queue.empty(); queue.pop()) {
+        key.path ^= (uint64_t)queue.top();
+        key.path *= 1099511628211ull;
+    }
+    return key;
+}
+
+// packs the least recently used hot room
+void coolOldestRoom()
+{
+    HotRoom& hot = hotRooms.back();
+    ColdRoom cold = {hot.key, {}};
+    cold.entities.reserve(hot.objects.size());
+    for (size_t i = 0; i < hot.objects.size(); i++) {
+        cold.entities.push_back(packEntity(hot.objects[i]));
+        delete hot.objects[i];
+    }
+    hotRooms.pop_back();
+
+    coldRoomBytes += cold.entities.size()*sizeof(SnapshotEntity);
+    coldRooms.push_front(std::move(cold));
+
+    // forget the oldest packed rooms once over budget
+    while (coldRoomBytes > ROOM_CACHE_COLD_BYTES && !coldRooms.empty()) {
+        coldRoomBytes -= coldRooms.back().entities.size()*sizeof(SnapshotEntity);
+        coldRooms.pop_back();
+    }
+}
+
+void storeRoom(const RoomKey& key)
+{
+    HotRoom room = {key, {}};
+    room.objects.reserve(gameObjects.size());
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        GameObject * obj = gameObjects[i];
+        // bullets would be frozen mid flight, the player moves on to the next room
+        if (obj->entityType == PLAYER || obj->entityType == PLAYER_BULLET) delete obj;
+        else room.objects.push_back(obj);
+    }
+    gameObjects.clear();
+
+    hotRooms.push_front(std::move(room));
+    if (hotRooms.size() > ROOM_CACHE_HOT) coolOldestRoom();
+}
+
+bool restoreRoom(const RoomKey& key)
+{
+    for (auto room = hotRooms.begin(); room != hotRooms.end(); room++) {
+        if (!(room->key == key)) continue;
+        // pointers move straight back, nothing is copied or allocated per object
+        gameObjects.insert(gameObjects.end(), room->objects.begin(), room->objects.end());
+        hotRooms.erase(room);
+        roomCacheCounters.hotHits++;
+        return true;
+    }
+
+    for (auto room = coldRooms.begin(); room != coldRooms.end(); room++) {
+        if (!(room->key == key)) continue;
+        gameObjects.reserve(gameObjects.size() + room->entities.size());
+        for (size_t i = 0; i < room->entities.size(); i++) gameObjects.push_back(unpackEntity(room->entities[i]));
+        coldRoomBytes -= room->entities.size()*sizeof(SnapshotEntity);
+        coldRooms.erase(room);
+        roomCacheCounters.coldHits++;
+        return true;
+    }
+
+    roomCacheCounters.misses++;
+    return false;
+}
+
+void clearRoomCache()
+{
+    for (HotRoom& room : hotRooms) {
+        for (size_t i = 0; i < room.objects.size(); i++) delete room.objects[i];
+    }
+    hotRooms.clear();
+    coldRooms.clear();
+    coldRoomBytes = 0;
+}
+
+RoomCacheStats roomCacheStats()
+{
+    RoomCacheStats stats = roomCacheCounters;
+    stats.hotBytes = 0;
+    for (HotRoom& room : hotRooms) {
+        stats.hotBytes += sizeof(HotRoom) + room.objects.capacity()*sizeof(GameObject*) +
+            room.objects.size()*sizeof(GameObject);
+    }
+    stats.coldBytes = coldRoomBytes;
+    return stats;
+}
@@ -0,0 +1,52 @@
+#ifndef ROOM_CACHE_HPP
+#define ROOM_CACHE_HPP
+
+/*
+    cache of visited rooms, so walking back through a load zone restores the
+    room as it was left instead of generating a new one
+
+    rooms are keyed by their depth and the path of entry directions that leads
+    to them (the contents of roomQueue). the most recent ROOM_CACHE_HOT rooms
+    keep their live objects, entering one just moves the pointers back into
+    gameObjects. older rooms are packed into SnapshotEntity records and kept
+    until the packed rooms go over ROOM_CACHE_COLD_BYTES.
+
+    bullets aren't kept, the player is respawned at the load zone.
+*/
+
+#include <list>
+
+#define ROOM_CACHE_HOT 8                   // rooms kept as live objects
+#define ROOM_CACHE_COLD_BYTES (512*1024)   // packed rooms kept after that
+
+struct RoomKey {
+    uint32 depth;
+    uint64_t path; // FNV-1a of the directions in roomQueue
+
+    bool operator==(const RoomKey& other) const { return depth == other.depth && path == other.path; }
+};
+
+struct HotRoom {
+    RoomKey key;
+    std::vector<GameObject*> objects;
+};
+
+struct ColdRoom {
+    RoomKey key;
+    std::vector<SnapshotEntity> entities;
+};
+
+struct RoomCacheStats {
+    uint32 hotHits, coldHits, misses;
+    size_t hotBytes, coldBytes;
+};
+
+RoomKey currentRoomKey();
+
+void storeRoom(const RoomKey& key); // moves everything but the player out of gameObjects
+bool restoreRoom(const RoomKey& key); // moves a cached room into gameObjects, false if it isn't cached
+void clearRoomCache();
+
+RoomCacheStats roomCacheStats();
+
+#endif
@@ -1,5 +1,29 @@
 #include "CaveGame.cpp"
+#include "EntityPool.cpp"
+#include "AllocTracker.cpp"
+#include "SaveData.cpp"
+#include "Snapshot.cpp"
+#include "RoomCache.cpp"
+#include "ChunkWorld.cpp"
+#include "SpatialGrid.cpp"
+#include "SpawnPlacement.cpp"
+#include "CaveGenerator.cpp"
+#include "Behaviour.cpp"
+#include "Steering.cpp"
+#include "TimerWheel.cpp"
+#include "Tuning.cpp"
+#include "Controller.cpp"
+#include "Input.cpp"
+#include "Lockstep.cpp"
+#include "SpriteCache.cpp"
+#include "Compositor.cpp"
+#include "Particles.cpp"
+#include "FrameCapture.cpp"
+#include "Telemetry.cpp"
+#include "Logger.cpp"
+#include "Profiler.cpp"
 
+#ifndef HEADLESS // the balance runner has its own main
 int main() {
     int ext = wndMain (
         GetModuleHandle(NULL),
@@ -8,4 +32,5 @@ int main() {
         SW_SHOWDEFAULT);
 
     return ext;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "SaveData.hpp"
+
+// autosave thread
+std::thread autosaveThread;
+std::mutex autosaveMutex;
+std::condition_variable autosaveCV;
+SaveFields pendingSave, lastSave; // guarded by autosaveMutex
+bool savePending = false, autosaveRunning = false;
+
+uint32 saveChecksum(const void * data, size_t size)
+{
+    const uint8 * bytes = (const uint8*)data;
+    uint32 hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int readSaveFile(SaveFields * fields)
+{
+    FILE* file = fopen(SAVE_FILE, "rb");
+    if (!file) return -1;
+
+    SaveHeader header;
+    uint8 payload[256];
+    int res = -1;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == SAVE_MAGIC && header.version >= 1 && header.version <= SAVE_VERSION &&
+        header.size <= sizeof(payload) &&
+        fread(payload, 1, header.size, file) == header.size &&
+        saveChecksum(payload, header.size) == header.checksum)
+    {
+        // older versions are missing trailing fields, those keep whatever fields already held
+        memcpy(fields, payload, MIN(sizeof(SaveFields), (size_t)header.size));
+        res = 0;
+    }
+
+    fclose(file);
+    return res;
+}
+
+int writeSaveFile(const SaveFields& fields)
+{
+    SaveHeader header = {SAVE_MAGIC, SAVE_VERSION, sizeof(SaveFields), saveChecksum(&fields, sizeof(SaveFields))};
+
+    FILE* file = fopen(SAVE_TEMP_FILE, "wb");
+    if (!file) return -1;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(&fields, sizeof(fields), 1, file) == 1 &&
+              fflush(file) == 0;
+    if (fclose(file) != 0) ok = false;
+
+    // swap the finished file in, the old save is untouched if anything failed
+    if (!ok || !MoveFileExA(SAVE_TEMP_FILE, SAVE_FILE, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(SAVE_TEMP_FILE);
+        return -1;
+    }
+    return 0;
+}
+
+int importLegacySave(SaveFields * fields)
+{
+    // txt file, tab separated:
+    // flashRange   flashWidth  initialBullets  initialCharge   gemsSaved
+    FILE* file = fopen(LEGACY_SAVE_FILE, "r");
+    if (!file) return -1;
+
+    SaveFields read = *fields;
+    int n = fscanf(file, "%f\t%f\t%u\t%f\t%u",
+        &read.flashRange, &read.flashWidth,
+        &read.initialBullets, &read.maxCharge, &read.gemsSaved);
+    fclose(file);
+
+    if (n != 5) return -1;
+    *fields = read;
+    return 0;
+}
+
+SaveFields collectSaveFields()
+{
+    return SaveFields {flashRange, flashWidth, initialBullets, maxCharge, gemsSaved};
+}
+
+void applySaveFields(const SaveFields& fields)
+{
+    flashRange = fields.flashRange;
+    flashWidth = fields.flashWidth;
+    initialBullets = fields.initialBullets;
+    maxCharge = fields.maxCharge;
+    gemsSaved = fields.gemsSaved;
+}
+
+void startAutosave()
+{
+    lastSave = collectSaveFields();
+    autosaveRunning = true;
+
+    autosaveThread = std::thread([]() {
+        std::unique_lock<std::mutex> lock(autosaveMutex);
+        while (true) {
+            autosaveCV.wait(lock, []() { return savePending || !autosaveRunning; });
+            if (savePending) {
+                SaveFields fields = pendingSave;
+                savePending = false;
+                // write without holding the lock, the game thread only ever waits on a memcpy
+                lock.unlock();
+                if (writeSaveFile(fields) != 0) LOG_WARN("autosave failed", "file", SAVE_FILE);
+                lock.lock();
+            } else return; // stopped with nothing left to write
+        }
+    });
+}
+
+void requestAutosave()
+{
+    SaveFields fields = collectSaveFields();
+    {
+        std::lock_guard<std::mutex> lock(autosaveMutex);
+        if (!autosaveRunning || memcmp(&fields, &lastSave, sizeof(SaveFields)) == 0) return;
+        pendingSave = lastSave = fields;
+        savePending = true;
+    }
+    autosaveCV.notify_one();
+}
+
+void stopAutosave()
+{
+    {
+        std::lock_guard<std::mutex> lock(autosaveMutex);
+        autosaveRunning = false;
+    }
+    autosaveCV.notify_one();
+    if (autosaveThread.joinable()) autosaveThread.join();
+}
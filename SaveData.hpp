@@ -0,0 +1,60 @@
+#ifndef SAVE_DATA_HPP
+#define SAVE_DATA_HPP
+
+/*
+    versioned binary save for player progression
+
+    file layout:
+        SaveHeader  magic, version, size of the payload, checksum of the payload
+        SaveFields  the payload, fields are only ever appended so older saves stay readable
+
+    saves are written to a temp file then renamed over the old one, so a crash
+    mid write never leaves a half written save behind.
+*/
+
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define SAVE_FILE "playerData.sav"
+#define SAVE_TEMP_FILE "playerData.sav.tmp"
+#define LEGACY_SAVE_FILE "playerData.txt" // tab separated save from before the binary format
+
+#define SAVE_MAGIC 0x45564143 // "CAVE"
+#define SAVE_VERSION 1
+
+#define AUTOSAVE_INTERVAL 10.0f // seconds between autosave checks
+
+struct SaveHeader {
+    uint32 magic;
+    uint16 version;
+    uint16 size;     // bytes of payload following the header
+    uint32 checksum; // FNV-1a of the payload
+};
+
+// version 1 fields
+struct SaveFields {
+    float flashRange;
+    float flashWidth;
+    uint32 initialBullets;
+    float maxCharge;
+    uint32 gemsSaved;
+};
+
+// file io
+uint32 saveChecksum(const void * data, size_t size);
+int readSaveFile(SaveFields * fields);
+int writeSaveFile(const SaveFields& fields);
+int importLegacySave(SaveFields * fields);
+
+// globals <-> save fields
+SaveFields collectSaveFields();
+void applySaveFields(const SaveFields& fields);
+
+// background autosave, writes never block the frame
+void startAutosave();
+void requestAutosave(); // queue a save if progression changed since the last one
+void stopAutosave();    // finishes any queued save before returning
+
+#endif
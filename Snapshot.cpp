@@ -0,0 +1,176 @@
+#include "Snapshot.hpp"
+
+SnapshotEntity packEntity(const GameObject * obj)
+{
+    return SnapshotEntity {obj->pos.x, obj->pos.y, obj->velocity.x, obj->velocity.y, obj->moveSpeed,
+        obj->health, (int16_t)obj->size[0], (int16_t)obj->size[1], (uint8)obj->entityType, obj->behaviour, obj->id};
+}
+
+GameObject * unpackEntity(const SnapshotEntity& e)
+{
+    GameObject * obj = new GameObject(*entityInfo(e.entityType).sprite, e.health, e.x, e.y,
+        e.moveSpeed, e.entityType, (int)e.width, (int)e.height);
+    obj->velocity = Vector2 {e.velX, e.velY};
+    obj->behaviour = e.behaviour & 7;
+    if (e.id) obj->id = e.id;
+    return obj;
+}
+
+SnapshotState packState()
+{
+    SnapshotState state = {};
+    state.timer = timer;
+    state.rngState = rngState;
+    state.numGems = numGems;
+    state.numBullets = numBullets;
+    state.pauseState = pauseState;
+    state.gameIsPaused = gameIsPaused;
+    state.flashlightOn = flashlightOn;
+    state.nextEntityId = nextEntityId;
+    state.flashLightCharge = flashLightCharge;
+    state.ambientLightPercent = ambientLightPercent;
+    state.flashlightBrightness = flashlightBrightness;
+    state.aimX = playerToMouse.x; state.aimY = playerToMouse.y;
+    return state;
+}
+
+void unpackState(const SnapshotState& state)
+{
+    timer = state.timer;
+    rngState = state.rngState;
+    numGems = state.numGems;
+    numBullets = state.numBullets;
+    pauseState = state.pauseState;
+    gameIsPaused = state.gameIsPaused;
+    flashlightOn = state.flashlightOn;
+    nextEntityId = state.nextEntityId;
+    flashLightCharge = state.flashLightCharge;
+    ambientLightPercent = state.ambientLightPercent;
+    flashlightBrightness = state.flashlightBrightness;
+    playerToMouse = Vector2 {state.aimX, state.aimY};
+}
+
+void serialiseSnapshot(std::vector<uint8>& buffer)
+{
+    // roomQueue is a stack, copy it out bottom first
+    std::vector<int32_t> rooms(roomQueue.size());
+    std::stack<int> queue = roomQueue;
+    for (size_t i = rooms.size(); i-- > 0; queue.pop()) rooms[i] = queue.top();
+
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(SnapshotState),
+        (uint32)rooms.size(), (uint32)gameObjects.size(), 0};
+
+    SnapshotState state = packState();
+
+    // one allocation, then straight copies into it
+    size_t bodySize = sizeof(state) + rooms.size()*sizeof(int32_t) + gameObjects.size()*sizeof(SnapshotEntity);
+    buffer.resize(sizeof(header) + bodySize);
+    uint8 * body = buffer.data() + sizeof(header);
+    uint8 * out = body;
+
+    memcpy(out, &state, sizeof(state)); out += sizeof(state);
+    memcpy(out, rooms.data(), rooms.size()*sizeof(int32_t)); out += rooms.size()*sizeof(int32_t);
+
+    SnapshotEntity * entities = (SnapshotEntity*)out;
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        entities[i] = packEntity(gameObjects[i]);
+    }
+
+    header.checksum = saveChecksum(body, bodySize);
+    memcpy(buffer.data(), &header, sizeof(header));
+}
+
+int restoreSnapshot(const uint8 * data, size_t size)
+{
+    // validate everything before touching the current run
+    if (size < sizeof(SnapshotHeader)) return -1;
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.stateSize != sizeof(SnapshotState)) return -1;
+
+    size_t bodySize = sizeof(SnapshotState) + (size_t)header.roomCount*sizeof(int32_t) +
+        (size_t)header.entityCount*sizeof(SnapshotEntity);
+    if (size - sizeof(header) != bodySize) return -1;
+    const uint8 * in = data + sizeof(header);
+    if (saveChecksum(in, bodySize) != header.checksum) return -1;
+
+    SnapshotState state;
+    memcpy(&state, in, sizeof(state)); in += sizeof(state);
+
+    const int32_t * rooms = (const int32_t*)in;
+    in += header.roomCount*sizeof(int32_t);
+
+    // exactly one player is needed to resume
+    const SnapshotEntity * entities = (const SnapshotEntity*)in;
+    int players = 0;
+    for (uint32 i = 0; i < header.entityCount; i++) {
+        if (entities[i].entityType <= 0 || entities[i].entityType >= NUM_ENTITY_TYPES) return -1;
+        players += entities[i].entityType == PLAYER;
+    }
+    if (players != 1) return -1;
+
+    // globals
+    unpackState(state);
+
+    while (!roomQueue.empty()) roomQueue.pop();
+    clearRoomCache(); // cached rooms belong to the run being replaced
+    for (uint32 i = 0; i < header.roomCount; i++) roomQueue.push(rooms[i]);
+
+    // entities
+    for (size_t i = 0; i < gameObjects.size(); i++) delete gameObjects[i];
+    gameObjects.clear();
+    gameObjects.reserve(header.entityCount);
+
+    for (uint32 i = 0; i < header.entityCount; i++) {
+        SnapshotEntity e;
+        memcpy(&e, &entities[i], sizeof(e)); // mapping might not be aligned for floats
+        GameObject * obj = unpackEntity(e);
+        gameObjects.push_back(obj);
+        if (e.entityType == PLAYER) player = obj;
+    }
+    resetBehaviours();
+    resetTimers();
+    return 0;
+}
+
+int saveSnapshot(const char * path)
+{
+    std::vector<uint8> buffer;
+    serialiseSnapshot(buffer);
+
+    // same temp file + rename as the progression save
+    std::string temp = std::string(path) + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return -1;
+    bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok || !MoveFileExA(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(temp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int loadSnapshot(const char * path)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return -1;
+
+    int res = -1;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            const uint8 * view = (const uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view) {
+                res = restoreSnapshot(view, (size_t)size.QuadPart);
+                UnmapViewOfFile(view);
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return res;
+}
@@ -0,0 +1,78 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+/*
+    snapshot of a whole run, used to resume after quitting and as fixtures for
+    benchmarks and bug reproductions
+
+    file layout:
+        SnapshotHeader      magic, version, counts, checksum of everything after the header
+        SnapshotState       globals: timer, inventory, flashlight, rng state
+        int32[roomCount]    roomQueue, bottom of the stack first
+        SnapshotEntity[entityCount]
+
+    loading maps the file and restores straight out of the mapping.
+*/
+
+#include <vector>
+
+#define RUN_SNAPSHOT_FILE "run.snap"     // written on exit when a run is in progress
+#define QUICK_SNAPSHOT_FILE "quick.snap" // F5 saves, F9 loads
+
+#define SNAPSHOT_MAGIC 0x50414E53 // "SNAP"
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader {
+    uint32 magic;
+    uint16 version;
+    uint16 stateSize;    // sizeof(SnapshotState) when written
+    uint32 roomCount;
+    uint32 entityCount;
+    uint32 checksum;     // FNV-1a of everything after the header
+};
+
+struct SnapshotState {
+    // run
+    float timer;
+    uint32 rngState;
+    uint32 numGems;
+    uint32 numBullets;
+    int32_t pauseState;
+    uint8 gameIsPaused;
+    // flashlight
+    uint8 flashlightOn;
+    uint16 nextEntityId;
+    float flashLightCharge;
+    float ambientLightPercent;
+    float flashlightBrightness;
+    float aimX, aimY; // playerToMouse
+};
+
+struct SnapshotEntity {
+    float x, y;
+    float velX, velY;
+    float moveSpeed;
+    int32_t health;
+    int16_t width, height;
+    uint8 entityType;
+    uint8 behaviour; // step of enemyBehaviour, 0 and 1 were the idle flag
+    uint16 id;       // GameObject::id, 0 for a new entity (and in files from before ids)
+};
+
+// entity records, also used by the room cache
+SnapshotEntity packEntity(const GameObject * obj);
+GameObject * unpackEntity(const SnapshotEntity& e);
+
+// the run's globals, also used by lockstep rollback
+SnapshotState packState();
+void unpackState(const SnapshotState& state);
+
+// serialisation, restoring replaces the current run
+void serialiseSnapshot(std::vector<uint8>& buffer);
+int restoreSnapshot(const uint8 * data, size_t size);
+
+// files
+int saveSnapshot(const char * path);
+int loadSnapshot(const char * path); // memory maps the file
+
+#endif
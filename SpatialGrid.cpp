@@ -0,0 +1,113 @@
+#include "SpatialGrid.hpp"
+
+SpatialGrid spatialGrid;
+WallIndex wallIndex;
+
+uint32 cellHash(int cx, int cy)
+{
+    return ((uint32)cx * 73856093u) ^ ((uint32)cy * 19349663u);
+}
+
+int gridBucket(int cx, int cy)
+{
+    return int(cellHash(cx, cy) & uint32(spatialGrid.bucketCount-1));
+}
+
+WallShape wallShape(GameObject * obj)
+{
+    int l = (int)obj->pos.x, t = (int)obj->pos.y;
+    return WallShape {obj, l, t, l+obj->size[0], t+obj->size[1], 0, 0, 0, 0};
+}
+
+bool sameWall(const WallShape& a, const WallShape& b)
+{
+    return a.obj == b.obj && a.l == b.l && a.t == b.t && a.r == b.r && a.b == b.b;
+}
+
+// indexes index.found, the walls gameObjects has now
+void buildWallIndex()
+{
+    PROFILE_SCOPE("buildWallIndex");
+    WallIndex& index = wallIndex;
+    index.shapes.swap(index.found);
+
+    int cells = 0;
+    for (WallShape& wall : index.shapes) {
+        wall.cx0 = (int)floorf((float)wall.l / GRID_CELL_SIZE);
+        wall.cy0 = (int)floorf((float)wall.t / GRID_CELL_SIZE);
+        wall.cx1 = (int)floorf((float)(wall.r-1) / GRID_CELL_SIZE);
+        wall.cy1 = (int)floorf((float)(wall.b-1) / GRID_CELL_SIZE);
+        if (wall.r > wall.l && wall.b > wall.t) cells += (wall.cx1-wall.cx0+1) * (wall.cy1-wall.cy0+1);
+    }
+    index.bucketCount = GRID_MIN_BUCKETS;
+    while (index.bucketCount < GRID_BUCKETS && index.bucketCount < 2*cells) index.bucketCount *= 2;
+    index.bucketStart.assign(index.bucketCount+1, 0);
+    index.entries.resize(cells);
+
+    // count entries per bucket, prefix sum into offsets, then place
+    auto eachCell = [&index](auto func) {
+        for (int w = 0; w < (int)index.shapes.size(); w++) {
+            const WallShape& wall = index.shapes[w];
+            if (wall.r <= wall.l || wall.b <= wall.t) continue;
+            for (int cy = wall.cy0; cy <= wall.cy1; cy++) {
+                for (int cx = wall.cx0; cx <= wall.cx1; cx++) func(WallEntry {w, cx, cy}, int(cellHash(cx, cy) & uint32(index.bucketCount-1)));
+            }
+        }
+    };
+    eachCell([&index](WallEntry entry, int bucket) { index.bucketStart[bucket+1]++; });
+    for (int b = 0; b < index.bucketCount; b++) index.bucketStart[b+1] += index.bucketStart[b];
+    index.cursor.assign(index.bucketStart.begin(), index.bucketStart.end()-1);
+    eachCell([&index](WallEntry entry, int bucket) { index.entries[index.cursor[bucket]++] = entry; });
+}
+
+void buildSpatialGrid()
+{
+    PROFILE_SCOPE("buildSpatialGrid");
+    SpatialGrid& grid = spatialGrid;
+    WallIndex& index = wallIndex;
+
+    // walls are checked against the index, everything else goes in with its cell
+    grid.unsorted.clear();
+    size_t walls = 0;
+    bool wallsChanged = index.bucketStart.empty();
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        GameObject * obj = gameObjects[i];
+        if (obj->entityType == WALL) {
+            wallsChanged = wallsChanged || walls >= index.shapes.size() || !sameWall(wallShape(obj), index.shapes[walls]);
+            walls++;
+            continue;
+        }
+        grid.unsorted.push_back(GridEntry {obj,
+            (int)floorf((obj->pos.x + obj->size[0]/2) / GRID_CELL_SIZE),
+            (int)floorf((obj->pos.y + obj->size[1]/2) / GRID_CELL_SIZE)});
+    }
+    if (wallsChanged || walls != index.shapes.size()) {
+        index.found.clear();
+        for (GameObject * obj : gameObjects) if (obj->entityType == WALL) index.found.push_back(wallShape(obj));
+        buildWallIndex();
+    }
+
+    // small rooms, one bucket (any query covers it, so cells aren't needed)
+    int count = (int)grid.unsorted.size();
+    if (count < GRID_MIN_OBJECTS) {
+        grid.bucketCount = 1;
+        grid.bucketStart.assign({0, count});
+        grid.entries.assign(grid.unsorted.begin(), grid.unsorted.end());
+        return;
+    }
+
+    grid.bucketCount = GRID_MIN_BUCKETS;
+    while (grid.bucketCount < GRID_BUCKETS && grid.bucketCount < 2*count) grid.bucketCount *= 2;
+    grid.bucketStart.assign(grid.bucketCount+1, 0);
+    grid.entries.resize(count);
+
+    // count objects per bucket
+    for (const GridEntry& entry : grid.unsorted) grid.bucketStart[gridBucket(entry.cx, entry.cy)+1]++;
+    // prefix sum into offsets, then place
+    for (int b = 0; b < grid.bucketCount; b++) grid.bucketStart[b+1] += grid.bucketStart[b];
+    grid.cursor.assign(grid.bucketStart.begin(), grid.bucketStart.end()-1);
+    for (size_t i = 0; i < grid.unsorted.size(); i++) {
+        const GridEntry& entry = grid.unsorted[i];
+        grid.entries[grid.cursor[gridBucket(entry.cx, entry.cy)]++] = entry;
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef SPATIAL_GRID_HPP
+#define SPATIAL_GRID_HPP
+
+/*
+    broadphase over gameObjects
+
+    rebuilt twice per tick, after dead objects are removed and again for
+    handleCollisions once everything has moved, by counting sort of
+    object centres into a hashed grid of GRID_CELL_SIZE cells, so building
+    doesn't allocate once the buffers have grown. queries visit every object
+    whose centre is in a cell touching the query area, callers do the exact
+    test. objects are only indexed by their centre, so walls aren't in it.
+
+    the bucket count follows the number of objects (up to GRID_BUCKETS), so a
+    normal room isn't paying to clear and scan thousands of empty buckets.
+    under GRID_MIN_OBJECTS everything goes in one bucket and queries are a
+    plain scan.
+
+    walls have an index of their own, every cell a wall covers has an entry
+    for it. walls never move, so it is only rebuilt when buildSpatialGrid
+    finds the room's walls aren't the ones it was built from (a new room,
+    a restored one, chunks coming and going). queryWalls visits each wall
+    overlapping a box once.
+*/
+
+#define GRID_CELL_SIZE 128
+#define GRID_BUCKETS 4096 // most buckets, must be a power of 2
+#define GRID_MIN_BUCKETS 16
+#define GRID_MIN_OBJECTS 64
+
+struct GridEntry {
+    GameObject * obj;
+    int cx, cy; // cell when the grid was built
+};
+
+// a wall as the index saw it, in whole pixels like handleCollisions
+struct WallShape {
+    GameObject * obj;
+    int l, t, r, b;
+    int cx0, cy0, cx1, cy1; // cells it covers
+};
+
+struct WallEntry {
+    int wall; // into WallIndex::shapes
+    int cx, cy;
+};
+
+struct WallIndex {
+    int bucketCount;
+    std::vector<int> bucketStart;   // bucketCount+1 offsets into entries
+    std::vector<WallEntry> entries; // a wall per cell it covers, ordered by bucket
+    std::vector<int> cursor;        // write position per bucket while building
+    std::vector<WallShape> shapes;  // gameObjects order
+    std::vector<WallShape> found;   // the walls in gameObjects while building
+};
+
+struct SpatialGrid {
+    int bucketCount;                 // power of 2, about twice the number of objects
+    std::vector<int> bucketStart;    // bucketCount+1 offsets into entries
+    std::vector<GridEntry> entries;  // objects ordered by bucket
+    std::vector<GridEntry> unsorted; // entries in gameObjects order while building
+    std::vector<int> cursor;         // write position per bucket while building
+};
+
+extern SpatialGrid spatialGrid;
+extern WallIndex wallIndex;
+
+uint32 cellHash(int cx, int cy);
+int gridBucket(int cx, int cy);
+void buildSpatialGrid(); // and the wall index when the walls have changed
+
+// calls func(GameObject*) for objects whose centre is in a cell touching the
+// square of half width radius around (x, y)
+template <typename Func> void queryRadius(float x, float y, float radius, Func func)
+{
+    SpatialGrid& grid = spatialGrid;
+    if (grid.bucketStart.empty()) return;
+
+    int cx0 = (int)floorf((x-radius) / GRID_CELL_SIZE), cx1 = (int)floorf((x+radius) / GRID_CELL_SIZE);
+    int cy0 = (int)floorf((y-radius) / GRID_CELL_SIZE), cy1 = (int)floorf((y+radius) / GRID_CELL_SIZE);
+
+    // a big query covers buckets more than once, fall back to visiting every bucket once
+    if ((cx1-cx0+1)*(cy1-cy0+1) >= grid.bucketCount) {
+        for (size_t i = 0; i < grid.entries.size(); i++) func(grid.entries[i].obj);
+        return;
+    }
+
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int b = gridBucket(cx, cy);
+            for (int i = grid.bucketStart[b]; i < grid.bucketStart[b+1]; i++) {
+                // the bucket can hold other cells that hashed to it
+                const GridEntry& entry = grid.entries[i];
+                if (entry.cx == cx && entry.cy == cy) func(entry.obj);
+            }
+        }
+    }
+}
+
+// calls func(const WallShape&) for each wall overlapping the box [l, r) x [t, b),
+// until it returns true
+template <typename Func> void queryWalls(int l, int t, int r, int b, Func func)
+{
+    WallIndex& index = wallIndex;
+    if (index.bucketStart.empty() || r <= l || b <= t) return;
+
+    int cx0 = (int)floorf((float)l / GRID_CELL_SIZE), cx1 = (int)floorf((float)(r-1) / GRID_CELL_SIZE);
+    int cy0 = (int)floorf((float)t / GRID_CELL_SIZE), cy1 = (int)floorf((float)(b-1) / GRID_CELL_SIZE);
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int bucket = int(cellHash(cx, cy) & uint32(index.bucketCount-1));
+            for (int i = index.bucketStart[bucket]; i < index.bucketStart[bucket+1]; i++) {
+                const WallEntry& entry = index.entries[i];
+                if (entry.cx != cx || entry.cy != cy) continue;
+                const WallShape& wall = index.shapes[entry.wall];
+                // a wall over several of the box's cells is visited from the first of them
+                if (cx != MAX(cx0, wall.cx0) || cy != MAX(cy0, wall.cy0)) continue;
+                if (r <= wall.l || l >= wall.r || b <= wall.t || t >= wall.b) continue;
+                if (func(wall)) return;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include "SpawnPlacement.hpp"
+
+SpawnMask spawnMask;
+
+int spawnRandomInt(SpawnMask& mask)
+{
+    if (!mask.rng) return randomInt();
+    uint32& state = *mask.rng;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return int(state >> 1);
+}
+
+float spawnRandom(SpawnMask& mask) // 0 - 1
+{
+    return float(spawnRandomInt(mask) & 0xffffff) / 16777216.0f;
+}
+
+void beginSpawnArea(SpawnMask& mask, float x, float y, uint32 * rng)
+{
+    mask.originX = x; mask.originY = y;
+    mask.left = x + SPAWN_EDGE_MARGIN; mask.top = y + SPAWN_EDGE_MARGIN;
+    mask.right = x + float(bkgWidth-SPAWN_EDGE_MARGIN); mask.bottom = y + float(bkgHeight-SPAWN_EDGE_MARGIN);
+    mask.cols = bkgWidth/SPAWN_MASK_CELL + 1;
+    mask.rows = bkgHeight/SPAWN_MASK_CELL + 1;
+    mask.blocked.assign(mask.cols*mask.rows, 0);
+    mask.rng = rng;
+}
+
+void beginSpawnPlacement()
+{
+    // the room inside the border walls
+    beginSpawnArea(spawnMask, 0.0f, 0.0f, nullptr);
+
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        GameObject * obj = gameObjects[i];
+        if (obj->entityType == PLAYER) {
+            blockSpawnArea(spawnMask, obj->pos.x-SPAWN_PLAYER_CLEARANCE, obj->pos.y-SPAWN_PLAYER_CLEARANCE,
+                obj->size[0]+2*SPAWN_PLAYER_CLEARANCE, obj->size[1]+2*SPAWN_PLAYER_CLEARANCE);
+        } else blockSpawnArea(spawnMask, obj->pos.x, obj->pos.y, obj->size[0], obj->size[1]); // walls, and items and enemies already there
+    }
+}
+
+// cells touched by a rectangle, clamped to the mask
+void spawnCells(const SpawnMask& mask, float x, float y, float w, float h, int * c0, int * r0, int * c1, int * r1)
+{
+    x -= mask.originX; y -= mask.originY;
+    *c0 = MAX((int)floorf(x / SPAWN_MASK_CELL), 0);
+    *r0 = MAX((int)floorf(y / SPAWN_MASK_CELL), 0);
+    *c1 = MIN((int)floorf((x+w-1.0f) / SPAWN_MASK_CELL), mask.cols-1);
+    *r1 = MIN((int)floorf((y+h-1.0f) / SPAWN_MASK_CELL), mask.rows-1);
+}
+
+void blockSpawnArea(SpawnMask& mask, float x, float y, float w, float h)
+{
+    int c0, r0, c1, r1;
+    spawnCells(mask, x, y, w, h, &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) mask.blocked[r*mask.cols + c] = 1;
+    }
+}
+
+bool spawnAreaFree(const SpawnMask& mask, float x, float y, float w, float h)
+{
+    if (x < mask.left || y < mask.top || x+w > mask.right || y+h > mask.bottom) return false;
+
+    int c0, r0, c1, r1;
+    spawnCells(mask, x, y, w, h, &c0, &r0, &c1, &r1);
+    for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+            if (mask.blocked[r*mask.cols + c]) return false;
+        }
+    }
+    return true;
+}
+
+void sampleSpawnPoints(SpawnMask& mask, float spacing, std::vector<Vector2>& points)
+{
+    points.clear();
+    float width = mask.right-mask.left, height = mask.bottom-mask.top;
+    if (mask.blocked.empty() || width <= 0.0f || height <= 0.0f) return;
+
+    // background grid, a cell holds at most one point
+    float cellSize = spacing / sqrtf(2.0f);
+    int cols = (int)ceilf(width / cellSize), rows = (int)ceilf(height / cellSize);
+    std::vector<int> grid(cols*rows, -1);
+    std::vector<int> active;
+
+    // a point is kept if it isn't masked and has no point within spacing
+    auto tryPoint = [&](float x, float y) {
+        if (x < mask.left || y < mask.top || x >= mask.right || y >= mask.bottom) return false;
+        if (!spawnAreaFree(mask, x, y, 1.0f, 1.0f)) return false;
+
+        int gx = int((x-mask.left) / cellSize), gy = int((y-mask.top) / cellSize);
+        for (int ny = (MAX(gy-2, 0)); ny <= (MIN(gy+2, rows-1)); ny++) {
+            for (int nx = (MAX(gx-2, 0)); nx <= (MIN(gx+2, cols-1)); nx++) {
+                int other = grid[ny*cols + nx];
+                if (other < 0) continue;
+                float dx = points[other].x-x, dy = points[other].y-y;
+                if (dx*dx + dy*dy < spacing*spacing) return false;
+            }
+        }
+        grid[gy*cols + gx] = (int)points.size();
+        active.push_back((int)points.size());
+        points.push_back(Vector2 {x, y});
+        return true;
+    };
+
+    // walls can cut the room into pieces, so keep seeding until the seeds stop landing
+    for (int seed = 0; seed < SPAWN_CANDIDATES; seed++) {
+        if (!tryPoint(mask.left + spawnRandom(mask)*width, mask.top + spawnRandom(mask)*height)) continue;
+
+        while (!active.empty()) {
+            int a = spawnRandomInt(mask) % (int)active.size();
+            Vector2 centre = points[active[a]];
+
+            bool found = false;
+            for (int k = 0; k < SPAWN_CANDIDATES && !found; k++) {
+                // somewhere in the annulus spacing - 2*spacing around the active point
+                float angle = spawnRandom(mask) * 6.2831853f;
+                float dist = spacing * (1.0f + spawnRandom(mask));
+                found = tryPoint(centre.x + cosf(angle)*dist, centre.y + sinf(angle)*dist);
+            }
+            if (!found) { // nothing fits around it any more
+                active[a] = active.back();
+                active.pop_back();
+            }
+        }
+    }
+
+    // shuffle so taking the first few doesn't cluster around a seed
+    for (int i = (int)points.size()-1; i > 0; i--) std::swap(points[i], points[spawnRandomInt(mask) % (i+1)]);
+}
+
+bool takeSpawnPoint(SpawnMask& mask, std::vector<Vector2>& points, float w, float h, Vector2 * pos)
+{
+    for (size_t i = 0; i < points.size(); i++) {
+        float x = points[i].x - w/2.0f, y = points[i].y - h/2.0f;
+        if (!spawnAreaFree(mask, x, y, w, h)) continue;
+
+        blockSpawnArea(mask, x, y, w, h);
+        points[i] = points.back();
+        points.pop_back();
+        *pos = Vector2 {x, y};
+        return true;
+    }
+    return false;
+}
+
+int placeSpawns(SpawnMask& mask, int n, float w, float h, float spacing, std::vector<Vector2>& positions)
+{
+    positions.clear();
+    std::vector<Vector2> points;
+    // a crowded area gets sampled again with closer points, but never closer than the object
+    float minSpacing = MAX(w, h);
+    for (spacing = MAX(spacing, minSpacing); (int)positions.size() < n; spacing = MAX(spacing/2.0f, minSpacing)) {
+        sampleSpawnPoints(mask, spacing, points);
+        Vector2 pos;
+        while ((int)positions.size() < n && takeSpawnPoint(mask, points, w, h, &pos)) positions.push_back(pos);
+        if (spacing <= minSpacing) break;
+    }
+    return (int)positions.size();
+}
@@ -0,0 +1,55 @@
+#ifndef SPAWN_PLACEMENT_HPP
+#define SPAWN_PLACEMENT_HPP
+
+/*
+    where items and enemies are put when a room is made
+
+    beginSpawnPlacement() marks everything in the room (walls, and any items
+    and enemies already there) and the space around the player in an
+    occupancy mask of SPAWN_MASK_CELL cells. spawn points are
+    then drawn by Bridson's poisson disk sampling over the unmasked part of
+    the room interior: points are at least the given spacing apart, and
+    every placed object's footprint is masked so later objects (of any
+    kind) can't overlap it.
+
+    everything is bounded, sampling tries SPAWN_CANDIDATES points around
+    each accepted point and SPAWN_CANDIDATES seeds for areas cut off by
+    walls. if a room fills up fewer objects are placed instead of looping.
+
+    large cave chunks are placed the same way with a mask of their own and
+    their own xorshift state, they're generated on the streaming thread and
+    mustn't touch the room's mask or the simulation's randomInt().
+*/
+
+#define SPAWN_MASK_CELL 10          // mask resolution in pixels
+#define SPAWN_EDGE_MARGIN 100       // objects stay this far inside the area, rooms have their border walls there
+#define SPAWN_CANDIDATES 30         // bridson's k
+#define SPAWN_PLAYER_CLEARANCE 100  // nothing spawns this close to the player
+#define SPAWN_ITEM_SPACING 80.0f
+#define SPAWN_ENEMY_SPACING 120.0f
+
+struct SpawnMask {
+    float originX, originY;         // world position of the first cell
+    float left, top, right, bottom; // area objects have to fit in
+    int cols, rows;
+    std::vector<uint8> blocked;
+    uint32 * rng; // xorshift state to draw from, null for randomInt()
+};
+
+extern SpawnMask spawnMask; // the room's
+
+// clears mask over a background sized area with its top left at x, y
+void beginSpawnArea(SpawnMask& mask, float x, float y, uint32 * rng);
+int spawnRandomInt(SpawnMask& mask); // from the mask's rng, 0 - INT_MAX
+void beginSpawnPlacement(); // the room's mask, with everything currently in gameObjects
+void blockSpawnArea(SpawnMask& mask, float x, float y, float w, float h);
+bool spawnAreaFree(const SpawnMask& mask, float x, float y, float w, float h);
+
+// poisson disk points (centres) over the free area, in random order
+void sampleSpawnPoints(SpawnMask& mask, float spacing, std::vector<Vector2>& points);
+// takes the first point a w*h object fits at, masks it and gives its top left corner
+bool takeSpawnPoint(SpawnMask& mask, std::vector<Vector2>& points, float w, float h, Vector2 * pos);
+// up to n top left corners for w*h objects, packs tighter than spacing if the area is crowded
+int placeSpawns(SpawnMask& mask, int n, float w, float h, float spacing, std::vector<Vector2>& positions);
+
+#endif
@@ -0,0 +1,176 @@
+#include "SpriteCache.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SPRITE_SSE2
+#endif
+
+struct CachedSprite {
+    SpriteSurface surface;
+    std::list<SpriteKey>::iterator order;
+};
+
+std::unordered_map<SpriteKey, CachedSprite, SpriteKeyHash> spriteCache;
+std::list<SpriteKey> spriteCacheOrder; // least recently drawn first
+size_t spriteCacheBytes = 0;
+std::atomic<uint64_t> spriteBlits {0}, spritePixels {0};
+std::atomic<int64_t> spriteBlitNanoseconds {0};
+
+void freeSurface(SpriteSurface& surface)
+{
+    ::operator delete(surface.pixels, std::align_val_t(SPRITE_ALIGN));
+    surface.pixels = nullptr;
+}
+
+void clearSpriteCache()
+{
+    for (auto& entry : spriteCache) freeSurface(entry.second.surface);
+    spriteCache.clear();
+    spriteCacheOrder.clear();
+    spriteCacheBytes = 0;
+}
+
+void trimSpriteCache()
+{
+    while (spriteCacheBytes > SPRITE_CACHE_MAX_BYTES) {
+        auto oldest = spriteCache.find(spriteCacheOrder.front());
+        SpriteSurface& surface = oldest->second.surface;
+        spriteCacheBytes -= (size_t)surface.stride * surface.height * 4;
+        freeSurface(surface);
+        spriteCache.erase(oldest);
+        spriteCacheOrder.pop_front();
+    }
+}
+
+// scales image into a new surface with GDI+, then copies it into aligned rows
+bool buildSurface(Gdiplus::Image * image, int width, int height, SpriteSurface * surface)
+{
+    Gdiplus::Bitmap scaled(width, height, PixelFormat32bppPARGB);
+    {
+        Gdiplus::Graphics graphics(&scaled);
+        graphics.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+        graphics.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHighQuality);
+        if (graphics.DrawImage(image, 0, 0, width, height) != Gdiplus::Ok) return false;
+    }
+
+    Gdiplus::Rect rect(0, 0, width, height);
+    Gdiplus::BitmapData data;
+    if (scaled.LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat32bppPARGB, &data) != Gdiplus::Ok) return false;
+
+    int rowAlign = SPRITE_ALIGN/4;
+    surface->width = width; surface->height = height;
+    surface->stride = (width + rowAlign-1) / rowAlign * rowAlign;
+    size_t bytes = (size_t)surface->stride * height * 4;
+    surface->pixels = static_cast<uint32*>(::operator new(bytes, std::align_val_t(SPRITE_ALIGN)));
+    memset(surface->pixels, 0, bytes); // padding is transparent
+    for (int y = 0; y < height; y++) {
+        memcpy(surface->pixels + (size_t)y*surface->stride, (const uint8*)data.Scan0 + (ptrdiff_t)y*data.Stride, width*4);
+    }
+    scaled.UnlockBits(&data);
+    return true;
+}
+
+const SpriteSurface * spriteSurface(Gdiplus::Image * image, int width, int height)
+{
+    if (!image || width <= 0 || height <= 0) return nullptr;
+    SpriteKey key = {image, width, height};
+    auto found = spriteCache.find(key);
+    if (found != spriteCache.end()) {
+        CachedSprite& cached = found->second;
+        spriteCacheOrder.splice(spriteCacheOrder.end(), spriteCacheOrder, cached.order);
+        return &cached.surface;
+    }
+
+    SpriteSurface surface;
+    if (!buildSurface(image, width, height, &surface)) {
+        LOG_WARN("failed to prescale sprite", "width", width, "height", height);
+        return nullptr;
+    }
+
+    size_t bytes = (size_t)surface.stride * height * 4;
+    spriteCacheBytes += bytes; // freed by the next trimSpriteCache if it's over, not while this frame is drawn
+    spriteCacheOrder.push_back(key);
+    CachedSprite& cached = spriteCache[key];
+    cached = CachedSprite {surface, std::prev(spriteCacheOrder.end())};
+    return &cached.surface;
+}
+
+// premultiplied source over: dst = src + dst*(255-srcAlpha)/255
+inline uint32 blendPixel(uint32 src, uint32 dst)
+{
+    uint32 inv = 255 - (src >> 24);
+    uint32 rb = (dst & 0x00ff00ff) * inv + 0x00800080;
+    uint32 ag = ((dst >> 8) & 0x00ff00ff) * inv + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return src + (rb | ag);
+}
+
+void blendRow(const uint32 * src, uint32 * dst, int count)
+{
+    int i = 0;
+#ifdef SPRITE_SSE2
+    const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(255), round = _mm_set1_epi16(128);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+    for (; i+4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+        __m128i alpha = _mm_and_si128(s, alphaMask);
+        // transparent and opaque runs are most of a sprite
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff) continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xffff) {
+            _mm_storeu_si128((__m128i*)(dst+i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+        __m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+        __m128i dLo = _mm_unpacklo_epi8(d, zero), dHi = _mm_unpackhi_epi8(d, zero);
+        // 255-alpha in all four lanes of each pixel
+        __m128i invLo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLo, 0xff), 0xff));
+        __m128i invHi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHi, 0xff), 0xff));
+        // x/255 as (t + (t>>8)) >> 8 with t = x+128
+        __m128i tLo = _mm_add_epi16(_mm_mullo_epi16(dLo, invLo), round);
+        __m128i tHi = _mm_add_epi16(_mm_mullo_epi16(dHi, invHi), round);
+        tLo = _mm_srli_epi16(_mm_add_epi16(tLo, _mm_srli_epi16(tLo, 8)), 8);
+        tHi = _mm_srli_epi16(_mm_add_epi16(tHi, _mm_srli_epi16(tHi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(dst+i), _mm_adds_epu8(s, _mm_packus_epi16(tLo, tHi)));
+    }
+#endif
+    for (; i < count; i++) {
+        uint32 s = src[i];
+        if ((s >> 24) == 0) continue;
+        dst[i] = (s >> 24) == 255 ? s : blendPixel(s, dst[i]);
+    }
+}
+
+void blitSpriteClipped(const SpriteSurface& sprite, int x, int y, int clipLeft, int clipTop, int clipRight, int clipBottom)
+{
+    if (!frameBuffer.pixels) return;
+    clipLeft = MAX(clipLeft, 0); clipTop = MAX(clipTop, 0);
+    clipRight = MIN(clipRight, frameBuffer.width); clipBottom = MIN(clipBottom, frameBuffer.height);
+
+    int x0 = MAX(x, clipLeft), y0 = MAX(y, clipTop);
+    int x1 = MIN(x+sprite.width, clipRight), y1 = MIN(y+sprite.height, clipBottom);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    int64_t start = profileNow();
+    for (int row = y0; row < y1; row++) {
+        const uint32 * src = sprite.pixels + (size_t)(row-y)*sprite.stride + (x0-x);
+        uint32 * dst = frameBuffer.pixels + (size_t)row*frameBuffer.stride + x0;
+        blendRow(src, dst, x1-x0);
+    }
+    spriteBlitNanoseconds.fetch_add(profileNow()-start, std::memory_order_relaxed);
+    spriteBlits.fetch_add(1, std::memory_order_relaxed);
+    spritePixels.fetch_add((uint64_t)(x1-x0)*(y1-y0), std::memory_order_relaxed);
+}
+
+void blitSprite(const SpriteSurface& sprite, int x, int y)
+{
+    blitSpriteClipped(sprite, x, y, 0, 0, frameBuffer.width, frameBuffer.height);
+}
+
+SpriteCacheStats spriteCacheStats()
+{
+    return SpriteCacheStats {(int)spriteCache.size(), spriteCacheBytes,
+        spriteBlits.load(), spritePixels.load(), spriteBlitNanoseconds.load()};
+}
@@ -0,0 +1,66 @@
+#ifndef SPRITE_CACHE_HPP
+#define SPRITE_CACHE_HPP
+
+/*
+    prescaled sprite surfaces
+
+    GDI+ rescales an image every time it is drawn at a size other than its
+    own, which is every sprite every frame. instead each (image, width,
+    height) is scaled once with high quality bicubic filtering into a
+    premultiplied BGRA buffer, with rows padded to SPRITE_ALIGN bytes, and
+    drawn with an unscaled source-over blit straight into the offscreen
+    frame buffer (SSE2, 4 pixels at a time).
+
+    past SPRITE_CACHE_MAX_BYTES the least recently drawn surfaces are freed
+    until it fits again, it only gets there if sprites keep being drawn at
+    new sizes. that only happens in trimSpriteCache between frames, never in
+    spriteSurface, so the surfaces composeFrame bins stay valid while the
+    tiles draw them. a frame with more new sizes than fit goes over until
+    the next trim.
+*/
+
+#include <list>
+#include <new>
+
+#define SPRITE_ALIGN 64 // bytes, a cache line
+#define SPRITE_CACHE_MAX_BYTES (16*1024*1024)
+
+struct SpriteSurface {
+    int width, height;
+    int stride;        // pixels per row, a multiple of SPRITE_ALIGN/4
+    uint32 * pixels;   // premultiplied BGRA, SPRITE_ALIGN aligned
+};
+
+struct SpriteKey {
+    Gdiplus::Image * image;
+    int width, height;
+
+    bool operator==(const SpriteKey& other) const { return image == other.image && width == other.width && height == other.height; }
+};
+
+struct SpriteKeyHash {
+    size_t operator()(const SpriteKey& key) const {
+        return std::hash<void*>()(key.image) ^ ((size_t)key.width * 73856093u) ^ ((size_t)key.height * 19349663u);
+    }
+};
+
+struct SpriteCacheStats {
+    int surfaces;
+    size_t bytes;
+    uint64_t blits, pixels; // since startup
+    int64_t blitNanoseconds;
+};
+
+// the surface for image drawn at width x height, made on first use. null if it can't be made
+const SpriteSurface * spriteSurface(Gdiplus::Image * image, int width, int height);
+void trimSpriteCache(); // before drawing a frame, frees what doesn't fit any more
+void clearSpriteCache();
+
+// source-over blit of a whole surface with its top left at (x, y), clipped to the frame buffer
+void blitSprite(const SpriteSurface& sprite, int x, int y);
+// same, only writing pixels inside the clip rectangle
+void blitSpriteClipped(const SpriteSurface& sprite, int x, int y, int clipLeft, int clipTop, int clipRight, int clipBottom);
+
+SpriteCacheStats spriteCacheStats();
+
+#endif
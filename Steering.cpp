@@ -0,0 +1,187 @@
+#include "Steering.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STEERING_SSE2
+#endif
+
+// chasing enemies 4 to a group, enemy i is lane i%4 of group i/4
+struct SteeringBatch {
+    std::vector<GameObject*> agents;
+    std::vector<float> arrivalX, arrivalY, maxSpeed; // per lane
+    std::vector<float> aheadX, aheadY;               // per lane, unit vector towards the player
+    std::vector<float> awayX, awayY;                 // neighbour centre to the enemy's, [group][neighbour][lane]
+    std::vector<int> groupNeighbours;                // the most any lane of the group has
+    std::vector<float> velX, velY;                   // per lane, the result
+};
+
+SteeringBatch steeringBatch;
+SteeringStats lastSteering;
+bool steeringSse2 = true;
+
+// room for every enemy in the room, so the batch doesn't grow when more of them start chasing
+void reserveSteering(size_t enemies)
+{
+    SteeringBatch& b = steeringBatch;
+    if (b.agents.capacity() >= enemies) return;
+    size_t lanes = (enemies+3) & ~size_t(3);
+    b.agents.reserve(lanes);
+    b.arrivalX.reserve(lanes); b.arrivalY.reserve(lanes); b.maxSpeed.reserve(lanes);
+    b.aheadX.reserve(lanes); b.aheadY.reserve(lanes);
+    b.velX.reserve(lanes); b.velY.reserve(lanes);
+    b.awayX.reserve(lanes*STEER_MAX_NEIGHBOURS); b.awayY.reserve(lanes*STEER_MAX_NEIGHBOURS);
+    b.groupNeighbours.reserve(lanes/4);
+}
+
+// arrival and neighbours of one enemy
+int gatherSteering(int i, uint32& capped)
+{
+    SteeringBatch& b = steeringBatch;
+    GameObject * enemy = b.agents[i];
+    int group = i/4, lane = i%4;
+
+    const GameObject * target = nearestPlayer(enemy->pos.x, enemy->pos.y);
+    float perPixel = enemy->moveSpeed / STEER_CHASE_DIVISOR, top = STEER_ARRIVAL_RADIUS * perPixel;
+    float ax = (target->pos.x - enemy->pos.x) * perPixel, ay = (target->pos.y - enemy->pos.y) * perPixel;
+    float speed = sqrtf(ax*ax + ay*ay);
+    b.aheadX[i] = speed > 0.0f ? ax/speed : 0.0f;
+    b.aheadY[i] = speed > 0.0f ? ay/speed : 0.0f;
+    if (speed > top) {
+        ax *= top/speed;
+        ay *= top/speed;
+    }
+    b.arrivalX[i] = ax; b.arrivalY[i] = ay; b.maxSpeed[i] = top;
+
+    float cx = enemy->pos.x + enemy->size[0]/2, cy = enemy->pos.y + enemy->size[1]/2;
+    int found = 0;
+    float * awayX = &b.awayX[group*STEER_MAX_NEIGHBOURS*4 + lane], * awayY = &b.awayY[group*STEER_MAX_NEIGHBOURS*4 + lane];
+    queryRadius(cx, cy, STEER_SEPARATION_RADIUS, [&](GameObject * other) {
+        if (other == enemy || other->entityType != ENEMY) return;
+        float dx = cx - (other->pos.x + other->size[0]/2), dy = cy - (other->pos.y + other->size[1]/2);
+        float d2 = dx*dx + dy*dy;
+        if (d2 >= STEER_SEPARATION_RADIUS*STEER_SEPARATION_RADIUS || d2 == 0.0f) return;
+        if (found == STEER_MAX_NEIGHBOURS) {
+            capped++;
+            return;
+        }
+        awayX[found*4] = dx;
+        awayY[found*4] = dy;
+        found++;
+    });
+    return found;
+}
+
+void separateGroupPlain(int group)
+{
+    SteeringBatch& b = steeringBatch;
+    for (int lane = 0; lane < 4; lane++) {
+        int i = group*4 + lane;
+        float sx = 0.0f, sy = 0.0f, blocked = 0.0f;
+        for (int k = 0; k < b.groupNeighbours[group]; k++) {
+            int n = (group*STEER_MAX_NEIGHBOURS + k)*4 + lane;
+            float d = sqrtf(b.awayX[n]*b.awayX[n] + b.awayY[n]*b.awayY[n]);
+            float w = fmaxf(0.0f, 1.0f - d*(1.0f/STEER_SEPARATION_RADIUS)) / d; // the unit vector, fading out at the radius
+            sx += b.awayX[n]*w;
+            sy += b.awayY[n]*w;
+            // the same for how far the neighbour is in the way
+            blocked += fmaxf(0.0f, -(b.awayX[n]*b.aheadX[i] + b.awayY[n]*b.aheadY[i])) * w;
+        }
+        float push = b.maxSpeed[i]*STEER_SEPARATION_WEIGHT, queue = fmaxf(0.0f, 1.0f - blocked*STEER_QUEUE_WEIGHT);
+        float vx = b.arrivalX[i]*queue + sx*push, vy = b.arrivalY[i]*queue + sy*push;
+        float cap = fminf(1.0f, b.maxSpeed[i] / fmaxf(sqrtf(vx*vx + vy*vy), 1e-6f));
+        b.velX[i] = vx*cap;
+        b.velY[i] = vy*cap;
+    }
+}
+
+#ifdef STEERING_SSE2
+// separateGroupPlain for the 4 lanes at once
+void separateGroupSse2(int group)
+{
+    SteeringBatch& b = steeringBatch;
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), tiny = _mm_set1_ps(1e-6f);
+    const __m128 invRadius = _mm_set1_ps(1.0f/STEER_SEPARATION_RADIUS), weight = _mm_set1_ps(STEER_SEPARATION_WEIGHT);
+    const __m128 queueWeight = _mm_set1_ps(STEER_QUEUE_WEIGHT);
+    int i = group*4;
+    __m128 aheadX = _mm_loadu_ps(&b.aheadX[i]), aheadY = _mm_loadu_ps(&b.aheadY[i]);
+    __m128 sx = zero, sy = zero, blocked = zero;
+    for (int k = 0; k < b.groupNeighbours[group]; k++) {
+        int n = (group*STEER_MAX_NEIGHBOURS + k)*4;
+        __m128 ax = _mm_loadu_ps(&b.awayX[n]), ay = _mm_loadu_ps(&b.awayY[n]);
+        __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(ay, ay)));
+        __m128 w = _mm_div_ps(_mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(d, invRadius))), d);
+        sx = _mm_add_ps(sx, _mm_mul_ps(ax, w));
+        sy = _mm_add_ps(sy, _mm_mul_ps(ay, w));
+        __m128 inTheWay = _mm_sub_ps(zero, _mm_add_ps(_mm_mul_ps(ax, aheadX), _mm_mul_ps(ay, aheadY)));
+        blocked = _mm_add_ps(blocked, _mm_mul_ps(_mm_max_ps(zero, inTheWay), w));
+    }
+    __m128 top = _mm_loadu_ps(&b.maxSpeed[i]), push = _mm_mul_ps(top, weight);
+    __m128 queue = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(blocked, queueWeight)));
+    __m128 vx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.arrivalX[i]), queue), _mm_mul_ps(sx, push));
+    __m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.arrivalY[i]), queue), _mm_mul_ps(sy, push));
+    __m128 length = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy))), tiny);
+    __m128 cap = _mm_min_ps(one, _mm_div_ps(top, length));
+    _mm_storeu_ps(&b.velX[i], _mm_mul_ps(vx, cap));
+    _mm_storeu_ps(&b.velY[i], _mm_mul_ps(vy, cap));
+}
+#endif
+
+void steerEnemies()
+{
+    PROFILE_SCOPE("steerEnemies");
+    SteeringBatch& b = steeringBatch;
+    b.agents.clear();
+    size_t enemies = 0;
+    forEachEntity<ENEMY>([&b, &enemies](GameObject * enemy) {
+        enemies++;
+        if (enemy->behaviour == BEHAVIOUR_CHASE && enemy->lodAwake) b.agents.push_back(enemy);
+    });
+    reserveSteering(enemies);
+
+    int count = (int)b.agents.size(), groups = (count+3)/4;
+    b.arrivalX.resize(groups*4); b.arrivalY.resize(groups*4); b.maxSpeed.resize(groups*4);
+    b.aheadX.resize(groups*4); b.aheadY.resize(groups*4);
+    b.velX.resize(groups*4); b.velY.resize(groups*4);
+    b.awayX.resize(groups*4*STEER_MAX_NEIGHBOURS); b.awayY.resize(groups*4*STEER_MAX_NEIGHBOURS);
+    b.groupNeighbours.resize(groups);
+
+    lastSteering = SteeringStats {count, 0, 0};
+    for (int group = 0; group < groups; group++) {
+        int found[4] = {0, 0, 0, 0}, most = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            int i = group*4 + lane;
+            if (i < count) found[lane] = gatherSteering(i, lastSteering.capped);
+            else { // padding past the last enemy
+                b.arrivalX[i] = b.arrivalY[i] = b.aheadX[i] = b.aheadY[i] = 0.0f;
+                b.maxSpeed[i] = 1.0f;
+            }
+            most = MAX(most, found[lane]);
+            lastSteering.neighbours += found[lane];
+        }
+        // lanes with fewer neighbours get ones outside the radius, which push with 0
+        for (int lane = 0; lane < 4; lane++) {
+            for (int k = found[lane]; k < most; k++) {
+                int n = (group*STEER_MAX_NEIGHBOURS + k)*4 + lane;
+                b.awayX[n] = 2.0f*STEER_SEPARATION_RADIUS;
+                b.awayY[n] = 0.0f;
+            }
+        }
+        b.groupNeighbours[group] = most;
+    }
+
+    for (int group = 0; group < groups; group++) {
+#ifdef STEERING_SSE2
+        if (steeringSse2) {
+            separateGroupSse2(group);
+            continue;
+        }
+#endif
+        separateGroupPlain(group);
+    }
+    for (int i = 0; i < count; i++) b.agents[i]->velocity = Vector2 {b.velX[i], b.velY[i]};
+}
+
+SteeringStats steeringStats()
+{
+    return lastSteering;
+}
@@ -0,0 +1,52 @@
+#ifndef STEERING_HPP
+#define STEERING_HPP
+
+/*
+    steering for chasing enemies: arrival plus separation
+
+    arrival is the old chase, a velocity towards the nearest player of
+    moveSpeed/10 per pixel away, capped at what it is STEER_ARRIVAL_RADIUS
+    away so enemies far behind no longer close in at any speed. separation
+    pushes each enemy away from the enemies whose centres are within
+    STEER_SEPARATION_RADIUS, harder the closer they are, so a crowd spreads
+    round the player instead of piling up on one spot. an enemy with
+    neighbours close in front of it eases off the chase and queues behind
+    them (STEER_QUEUE_WEIGHT), otherwise the back of a big crowd squeezes the
+    front into one heap. the sum is capped at the arrival speed. enemies
+    exactly on top of each other have no direction to push in and are left
+    to handleCollisions.
+
+    steerEnemies runs in two passes. the first walks the awake chasing
+    enemies, works out their arrival and finds up to STEER_MAX_NEIGHBOURS
+    neighbours each through the spatial grid, writing the offsets a field per
+    array with 4 enemies side by side, one per SSE lane. the second adds up
+    the separation and caps the result 4 enemies at a time, so the cost per
+    enemy is bounded by STEER_MAX_NEIGHBOURS however dense the crowd is. it
+    only uses exact SSE operations (no rsqrt or rcp estimates), so it gives
+    the same velocities bit for bit as the plain loop, and every co-op peer
+    gets the same result whichever path it runs.
+*/
+
+#include <vector>
+
+#define STEER_ARRIVAL_RADIUS 400.0f    // pixels, further away than this chases at full speed
+#define STEER_CHASE_DIVISOR 10.0f      // pixels per second per pixel away, per moveSpeed
+#define STEER_SEPARATION_RADIUS 40.0f  // pixels between centres, enemies are 30 across
+#define STEER_SEPARATION_WEIGHT 1.5f   // times the enemy's top speed, when touching
+#define STEER_QUEUE_WEIGHT 3.0f       // how quickly a neighbour in the way stops the chase
+#define STEER_MAX_NEIGHBOURS 8         // per enemy, more than fit in the radius once they've spread
+
+struct SteeringStats {
+    int agents;       // enemies steered last tick
+    int neighbours;   // found for them in total
+    uint32 capped;    // neighbours past STEER_MAX_NEIGHBOURS, ignored
+};
+
+extern bool steeringSse2; // the swarm bench turns it off to time the plain loop
+
+// sets the velocity of every awake chasing enemy, needs the spatial grid
+void steerEnemies();
+
+SteeringStats steeringStats();
+
+#endif
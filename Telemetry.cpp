@@ -0,0 +1,260 @@
+#include "Telemetry.hpp"
+
+// which entity a sample is. GameObject::id wraps and a record is reused, together they don't repeat
+struct TelemetryKey {
+    const void * record;
+    uint16 id;
+
+    bool operator==(const TelemetryKey& other) const { return record == other.record && id == other.id; }
+};
+
+struct TelemetryKeyHash {
+    size_t operator()(const TelemetryKey& key) const { return std::hash<const void*>()(key.record) ^ ((size_t)key.id * 2654435761u); }
+};
+
+// a gameObject as the game thread copies it, quantized by the encoder
+struct TelemetrySample {
+    TelemetryKey key;
+    float x, y;
+    int16_t health;
+    uint8 type;
+};
+
+struct TelemetryTick {
+    uint32 tick;
+    double time; // seconds since telemetry started
+    int32_t globals[NUM_TELEMETRY_GLOBALS];
+    std::vector<TelemetrySample> samples;
+};
+
+// the game thread fills one while the encoder has the other, they're swapped when the encoder is done
+TelemetryTick telemetryTicks[2];
+TelemetryTick * telemetryFilling = &telemetryTicks[0], * telemetryEncoding = &telemetryTicks[1];
+std::thread telemetryThread;
+std::mutex telemetryMutex;
+std::condition_variable telemetryCV;
+std::atomic<bool> telemetryBusy {false}; // the encoder hasn't finished telemetryEncoding
+bool telemetryRunning = false;
+FILE * telemetryFile = nullptr;
+int telemetryKeyframeTicks = TELEMETRY_KEYFRAME_TICKS;
+uint32 telemetryTick = 0;
+double telemetryTime = 0.0;
+std::atomic<uint32> telemetryPublished {0}, telemetryDropped {0}, telemetryKeyframes {0}, telemetryDeltas {0};
+std::atomic<uint64_t> telemetryBytes {0};
+
+// the encoder's, what the file says the state is
+struct TelemetrySent {
+    TelemetryEntity entity;
+    uint32 seen; // last frame it was in
+};
+std::unordered_map<TelemetryKey, TelemetrySent, TelemetryKeyHash> sentEntities;
+int32_t sentGlobals[NUM_TELEMETRY_GLOBALS];
+uint32 sentTick, sentTime, sentFrames = 0, lastKeyframe;
+uint32 nextTelemetryId = 1;
+std::vector<TelemetryEntity> telemetrySpawns, telemetryMoves, telemetryHurts;
+std::vector<uint32> telemetryDeaths;
+std::vector<uint8> telemetryPayload, telemetryFrame;
+
+void putTelemetryEntity(std::vector<uint8>& out, const TelemetryEntity& entity)
+{
+    putVarint(out, entity.id);
+    out.push_back(entity.type);
+    putSigned(out, entity.x);
+    putSigned(out, entity.y);
+    putSigned(out, entity.health);
+}
+
+void writeTelemetryFrame(uint8 kind)
+{
+    telemetryFrame.clear();
+    telemetryFrame.push_back(kind);
+    putVarint(telemetryFrame, (uint32)telemetryPayload.size());
+    telemetryFrame.insert(telemetryFrame.end(), telemetryPayload.begin(), telemetryPayload.end());
+    fwrite(telemetryFrame.data(), 1, telemetryFrame.size(), telemetryFile);
+    fflush(telemetryFile); // readers follow the file live
+    telemetryBytes += telemetryFrame.size();
+}
+
+void encodeTelemetry(const TelemetryTick& tick)
+{
+    uint32 frame = ++sentFrames;
+    uint32 time = uint32(tick.time * TELEMETRY_TIME_SCALE + 0.5);
+    telemetrySpawns.clear(); telemetryMoves.clear(); telemetryHurts.clear(); telemetryDeaths.clear();
+
+    // bring what was sent up to this tick, keeping what changed
+    for (const TelemetrySample& sample : tick.samples) {
+        int32_t x = (int32_t)lroundf(sample.x * TELEMETRY_POSITION_SCALE), y = (int32_t)lroundf(sample.y * TELEMETRY_POSITION_SCALE);
+        auto found = sentEntities.find(sample.key);
+        if (found == sentEntities.end()) {
+            TelemetryEntity entity = {nextTelemetryId++, sample.type, x, y, sample.health};
+            sentEntities.emplace(sample.key, TelemetrySent {entity, frame});
+            telemetrySpawns.push_back(entity);
+            continue;
+        }
+        TelemetryEntity& sent = found->second.entity;
+        found->second.seen = frame;
+        if (x != sent.x || y != sent.y) {
+            telemetryMoves.push_back(TelemetryEntity {sent.id, sent.type, x-sent.x, y-sent.y, 0});
+            sent.x = x; sent.y = y;
+        }
+        if (sample.health != sent.health) {
+            sent.health = sample.health;
+            telemetryHurts.push_back(sent);
+        }
+    }
+    for (auto it = sentEntities.begin(); it != sentEntities.end();) {
+        if (it->second.seen == frame) { ++it; continue; }
+        telemetryDeaths.push_back(it->second.entity.id);
+        it = sentEntities.erase(it);
+    }
+
+    if (frame > 1) {
+        telemetryPayload.clear();
+        putVarint(telemetryPayload, tick.tick - sentTick);
+        putVarint(telemetryPayload, time - sentTime);
+        uint8 changed = 0;
+        for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) changed |= uint8(tick.globals[g] != sentGlobals[g]) << g;
+        telemetryPayload.push_back(changed);
+        for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) if (changed & (1 << g)) putSigned(telemetryPayload, tick.globals[g]);
+
+        putVarint(telemetryPayload, (uint32)telemetrySpawns.size());
+        for (const TelemetryEntity& entity : telemetrySpawns) putTelemetryEntity(telemetryPayload, entity);
+        putVarint(telemetryPayload, (uint32)telemetryDeaths.size());
+        for (uint32 id : telemetryDeaths) putVarint(telemetryPayload, id);
+        // consecutive gameObjects mostly have consecutive ids
+        uint32 last = 0;
+        putVarint(telemetryPayload, (uint32)telemetryMoves.size());
+        for (const TelemetryEntity& move : telemetryMoves) {
+            putSigned(telemetryPayload, int32_t(move.id - last));
+            putSigned(telemetryPayload, move.x);
+            putSigned(telemetryPayload, move.y);
+            last = move.id;
+        }
+        last = 0;
+        putVarint(telemetryPayload, (uint32)telemetryHurts.size());
+        for (const TelemetryEntity& hurt : telemetryHurts) {
+            putSigned(telemetryPayload, int32_t(hurt.id - last));
+            putSigned(telemetryPayload, hurt.health);
+            last = hurt.id;
+        }
+        writeTelemetryFrame(TELEMETRY_DELTA);
+        telemetryDeltas++;
+    }
+
+    // after the tick's delta, so a reader that has followed along can check it
+    if (frame == 1 || tick.tick - lastKeyframe >= (uint32)telemetryKeyframeTicks) {
+        telemetryPayload.clear();
+        putVarint(telemetryPayload, tick.tick);
+        putVarint(telemetryPayload, time);
+        for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) putSigned(telemetryPayload, tick.globals[g]);
+        putVarint(telemetryPayload, (uint32)sentEntities.size());
+        for (const auto& sent : sentEntities) putTelemetryEntity(telemetryPayload, sent.second.entity);
+        writeTelemetryFrame(TELEMETRY_KEYFRAME);
+        lastKeyframe = tick.tick;
+        telemetryKeyframes++;
+    }
+    sentTick = tick.tick;
+    sentTime = time;
+    memcpy(sentGlobals, tick.globals, sizeof(sentGlobals));
+}
+
+int startTelemetry(int keyframeTicks)
+{
+    if (telemetryRunning) return -1;
+    telemetryFile = fopen(TELEMETRY_FILE, "wb");
+    if (!telemetryFile) return -1;
+    TelemetryHeader header = {TELEMETRY_MAGIC, TELEMETRY_VERSION, TELEMETRY_POSITION_SCALE, TELEMETRY_TIME_SCALE, TELEMETRY_CHARGE_SCALE};
+    fwrite(&header, sizeof(header), 1, telemetryFile);
+    telemetryBytes = sizeof(header);
+
+    telemetryKeyframeTicks = MAX(keyframeTicks, 1);
+    telemetryTick = 0;
+    telemetryTime = 0.0;
+    telemetryPublished = telemetryDropped = telemetryKeyframes = telemetryDeltas = 0;
+    sentEntities.clear();
+    sentFrames = 0;
+    nextTelemetryId = 1;
+    telemetryBusy = false;
+    telemetryRunning = true;
+
+    telemetryThread = std::thread([]() {
+        std::unique_lock<std::mutex> lock(telemetryMutex);
+        while (true) {
+            telemetryCV.wait(lock, []() { return telemetryBusy.load() || !telemetryRunning; });
+            if (telemetryBusy) {
+                // the game thread only touches the other buffer meanwhile
+                lock.unlock();
+                encodeTelemetry(*telemetryEncoding);
+                lock.lock();
+                telemetryBusy = false;
+            } else return; // stopped with nothing left to encode
+        }
+    });
+    LOG_INFO("telemetry started", "file", TELEMETRY_FILE, "keyframeTicks", telemetryKeyframeTicks);
+    return 0;
+}
+
+void stopTelemetry()
+{
+    if (!telemetryRunning) return;
+    {
+        std::lock_guard<std::mutex> lock(telemetryMutex);
+        telemetryRunning = false;
+    }
+    telemetryCV.notify_one();
+    telemetryThread.join();
+    fclose(telemetryFile);
+    telemetryFile = nullptr;
+
+    TelemetryStats stats = telemetryStats();
+    LOG_INFO("telemetry stopped", "published", stats.published, "dropped", stats.dropped, "bytes", stats.bytes);
+}
+
+bool telemetryActive()
+{
+    return telemetryRunning;
+}
+
+void publishTelemetry(float dt)
+{
+    if (!telemetryRunning) return;
+    telemetryTick++;
+    telemetryTime += dt;
+    // still encoding the last one, the next delta will cover this tick too
+    if (telemetryBusy.load(std::memory_order_acquire)) {
+        telemetryDropped++;
+        return;
+    }
+    PROFILE_SCOPE("publishTelemetry");
+
+    TelemetryTick& tick = *telemetryFilling;
+    tick.tick = telemetryTick;
+    tick.time = telemetryTime;
+    tick.globals[TELEMETRY_BULLETS] = (int32_t)numBullets;
+    tick.globals[TELEMETRY_GEMS] = (int32_t)numGems;
+    tick.globals[TELEMETRY_GEMS_SAVED] = (int32_t)gemsSaved;
+    tick.globals[TELEMETRY_HEALTH] = player ? player->health : 0;
+    tick.globals[TELEMETRY_CHARGE] = (int32_t)lroundf(flashLightCharge * TELEMETRY_CHARGE_SCALE);
+    tick.globals[TELEMETRY_DEPTH] = largeCaveMode ? chunkDistanceFromStart() : (int32_t)roomQueue.size();
+    tick.globals[TELEMETRY_PAUSE] = gameIsPaused ? pauseState : -1;
+    tick.globals[TELEMETRY_FLASHLIGHT] = flashlightOn;
+    tick.samples.resize(gameObjects.size());
+    for (size_t i = 0; i < gameObjects.size(); i++) {
+        const GameObject * obj = gameObjects[i];
+        tick.samples[i] = TelemetrySample {TelemetryKey {obj, obj->id}, obj->pos.x, obj->pos.y, obj->health, obj->entityType};
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(telemetryMutex);
+        std::swap(telemetryFilling, telemetryEncoding);
+        telemetryBusy = true;
+    }
+    telemetryCV.notify_one();
+    telemetryPublished++;
+}
+
+TelemetryStats telemetryStats()
+{
+    return TelemetryStats {telemetryRunning, telemetryPublished.load(), telemetryDropped.load(),
+        telemetryKeyframes.load(), telemetryDeltas.load(), telemetryBytes.load()};
+}
@@ -0,0 +1,140 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+/*
+    telemetry stream for spectators and dashboards (run with -telemetry [keyframe ticks])
+
+    after every tick publishTelemetry copies the globals and each gameObject's
+    type, position and health into one of two buffers and hands it to the
+    encoder thread, which has the other. if the encoder is still busy with the
+    last one the tick is dropped and counted, the next delta covers both. the
+    render path is never touched and the game thread never waits on the disk.
+
+    the encoder keeps the state it last sent and appends frames to
+    TELEMETRY_FILE, flushed as they go so a reader can follow it live:
+        TelemetryHeader     magic, version, scales
+        frames              uint8 kind, varint payload bytes, payload
+
+    a keyframe (the first frame, then every keyframe ticks following that
+    tick's delta) is the whole state:
+        varint tick, varint time
+        the globals, zigzag varints in TelemetryGlobal order
+        varint count, each entity: varint id, uint8 type, zigzag x, y, health
+    a delta is what changed since the frame before it:
+        varint ticks since, varint time since
+        uint8 mask of changed globals, then each changed one
+        varint spawns, each like a keyframe entity
+        varint deaths, each varint id
+        varint moves, each zigzag id - the last id, zigzag dx, dy
+        varint hurts, each zigzag id - the last id, zigzag health
+    positions are in 1/TELEMETRY_POSITION_SCALE pixels and time in
+    1/TELEMETRY_TIME_SCALE seconds, and deltas are taken between quantized
+    values so they never drift. ids are handed out by the encoder as entities
+    first appear and never reused. entities are recognised by GameObject::id
+    together with their record, so one that dies and is replaced in the same
+    record between two frames is a death and a spawn, and so is an object
+    put back from a snapshot somewhere else.
+
+    TelemetryDecoder rebuilds the state from the file (see its usage) and
+    checks it against every keyframe.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define TELEMETRY_FILE "telemetry.bin"
+#define TELEMETRY_MAGIC 0x594d4c54 // "TLMY"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_KEYFRAME_TICKS 300
+#define TELEMETRY_POSITION_SCALE 4 // steps per pixel
+#define TELEMETRY_TIME_SCALE 1000  // steps per second
+#define TELEMETRY_CHARGE_SCALE 100 // steps per second of charge
+
+enum TelemetryFrameKind : uint8 {
+    TELEMETRY_KEYFRAME = 1,
+    TELEMETRY_DELTA = 2
+};
+
+enum TelemetryGlobal {
+    TELEMETRY_BULLETS,
+    TELEMETRY_GEMS,       // carried
+    TELEMETRY_GEMS_SAVED,
+    TELEMETRY_HEALTH,
+    TELEMETRY_CHARGE,     // TELEMETRY_CHARGE_SCALE steps
+    TELEMETRY_DEPTH,      // rooms, or chunks from the start in the large cave
+    TELEMETRY_PAUSE,      // -1 while playing, otherwise pauseState
+    TELEMETRY_FLASHLIGHT, // 1 when on
+    NUM_TELEMETRY_GLOBALS // no more than 8, deltas have a byte mask
+};
+
+struct TelemetryHeader {
+    uint32 magic;
+    uint16 version;
+    uint16 positionScale;
+    uint16 timeScale;
+    uint16 chargeScale;
+};
+
+// an entity as it was last sent
+struct TelemetryEntity {
+    uint32 id;
+    uint8 type;
+    int32_t x, y; // quantized
+    int32_t health;
+};
+
+struct TelemetryStats {
+    bool active;
+    uint32 published, dropped; // ticks handed to the encoder, ticks it was too busy for
+    uint32 keyframes, deltas;
+    uint64_t bytes;            // written to the file
+};
+
+int startTelemetry(int keyframeTicks); // 0 on success
+void stopTelemetry(); // encodes what's been handed over and closes the file
+bool telemetryActive();
+
+// once a tick after the game has been simulated, dt is the tick's delta time
+void publishTelemetry(float dt);
+
+TelemetryStats telemetryStats();
+
+// varints, shared with the decoder
+inline void putVarint(std::vector<uint8>& out, uint32 value)
+{
+    while (value >= 0x80) {
+        out.push_back(uint8(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(uint8(value));
+}
+
+inline void putSigned(std::vector<uint8>& out, int32_t value) // zigzag, small either side of 0 stays short
+{
+    putVarint(out, (uint32(value) << 1) ^ uint32(value >> 31));
+}
+
+// false past the end or on a varint longer than 5 bytes
+inline bool getVarint(const uint8 *& at, const uint8 * end, uint32& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && at < end; shift += 7) {
+        uint8 byte = *at++;
+        value |= uint32(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+inline bool getSigned(const uint8 *& at, const uint8 * end, int32_t& value)
+{
+    uint32 zigzag;
+    if (!getVarint(at, end, zigzag)) return false;
+    value = int32_t(zigzag >> 1) ^ -int32_t(zigzag & 1);
+    return true;
+}
+
+#endif
@@ -0,0 +1,264 @@
+/*
+    telemetry decoder, rebuilds the game state from a -telemetry stream
+
+    usage: TelemetryDecoder [file] [-follow] [-quiet]
+        file is telemetry.bin by default
+        -follow keeps reading as the game writes it, until interrupted
+        -quiet only prints the summary
+
+    prints a line per frame with what changed and the state after it. deltas
+    before the first keyframe are skipped, so reading can start on a file the
+    game is still writing. every keyframe after that is checked against the
+    state built up from the deltas, any difference is reported and makes the
+    exit code 1.
+
+    standalone, none of the game is compiled in.
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+typedef unsigned char uint8;
+typedef unsigned short uint16;
+typedef unsigned int uint32;
+
+#include "Telemetry.hpp"
+
+#define DECODER_READ_SIZE 65536
+#define DECODER_FOLLOW_MS 100 // between looks at the end of a file being written
+
+const char * telemetryGlobalNames[NUM_TELEMETRY_GLOBALS] = {
+    "bullets", "gems", "gems saved", "health", "charge", "depth", "pause", "flashlight"
+};
+
+struct DecodedState {
+    uint32 tick;
+    uint32 time; // TELEMETRY_TIME_SCALE steps
+    int32_t globals[NUM_TELEMETRY_GLOBALS];
+    std::unordered_map<uint32, TelemetryEntity> entities;
+};
+
+struct DecoderTotals {
+    uint32 keyframes, deltas, skipped; // skipped deltas before the first keyframe
+    uint32 checked, mismatched;        // keyframes compared with the decoded state
+    uint32 errors;                     // frames that didn't parse or named unknown ids
+    uint64_t keyframeBytes, deltaBytes;
+};
+
+DecodedState decoded;
+bool synced = false; // a keyframe has been read
+DecoderTotals totals = {};
+bool quiet = false;
+
+bool getEntity(const uint8 *& at, const uint8 * end, TelemetryEntity& entity)
+{
+    if (!getVarint(at, end, entity.id) || at >= end) return false;
+    entity.type = *at++;
+    return getSigned(at, end, entity.x) && getSigned(at, end, entity.y) && getSigned(at, end, entity.health);
+}
+
+void printState(const char * what)
+{
+    printf("tick %u %.3fs %s | %zu entities, bullets %d, gems %d (%d saved), health %d, charge %.2f, depth %d%s%s\n",
+        decoded.tick, (double)decoded.time/TELEMETRY_TIME_SCALE, what, decoded.entities.size(),
+        decoded.globals[TELEMETRY_BULLETS], decoded.globals[TELEMETRY_GEMS], decoded.globals[TELEMETRY_GEMS_SAVED],
+        decoded.globals[TELEMETRY_HEALTH], (double)decoded.globals[TELEMETRY_CHARGE]/TELEMETRY_CHARGE_SCALE,
+        decoded.globals[TELEMETRY_DEPTH], decoded.globals[TELEMETRY_FLASHLIGHT] ? ", light on" : "",
+        decoded.globals[TELEMETRY_PAUSE] >= 0 ? ", paused" : "");
+}
+
+// the first difference, or null
+const char * compareStates(const DecodedState& a, const DecodedState& b, char * buffer, size_t size)
+{
+    if (a.tick != b.tick || a.time != b.time) return "tick or time";
+    for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) if (a.globals[g] != b.globals[g]) return telemetryGlobalNames[g];
+    if (a.entities.size() != b.entities.size()) return "entity count";
+    for (const auto& entry : a.entities) {
+        auto found = b.entities.find(entry.first);
+        const TelemetryEntity& e = entry.second;
+        if (found == b.entities.end() || found->second.type != e.type ||
+            found->second.x != e.x || found->second.y != e.y || found->second.health != e.health) {
+            snprintf(buffer, size, "entity %u", entry.first);
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+bool readKeyframe(const uint8 * at, const uint8 * end)
+{
+    const uint8 * start = at;
+    DecodedState state;
+    uint32 count;
+    if (!getVarint(at, end, state.tick) || !getVarint(at, end, state.time)) return false;
+    for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) if (!getSigned(at, end, state.globals[g])) return false;
+    if (!getVarint(at, end, count)) return false;
+    state.entities.reserve(count);
+    for (uint32 i = 0; i < count; i++) {
+        TelemetryEntity entity;
+        if (!getEntity(at, end, entity)) return false;
+        state.entities[entity.id] = entity;
+    }
+
+    const char * result = "";
+    if (synced) {
+        char buffer[64];
+        const char * difference = compareStates(state, decoded, buffer, sizeof(buffer));
+        totals.checked++;
+        if (difference) {
+            totals.mismatched++;
+            fprintf(stderr, "keyframe at tick %u doesn't match the deltas: %s\n", state.tick, difference);
+            result = ", MISMATCH";
+        } else result = ", matches";
+    }
+    decoded = std::move(state);
+    synced = true;
+    totals.keyframes++;
+    if (!quiet) {
+        char what[64];
+        snprintf(what, sizeof(what), "keyframe %zu B%s", size_t(end - start), result);
+        printState(what);
+    }
+    return true;
+}
+
+bool readDelta(const uint8 * at, const uint8 * end)
+{
+    const uint8 * start = at;
+    if (!synced) {
+        totals.skipped++;
+        return true;
+    }
+    uint32 ticks, time;
+    if (!getVarint(at, end, ticks) || !getVarint(at, end, time) || at >= end) return false;
+    decoded.tick += ticks;
+    decoded.time += time;
+    uint8 changed = *at++;
+    for (int g = 0; g < NUM_TELEMETRY_GLOBALS; g++) {
+        if ((changed & (1 << g)) && !getSigned(at, end, decoded.globals[g])) return false;
+    }
+
+    uint32 spawns, deaths, moves, hurts;
+    if (!getVarint(at, end, spawns)) return false;
+    for (uint32 i = 0; i < spawns; i++) {
+        TelemetryEntity entity;
+        if (!getEntity(at, end, entity)) return false;
+        decoded.entities[entity.id] = entity;
+    }
+    if (!getVarint(at, end, deaths)) return false;
+    for (uint32 i = 0; i < deaths; i++) {
+        uint32 id;
+        if (!getVarint(at, end, id)) return false;
+        if (decoded.entities.erase(id) == 0) totals.errors++;
+    }
+    uint32 id = 0;
+    if (!getVarint(at, end, moves)) return false;
+    for (uint32 i = 0; i < moves; i++) {
+        int32_t step, dx, dy;
+        if (!getSigned(at, end, step) || !getSigned(at, end, dx) || !getSigned(at, end, dy)) return false;
+        id += (uint32)step;
+        auto found = decoded.entities.find(id);
+        if (found == decoded.entities.end()) { totals.errors++; continue; }
+        found->second.x += dx;
+        found->second.y += dy;
+    }
+    id = 0;
+    if (!getVarint(at, end, hurts)) return false;
+    for (uint32 i = 0; i < hurts; i++) {
+        int32_t step, health;
+        if (!getSigned(at, end, step) || !getSigned(at, end, health)) return false;
+        id += (uint32)step;
+        auto found = decoded.entities.find(id);
+        if (found == decoded.entities.end()) { totals.errors++; continue; }
+        found->second.health = health;
+    }
+
+    totals.deltas++;
+    totals.deltaBytes += end - start;
+    if (!quiet) {
+        char what[96];
+        snprintf(what, sizeof(what), "delta %zu B, +%u -%u, %u moved, %u hurt", size_t(end - start), spawns, deaths, moves, hurts);
+        printState(what);
+    }
+    return true;
+}
+
+// frames at the front of buffer, returns the bytes used, a partial frame at the end is left
+size_t readFrames(const uint8 * data, size_t size)
+{
+    size_t used = 0;
+    while (used < size) {
+        const uint8 * at = data + used, * end = data + size;
+        uint8 kind = *at++;
+        uint32 length;
+        if (!getVarint(at, end, length)) {
+            if (end - at > 5) totals.errors++; // not just cut short
+            break;
+        }
+        if ((size_t)(end - at) < length) break;
+
+        bool ok = false;
+        if (kind == TELEMETRY_KEYFRAME) {
+            ok = readKeyframe(at, at + length);
+            totals.keyframeBytes += length;
+        } else if (kind == TELEMETRY_DELTA) ok = readDelta(at, at + length);
+        if (!ok) {
+            totals.errors++;
+            fprintf(stderr, "bad frame of kind %u, %u bytes\n", kind, length);
+        }
+        used = size_t(at + length - data);
+    }
+    return used;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * path = TELEMETRY_FILE;
+    bool follow = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-follow") == 0) follow = true;
+        else if (strcmp(argv[i], "-quiet") == 0) quiet = true;
+        else path = argv[i];
+    }
+
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "can't open %s\n", path);
+        return 1;
+    }
+    TelemetryHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TELEMETRY_MAGIC || header.version != TELEMETRY_VERSION ||
+        header.positionScale != TELEMETRY_POSITION_SCALE || header.timeScale != TELEMETRY_TIME_SCALE || header.chargeScale != TELEMETRY_CHARGE_SCALE) {
+        fprintf(stderr, "%s isn't a version %d telemetry stream\n", path, TELEMETRY_VERSION);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<uint8> buffer;
+    size_t pending = 0; // bytes of buffer not yet used
+    while (true) {
+        buffer.resize(pending + DECODER_READ_SIZE);
+        size_t got = fread(buffer.data() + pending, 1, DECODER_READ_SIZE, file);
+        pending += got;
+        size_t used = readFrames(buffer.data(), pending);
+        memmove(buffer.data(), buffer.data() + used, pending - used);
+        pending -= used;
+        if (got == 0) {
+            if (!follow) break;
+            clearerr(file); // at the end for now, the game may write more
+            std::this_thread::sleep_for(std::chrono::milliseconds(DECODER_FOLLOW_MS));
+        }
+    }
+    fclose(file);
+    if (pending) fprintf(stderr, "%zu bytes of an unfinished frame at the end\n", pending);
+
+    printf("%u keyframes (%llu B), %u deltas (%llu B, %.1f B each), %u skipped before the first keyframe\n",
+        totals.keyframes, (unsigned long long)totals.keyframeBytes, totals.deltas, (unsigned long long)totals.deltaBytes,
+        totals.deltas ? (double)totals.deltaBytes/totals.deltas : 0.0, totals.skipped);
+    printf("%u keyframes checked, %u mismatched, %u errors\n", totals.checked, totals.mismatched, totals.errors);
+    return totals.mismatched || totals.errors ? 1 : 0;
+}
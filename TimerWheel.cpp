@@ -0,0 +1,231 @@
+#include "TimerWheel.hpp"
+
+#define TIMER_LEVEL0_SLOTS (1 << TIMER_LEVEL0_BITS)
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LISTS (TIMER_LEVEL0_SLOTS + (TIMER_LEVELS-1)*TIMER_LEVEL_SLOTS)
+#define TIMER_FIRING TIMER_LISTS         // head of the list being fired
+#define TIMER_FIRST_NODE (TIMER_LISTS+1) // nodes before this are list heads
+
+constexpr TimerEffectInfo timerEffects[NUM_TIMER_EFFECTS] = {
+    {"invulnerable",  nullptr},          // TIMER_INVULNERABLE
+    {"battery drain", drainBatteryStep}, // TIMER_BATTERY_DRAIN
+    {"cave clock",    advanceCaveClock}  // TIMER_CAVE_CLOCK
+};
+
+// a timer, or the head of a list
+struct TimerNode {
+    uint32 expires; // slot it fires in
+    uint32 data;
+    int prev, next; // lists are circular through their head, next is the free list when it's unused
+    uint16 effect;
+    uint8 generation; // bumped when freed so old handles miss
+    bool live;
+};
+
+std::vector<TimerNode> timerNodes;
+int freeTimerNode = -1;
+uint32 timerNow = 0;    // the next slot to fire
+float timerCarry = 0.0f;
+int pendingTimers[NUM_TIMER_EFFECTS];
+int liveTimers = 0;
+uint32 timersFired = 0, timersCascaded = 0;
+uint64_t totalTimersFired = 0;
+
+void initTimerLists()
+{
+    timerNodes.resize(TIMER_FIRST_NODE);
+    for (int i = 0; i < TIMER_FIRST_NODE; i++) {
+        timerNodes[i] = TimerNode {};
+        timerNodes[i].prev = timerNodes[i].next = i;
+    }
+}
+
+void linkTimer(int list, int node)
+{
+    TimerNode * nodes = timerNodes.data();
+    int last = nodes[list].prev;
+    nodes[node].prev = last;
+    nodes[node].next = list;
+    nodes[last].next = node;
+    nodes[list].prev = node;
+}
+
+void unlinkTimer(int node)
+{
+    TimerNode * nodes = timerNodes.data();
+    nodes[nodes[node].prev].next = nodes[node].next;
+    nodes[nodes[node].next].prev = nodes[node].prev;
+}
+
+// the list a timer goes in from where the wheel is now
+int timerList(uint32 expires)
+{
+    uint32 delta = expires - timerNow;
+    if (delta < TIMER_LEVEL0_SLOTS) return expires & (TIMER_LEVEL0_SLOTS-1);
+    int shift = TIMER_LEVEL0_BITS, first = TIMER_LEVEL0_SLOTS;
+    for (int level = 1; level < TIMER_LEVELS-1; level++) {
+        if (delta < 1u << (shift+TIMER_LEVEL_BITS)) break;
+        shift += TIMER_LEVEL_BITS;
+        first += TIMER_LEVEL_SLOTS;
+    }
+    return first + ((expires >> shift) & (TIMER_LEVEL_SLOTS-1));
+}
+
+void addTimer(int node)
+{
+    linkTimer(timerList(timerNodes[node].expires), node);
+}
+
+TimerHandle scheduleTimerSlots(int effect, uint32 slots, uint32 data)
+{
+    if (timerNodes.empty()) initTimerLists();
+    int node = freeTimerNode;
+    if (node >= 0) freeTimerNode = timerNodes[node].next;
+    else {
+        node = (int)timerNodes.size();
+        timerNodes.push_back(TimerNode {});
+    }
+    TimerNode& timer = timerNodes[node];
+    timer.expires = timerNow + slots-1; // timerNow fires on the next slot
+    timer.data = data;
+    timer.effect = (uint16)effect;
+    timer.live = true;
+    addTimer(node);
+    pendingTimers[effect]++;
+    liveTimers++;
+    return TimerHandle(node) << 8 | timer.generation;
+}
+
+TimerHandle scheduleTimer(int effect, float seconds, uint32 data)
+{
+    float slots = seconds / TIMER_RESOLUTION + 0.5f;
+    return scheduleTimerSlots(effect, slots < 1.0f ? 1 : slots > (float)TIMER_MAX_SLOTS ? TIMER_MAX_SLOTS : (uint32)slots, data);
+}
+
+void freeTimer(int node)
+{
+    TimerNode& timer = timerNodes[node];
+    pendingTimers[timer.effect]--;
+    liveTimers--;
+    timer.live = false;
+    timer.generation++;
+    timer.next = freeTimerNode;
+    freeTimerNode = node;
+}
+
+bool timerScheduled(TimerHandle handle)
+{
+    size_t node = handle >> 8;
+    return node >= TIMER_FIRST_NODE && node < timerNodes.size() &&
+        timerNodes[node].live && timerNodes[node].generation == (handle & 0xff);
+}
+
+void cancelTimer(TimerHandle handle)
+{
+    if (!timerScheduled(handle)) return;
+    unlinkTimer(handle >> 8);
+    freeTimer(handle >> 8);
+}
+
+int timersPending(int effect)
+{
+    return pendingTimers[effect];
+}
+
+void resetTimers()
+{
+    timerNodes.clear();
+    initTimerLists();
+    freeTimerNode = -1;
+    timerNow = 0;
+    timerCarry = 0.0f;
+    for (int i = 0; i < NUM_TIMER_EFFECTS; i++) pendingTimers[i] = 0;
+    liveTimers = 0;
+}
+
+// moves a list of a higher level down to where its timers go now
+void cascadeTimers(int list)
+{
+    TimerNode * nodes = timerNodes.data();
+    int node = nodes[list].next;
+    nodes[list].prev = nodes[list].next = list;
+    while (node != list) {
+        int next = nodes[node].next;
+        addTimer(node);
+        timersCascaded++;
+        node = next;
+    }
+}
+
+void advanceTimerSlot()
+{
+    int index = timerNow & (TIMER_LEVEL0_SLOTS-1);
+    // back at the start of the first level, the next list of each level above comes down
+    if (index == 0) {
+        int shift = TIMER_LEVEL0_BITS, first = TIMER_LEVEL0_SLOTS;
+        for (int level = 1; level < TIMER_LEVELS; level++) {
+            int slot = (timerNow >> shift) & (TIMER_LEVEL_SLOTS-1);
+            cascadeTimers(first + slot);
+            if (slot != 0) break;
+            shift += TIMER_LEVEL_BITS;
+            first += TIMER_LEVEL_SLOTS;
+        }
+    }
+    timerNow++;
+
+    // take the slot's list first, effects can schedule into it again
+    TimerNode * nodes = timerNodes.data();
+    if (nodes[index].next == index) return;
+    nodes[TIMER_FIRING].next = nodes[index].next;
+    nodes[TIMER_FIRING].prev = nodes[index].prev;
+    nodes[nodes[index].next].prev = TIMER_FIRING;
+    nodes[nodes[index].prev].next = TIMER_FIRING;
+    nodes[index].prev = nodes[index].next = index;
+
+    // effects can cancel timers that are still on the firing list, so take them one at a time
+    while (timerNodes[TIMER_FIRING].next != TIMER_FIRING) {
+        int node = timerNodes[TIMER_FIRING].next;
+        unlinkTimer(node);
+        int effect = timerNodes[node].effect;
+        uint32 data = timerNodes[node].data;
+        freeTimer(node);
+        timersFired++;
+        totalTimersFired++;
+        if (timerEffects[effect].fire) timerEffects[effect].fire(data);
+    }
+}
+
+void advanceTimers(float dt)
+{
+    if (timerNodes.empty()) initTimerLists();
+    timersFired = timersCascaded = 0;
+    timerCarry += dt;
+    while (timerCarry >= TIMER_RESOLUTION) {
+        timerCarry -= TIMER_RESOLUTION;
+        advanceTimerSlot();
+    }
+}
+
+void captureTimers(TimerState& state)
+{
+    state.now = timerNow;
+    state.carry = timerCarry;
+    state.timers.clear();
+    for (size_t node = TIMER_FIRST_NODE; node < timerNodes.size(); node++) {
+        const TimerNode& timer = timerNodes[node];
+        if (timer.live) state.timers.push_back(TimerSave {timer.effect, timer.data, timer.expires-timerNow+1});
+    }
+}
+
+void restoreTimers(const TimerState& state)
+{
+    resetTimers();
+    timerNow = state.now;
+    timerCarry = state.carry;
+    for (const TimerSave& save : state.timers) scheduleTimerSlots(save.effect, save.slotsLeft, save.data);
+}
+
+TimerStats timerStats()
+{
+    return TimerStats {liveTimers, timersFired, timersCascaded, totalTimersFired};
+}
@@ -0,0 +1,82 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+/*
+    timed effects: the invulnerability window after contact damage, the
+    flashlight's drain steps, the cave clock that makes later rooms richer
+
+    a hierarchical timer wheel counting slots of TIMER_RESOLUTION seconds of
+    unpaused game time. the first level has a list per slot for the next 256
+    slots, each level after it has 64 lists covering 64 times as long, so
+    anything up to TIMER_MAX_SLOTS away has a list to go in straight away.
+    timers are nodes in one array linked into those lists, scheduling one is
+    a push on the end of a list and cancelling one unlinks it. advancing a
+    slot fires the first level's list for it, and every 256 slots the next
+    list of the level above is shared out again over the levels below. a tick
+    costs the timers that fire plus the ones moved down, never the ones that
+    are just waiting.
+
+    what a timer does is one of the TimerEffect kinds, a function and 32 bits
+    of data rather than a closure, so lockstep can copy the pending timers
+    and put them back (snapshots don't keep them, a loaded run starts with
+    none). timersPending says whether a kind is waiting, that's all the
+    state the invulnerability window needs. effects can schedule more, but
+    ones that fire in the same slot mustn't care which goes first, a
+    restored wheel doesn't keep that order.
+*/
+
+#include <vector>
+
+#define TIMER_RESOLUTION 0.01f   // seconds per slot
+#define TIMER_LEVEL0_BITS 8
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVELS 4
+#define TIMER_MAX_SLOTS ((1u << (TIMER_LEVEL0_BITS + (TIMER_LEVELS-1)*TIMER_LEVEL_BITS)) - 1) // about 7.7 days, longer is clamped
+
+typedef uint32 TimerHandle; // 0 is no timer
+
+enum TimerEffect {
+    TIMER_INVULNERABLE,   // the player can't be hurt until it fires
+    TIMER_BATTERY_DRAIN,  // the flashlight's next step of charge
+    TIMER_CAVE_CLOCK,     // another CAVE_CLOCK_SECONDS in the cave
+    NUM_TIMER_EFFECTS
+};
+
+struct TimerEffectInfo {
+    const char * name;
+    void (*fire)(uint32 data); // nullptr when only timersPending matters
+};
+
+// lockstep's copy of the pending timers
+struct TimerSave {
+    uint16 effect;
+    uint32 data;
+    uint32 slotsLeft;
+};
+
+struct TimerState {
+    uint32 now;
+    float carry; // seconds not yet a whole slot
+    std::vector<TimerSave> timers;
+};
+
+struct TimerStats {
+    int live;
+    uint32 fired, cascaded; // last tick
+    uint64_t totalFired;
+};
+
+TimerHandle scheduleTimer(int effect, float seconds, uint32 data = 0); // at least one slot
+void cancelTimer(TimerHandle handle); // nothing if it already fired
+bool timerScheduled(TimerHandle handle);
+int timersPending(int effect);
+void resetTimers(); // drops every timer
+
+void advanceTimers(float dt); // once a tick while the game isn't paused, fires what's due
+
+void captureTimers(TimerState& state);
+void restoreTimers(const TimerState& state);
+
+TimerStats timerStats();
+
+#endif
@@ -0,0 +1,167 @@
+#include "Tuning.hpp"
+
+const Tuning defaultTuning = {
+    0,
+    10, 200.0f,             // player health, speed
+    400.0f, 1,              // bullet speed, damage
+    5, 5.0f,                // enemy health, speed
+    5.0f, 5,                // battery charge, ammo
+    10, 0.01f, 1.0f, 1.0f, 1, // upgrade cost, width, range, charge, bullets
+    5, 0.5f, 3              // light falloff, ambient light, darker every
+};
+
+enum TuningType { TUNING_INT, TUNING_FLOAT };
+
+struct TuningField {
+    const char * name;
+    TuningType type;
+    size_t offset;
+    float min, max;
+};
+
+const TuningField tuningFields[] = {
+    {"player_health",  TUNING_INT,   offsetof(Tuning, playerHealth),   1.0f, 32767.0f},
+    {"player_speed",   TUNING_FLOAT, offsetof(Tuning, playerSpeed),    0.0f, 4000.0f},
+    {"bullet_speed",   TUNING_FLOAT, offsetof(Tuning, bulletSpeed),    0.0f, 4000.0f},
+    {"bullet_damage",  TUNING_INT,   offsetof(Tuning, bulletDamage),   0.0f, 32767.0f},
+    {"enemy_health",   TUNING_INT,   offsetof(Tuning, enemyHealth),    1.0f, 32767.0f},
+    {"enemy_speed",    TUNING_FLOAT, offsetof(Tuning, enemySpeed),     0.0f, 4000.0f},
+    {"battery_charge", TUNING_FLOAT, offsetof(Tuning, batteryCharge),  0.0f, 1000.0f},
+    {"ammo_pickup",    TUNING_INT,   offsetof(Tuning, ammoPickup),     0.0f, 1000.0f},
+    {"upgrade_cost",   TUNING_INT,   offsetof(Tuning, upgradeCost),    0.0f, 1000000.0f},
+    {"upgrade_width",  TUNING_FLOAT, offsetof(Tuning, upgradeWidth),   0.0f, 1.0f},
+    {"upgrade_range",  TUNING_FLOAT, offsetof(Tuning, upgradeRange),   0.0f, 1000.0f},
+    {"upgrade_charge", TUNING_FLOAT, offsetof(Tuning, upgradeCharge),  0.0f, 1000.0f},
+    {"upgrade_bullets",TUNING_INT,   offsetof(Tuning, upgradeBullets), 0.0f, 1000.0f},
+    {"light_falloff",  TUNING_INT,   offsetof(Tuning, lightFalloff),   1.0f, 16.0f},
+    {"ambient_light",  TUNING_FLOAT, offsetof(Tuning, ambientLight),   0.0f, 1.0f},
+    {"darker_every",   TUNING_INT,   offsetof(Tuning, darkerEvery),    1.0f, 1000.0f},
+};
+
+std::atomic<const Tuning*> publishedTuning {&defaultTuning};
+const Tuning * tuning = &defaultTuning;
+std::vector<std::unique_ptr<Tuning>> tuningSnapshots; // oldest first, the ones that can still be in use
+uint32 tuningLoads = 0;
+std::mutex tuningMutex;                               // loads, from the watcher or the game
+uint64_t tuningWriteTime = 0;                         // of the file when it was last read
+std::thread tuningThread;
+HANDLE tuningStop = NULL;
+
+uint64_t tuningFileTime()
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(TUNING_FILE, GetFileExInfoStandard, &data)) return 0;
+    return (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+}
+
+// the line of the first problem, 0 if there isn't one
+int parseTuning(FILE * file, Tuning& out)
+{
+    char text[256];
+    for (int line = 1; fgets(text, sizeof(text), file); line++) {
+        char * comment = strchr(text, '#');
+        if (comment) *comment = '\0';
+        char name[64], extra[2];
+        float value;
+        int n = sscanf(text, "%63s %f %1s", name, &value, extra);
+        if (n <= 0) continue; // blank
+        if (n != 2) return line;
+
+        const TuningField * field = nullptr;
+        for (const TuningField& f : tuningFields) if (strcmp(f.name, name) == 0) field = &f;
+        if (!field || !(value >= field->min && value <= field->max)) return line;
+        if (field->type == TUNING_INT) {
+            if (value != floorf(value)) return line;
+            *(int*)((uint8*)&out + field->offset) = (int)value;
+        } else *(float*)((uint8*)&out + field->offset) = value;
+    }
+    return 0;
+}
+
+int loadTuning()
+{
+    std::lock_guard<std::mutex> lock(tuningMutex);
+    tuningWriteTime = tuningFileTime();
+    FILE * file = fopen(TUNING_FILE, "r");
+    if (!file) {
+        LOG_INFO("no tuning file, using the defaults", "file", TUNING_FILE);
+        return 1;
+    }
+    // what isn't in the file goes back to its default
+    std::unique_ptr<Tuning> loaded(new Tuning(defaultTuning));
+    int badLine = parseTuning(file, *loaded);
+    fclose(file);
+    if (badLine) {
+        LOG_WARN("tuning rejected, keeping the last one", "file", TUNING_FILE, "line", badLine);
+        return -1;
+    }
+
+    loaded->version = ++tuningLoads;
+    publishedTuning.store(loaded.get(), std::memory_order_release);
+    LOG_INFO("tuning loaded", "file", TUNING_FILE, "version", loaded->version);
+    tuningSnapshots.push_back(std::move(loaded));
+    return 0;
+}
+
+void tuningWatchLoop()
+{
+    HANDLE change = FindFirstChangeNotificationA(".", FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (change == INVALID_HANDLE_VALUE) {
+        LOG_WARN("can't watch the tuning file", "file", TUNING_FILE);
+        return;
+    }
+    HANDLE handles[2] = {tuningStop, change};
+    while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0+1) {
+        Sleep(TUNING_SETTLE_MS);
+        FindNextChangeNotification(change); // before reading, so a save while it's read isn't missed
+        // something in the directory changed, maybe not this file
+        uint64_t written = tuningFileTime();
+        bool changed;
+        {
+            std::lock_guard<std::mutex> lock(tuningMutex);
+            changed = written != tuningWriteTime;
+        }
+        if (changed) loadTuning();
+    }
+    FindCloseChangeNotification(change);
+}
+
+void startTuningWatch()
+{
+    if (tuningThread.joinable()) return;
+    tuningStop = CreateEventA(NULL, TRUE, FALSE, NULL);
+    tuningThread = std::thread(tuningWatchLoop);
+}
+
+void stopTuningWatch()
+{
+    if (!tuningThread.joinable()) return;
+    SetEvent(tuningStop);
+    tuningThread.join();
+    CloseHandle(tuningStop);
+    tuningStop = NULL;
+}
+
+// frees the snapshots older than both the game's and the streaming thread's
+void reclaimTuning()
+{
+    std::lock_guard<std::mutex> lock(tuningMutex);
+    uint32 oldest = chunkTuningVersion();
+    if (tuning->version < oldest) oldest = tuning->version;
+    size_t unused = 0;
+    while (unused < tuningSnapshots.size() && tuningSnapshots[unused]->version < oldest) unused++;
+    tuningSnapshots.erase(tuningSnapshots.begin(), tuningSnapshots.begin() + unused);
+}
+
+void applyTuning()
+{
+    const Tuning * last = tuning;
+    tuning = publishedTuning.load(std::memory_order_acquire);
+    if (tuning != last) reclaimTuning();
+}
+
+uint32 tuningHash(const Tuning& numbers)
+{
+    // everything but the version, which counts this process's loads
+    return saveChecksum(&numbers.playerHealth, sizeof(Tuning) - offsetof(Tuning, playerHealth));
+}
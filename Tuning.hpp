@@ -0,0 +1,76 @@
+#ifndef TUNING_HPP
+#define TUNING_HPP
+
+/*
+    gameplay tuning, read from TUNING_FILE and reloaded while the game runs
+
+    the file is "name value" lines, # starts a comment, anything left out
+    keeps its default (see tuning.txt). a file with an unknown name or a
+    value out of range is rejected whole and the last good one stays, the
+    log says which line.
+
+    each load parses into a new Tuning that is never changed afterwards and
+    publishes it through an atomic pointer. the game never reads that
+    pointer while simulating: applyTuning copies it into the plain tuning
+    pointer at the start of every tick, so a reload lands between ticks and a
+    read in the tick is a load from a global like any constant. the chunk
+    streaming thread is handed the game's pointer with each request. when
+    applyTuning picks up a new snapshot it frees the ones older than both
+    the game's and the last one handed to the streaming thread (or the one
+    it's making a chunk with), what's still in use is freed at a later
+    reload.
+
+    a watcher thread waits on FindFirstChangeNotification for the game's
+    directory and reloads when the file's write time changes. co-op doesn't
+    start it, every peer has to simulate with the same numbers from the
+    first tick to the last (the hello carries tuningHash, see Lockstep.hpp).
+    values are read where they're used, so speeds and health apply to what
+    spawns after a reload.
+*/
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define TUNING_FILE "tuning.txt"
+#define TUNING_SETTLE_MS 50 // after a change, editors can write a file in more than one go
+
+struct Tuning {
+    uint32 version; // loads so far, 0 is the built in defaults
+    // player
+    int playerHealth;
+    float playerSpeed;     // pixels per second
+    // bullets
+    float bulletSpeed;     // pixels per second
+    int bulletDamage;
+    // enemies
+    int enemyHealth;
+    float enemySpeed;      // chase speed per 10 pixels from the player, see Steering.hpp
+    // pickups
+    float batteryCharge;   // seconds of flashlight
+    int ammoPickup;
+    // upgrades on the pause menu
+    int upgradeCost;       // gems
+    float upgradeWidth, upgradeRange, upgradeCharge;
+    int upgradeBullets;
+    // light
+    int lightFalloff;      // the flashlight dims with the fraction of charge used to this power
+    float ambientLight;    // in the first room
+    int darkerEvery;       // rooms, from this deep the ambient light is also divided by depth/darkerEvery
+};
+
+extern const Tuning defaultTuning;
+extern const Tuning * tuning; // this tick's
+
+int loadTuning(); // parses TUNING_FILE and publishes it, 0 on success, 1 when there's no file, -1 when it's rejected
+void startTuningWatch();
+void stopTuningWatch();
+
+// at the start of every tick, picks up the last snapshot published
+void applyTuning();
+
+uint32 tuningHash(const Tuning& numbers); // the same on every peer loading the same numbers
+
+#endif